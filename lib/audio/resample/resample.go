@@ -0,0 +1,61 @@
+// Package resample converts audio between sample rates.
+package resample
+
+// #include "lib/resample/resample.h"
+// #include <stdlib.h>
+import "C"
+
+import (
+	"strconv"
+	"unsafe"
+)
+
+type resampleerr uint32
+
+// ErrLargeRatio is returned when the ratio between the sample rates needs too
+// many filter phases, such as 44100 Hz to 32001 Hz.
+var ErrLargeRatio error = resampleerr(C.kResampleErrLargeRatio)
+
+var errtext = [...]string{
+	C.kResampleErrInvalidRate: "invalid sample rate",
+	C.kResampleErrLargeRatio:  "sample rate ratio too complex",
+}
+
+func (e resampleerr) Error() string {
+	if e < resampleerr(len(errtext)) {
+		if s := errtext[e]; s != "" {
+			return s
+		}
+	}
+	return "resampleerr(" + strconv.Itoa(int(e)) + ")"
+}
+
+// Resample converts 16-bit mono audio from one sample rate to another.
+func Resample(data []int16, inRate, outRate int) ([]int16, error) {
+	var spec C.struct_resample_spec
+	if err := C.resample_init(&spec, C.int(inRate), C.int(outRate)); err != 0 {
+		return nil, resampleerr(err)
+	}
+	if len(data) == 0 {
+		return nil, nil
+	}
+	nout := int(C.resample_output_count(&spec, C.size_t(len(data))))
+	out := make([]int16, nout)
+	if nout == 0 {
+		return out, nil
+	}
+	filter := C.malloc(C.resample_filter_size(&spec) * C.sizeof_float)
+	defer C.free(filter)
+	C.resample_make_filter(&spec, (*C.float)(filter))
+	scratch := C.malloc(C.resample_scratch_size(&spec, C.size_t(len(data))))
+	defer C.free(scratch)
+	C.resample(
+		&spec,
+		(*C.float)(filter),
+		C.size_t(nout),
+		(*C.int16_t)(unsafe.Pointer(&out[0])),
+		C.size_t(len(data)),
+		(*C.int16_t)(unsafe.Pointer(&data[0])),
+		scratch)
+	return out, nil
+}
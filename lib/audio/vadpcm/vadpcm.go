@@ -8,6 +8,7 @@ import "C"
 import (
 	"errors"
 	"fmt"
+	"math"
 	"strconv"
 	"unsafe"
 )
@@ -110,6 +111,13 @@ func Decode(codebook *Codebook, state *Vector, dest []int16, src []byte) (int, e
 // Parameters contains the parameters for encoding,
 type Parameters struct {
 	PredictorCount int
+
+	// ClosedLoop chooses the predictor for each frame by encoding the frame
+	// with every predictor and keeping the one with the lowest error.
+	ClosedLoop bool
+
+	// TargetSNR is the target signal-to-noise ratio, in dB, for EncodeAuto.
+	TargetSNR float64
 }
 
 // Encode encodes audio as VADPCM.
@@ -136,6 +144,9 @@ func Encode(params *Parameters, data []int16) (*Codebook, []byte, error) {
 	cparams := C.struct_vadpcm_params{
 		predictor_count: C.int(predictor_count),
 	}
+	if params.ClosedLoop {
+		cparams.closed_loop = 1
+	}
 	vecs := make([]Vector, nvec)
 	scratchsz := C.vadpcm_encode_scratch_size(C.size_t(nframes))
 	scratch := C.malloc(scratchsz)
@@ -157,3 +168,51 @@ func Encode(params *Parameters, data []int16) (*Codebook, []byte, error) {
 		Vectors:        vecs,
 	}, dest, nil
 }
+
+// EncodeAuto encodes audio as VADPCM, using the smallest predictor count that
+// meets the target SNR. The PredictorCount parameter is the largest predictor
+// count to try. Returns the SNR of the encoded audio.
+func EncodeAuto(params *Parameters, data []int16) (*Codebook, []byte, float64, error) {
+	max_count := params.PredictorCount
+	if max_count < 1 || MaxPredictorCount < max_count {
+		return nil, nil, 0, fmt.Errorf("invalid predictor count: %d", max_count)
+	}
+	nframes := len(data) / FrameSampleCount
+	if nframes == 0 {
+		return &Codebook{
+			Order:          EncodeOrder,
+			PredictorCount: 1,
+			Vectors:        make([]Vector, EncodeOrder),
+		}, nil, math.Inf(1), nil
+	}
+	cparams := C.struct_vadpcm_params{
+		predictor_count: C.int(max_count),
+		target_snr:      C.double(params.TargetSNR),
+	}
+	if params.ClosedLoop {
+		cparams.closed_loop = 1
+	}
+	vecs := make([]Vector, max_count*EncodeOrder)
+	scratchsz := C.vadpcm_encode_scratch_size(C.size_t(nframes))
+	scratch := C.malloc(scratchsz)
+	defer C.free(scratch)
+	dest := make([]byte, nframes*FrameByteSize)
+	var result C.struct_vadpcm_auto_result
+	err := C.vadpcm_encode_auto(
+		&cparams,
+		&result,
+		(*C.struct_vadpcm_vector)(unsafe.Pointer(&vecs[0])),
+		C.size_t(nframes),
+		unsafe.Pointer(&dest[0]),
+		(*C.int16_t)(unsafe.Pointer(&data[0])),
+		unsafe.Pointer(scratch))
+	if err != 0 {
+		return nil, nil, 0, vadpcmerr(err)
+	}
+	predictor_count := int(result.predictor_count)
+	return &Codebook{
+		Order:          EncodeOrder,
+		PredictorCount: predictor_count,
+		Vectors:        vecs[:predictor_count*EncodeOrder],
+	}, dest, float64(result.snr), nil
+}
@@ -267,6 +267,11 @@ void Parser::Parse(int argc, char **argv) {
     } catch (UsageError &e) { FailUsage(e.what()); }
 }
 
+void Parser::ParseList(int argc, char **argv) {
+    ProgramArguments args(argc, argv);
+    ParseAll(args);
+}
+
 void Parser::ParseMain(int argc, char **argv) {
     if (argc > 1) {
         Parse(argc - 1, argv + 1);
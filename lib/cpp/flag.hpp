@@ -203,6 +203,11 @@ public:
     // Parse all command-line arguments, including the program name.
     void ParseMain(int argc, char **argv);
 
+    // Parse arguments which do not come from the command line. Throws
+    // UsageError if there are any problems with the arguments, instead of
+    // exiting.
+    void ParseList(int argc, char **argv);
+
 private:
     void ParseAll(ProgramArguments &args);
     void ParseNext(ProgramArguments &args);
@@ -0,0 +1,166 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "lib/cpp/json.hpp"
+
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace util {
+
+namespace {
+
+const char HEX_DIGIT[16] = {'0', '1', '2', '3', '4', '5', '6', '7',
+                            '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+} // namespace
+
+void JSONWriter::BeginObject() {
+    Open(true, '{');
+}
+
+void JSONWriter::EndObject() {
+    Close(true, '}');
+}
+
+void JSONWriter::BeginArray() {
+    Open(false, '[');
+}
+
+void JSONWriter::EndArray() {
+    Close(false, ']');
+}
+
+void JSONWriter::Key(std::string_view key) {
+    if (m_stack.empty() || !m_stack.back().object || m_has_key) {
+        throw std::logic_error("JSONWriter: unexpected key");
+    }
+    NewLine();
+    WriteString(key);
+    m_text.append(": ");
+    m_has_key = true;
+}
+
+void JSONWriter::String(std::string_view value) {
+    BeginValue();
+    WriteString(value);
+}
+
+void JSONWriter::Int(int64_t value) {
+    BeginValue();
+    fmt::format_to(std::back_inserter(m_text), "{}", value);
+}
+
+void JSONWriter::Double(double value) {
+    BeginValue();
+    if (std::isfinite(value)) {
+        fmt::format_to(std::back_inserter(m_text), "{}", value);
+    } else {
+        m_text.append("null");
+    }
+}
+
+void JSONWriter::Bool(bool value) {
+    BeginValue();
+    m_text.append(value ? "true" : "false");
+}
+
+void JSONWriter::Null() {
+    BeginValue();
+    m_text.append("null");
+}
+
+std::string JSONWriter::Finish() {
+    if (!m_stack.empty()) {
+        throw std::logic_error("JSONWriter: unclosed object or array");
+    }
+    m_text.push_back('\n');
+    std::string text;
+    std::swap(text, m_text);
+    return text;
+}
+
+void JSONWriter::Open(bool object, char c) {
+    BeginValue();
+    m_text.push_back(c);
+    m_stack.push_back(Level{object, 0});
+}
+
+void JSONWriter::Close(bool object, char c) {
+    if (m_stack.empty() || m_stack.back().object != object || m_has_key) {
+        throw std::logic_error("JSONWriter: unexpected end of object or array");
+    }
+    const int count = m_stack.back().count;
+    m_stack.pop_back();
+    if (count != 0) {
+        m_text.push_back('\n');
+        m_text.append(m_stack.size() * 2, ' ');
+    }
+    m_text.push_back(c);
+}
+
+// Start writing a value. Values in objects follow their key, and values in
+// arrays go on their own line.
+void JSONWriter::BeginValue() {
+    if (m_stack.empty()) {
+        if (!m_text.empty()) {
+            throw std::logic_error("JSONWriter: multiple top-level values");
+        }
+        return;
+    }
+    if (m_stack.back().object) {
+        if (!m_has_key) {
+            throw std::logic_error("JSONWriter: missing key");
+        }
+        m_has_key = false;
+        return;
+    }
+    NewLine();
+}
+
+// Start a new line for a key or array element, after a comma if needed.
+void JSONWriter::NewLine() {
+    if (m_stack.back().count++ != 0) {
+        m_text.push_back(',');
+    }
+    m_text.push_back('\n');
+    m_text.append(m_stack.size() * 2, ' ');
+}
+
+void JSONWriter::WriteString(std::string_view value) {
+    m_text.push_back('"');
+    for (const unsigned char c : value) {
+        switch (c) {
+        case '"':
+            m_text.append("\\\"");
+            break;
+        case '\\':
+            m_text.append("\\\\");
+            break;
+        case '\n':
+            m_text.append("\\n");
+            break;
+        case '\r':
+            m_text.append("\\r");
+            break;
+        case '\t':
+            m_text.append("\\t");
+            break;
+        default:
+            if (c < 32) {
+                m_text.append("\\u00");
+                m_text.push_back(HEX_DIGIT[c >> 4]);
+                m_text.push_back(HEX_DIGIT[c & 15]);
+            } else {
+                m_text.push_back(c);
+            }
+            break;
+        }
+    }
+    m_text.push_back('"');
+}
+
+} // namespace util
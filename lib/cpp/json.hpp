@@ -0,0 +1,52 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace util {
+
+// Writer for indented JSON text. Objects and arrays are opened and closed
+// explicitly, and each value in an object must be preceded by its key.
+class JSONWriter {
+public:
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    // Write the key for the next value in an object.
+    void Key(std::string_view key);
+
+    void String(std::string_view value);
+    void Int(int64_t value);
+    void Double(double value); // Non-finite values are written as null.
+    void Bool(bool value);
+    void Null();
+
+    // Get the JSON text. All objects and arrays must be closed.
+    std::string Finish();
+
+private:
+    // An open object or array.
+    struct Level {
+        bool object;
+        int count; // Number of values written so far.
+    };
+
+    void Open(bool object, char c);
+    void Close(bool object, char c);
+    void BeginValue();
+    void NewLine();
+    void WriteString(std::string_view value);
+
+    std::string m_text;
+    std::vector<Level> m_stack;
+    bool m_has_key = false;
+};
+
+} // namespace util
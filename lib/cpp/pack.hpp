@@ -3,6 +3,7 @@
 // Mozilla Public License, version 2.0. See LICENSE.txt for details.
 #pragma once
 
+#include <array>
 #include <cstdint>
 
 namespace util {
@@ -0,0 +1,203 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "lib/resample/resample.h"
+
+#include <math.h>
+#include <string.h>
+
+enum {
+    // Number of zero crossings of the sinc function on each side of the filter
+    // center, at the input rate or output rate, whichever is lower.
+    kResampleZeroCrossings = 16,
+};
+
+// Filter cutoff, relative to the Nyquist frequency of the lower sample rate.
+static const double kResampleCutoff = 0.92;
+
+// Kaiser window shape parameter.
+static const double kResampleKaiserBeta = 8.0;
+
+const char *resample_error_name(resample_error err) {
+    switch (err) {
+    case kResampleErrNone:
+        return "no error";
+    case kResampleErrInvalidRate:
+        return "invalid sample rate";
+    case kResampleErrLargeRatio:
+        return "sample rate ratio too complex";
+    }
+    return 0;
+}
+
+static int resample_gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+resample_error resample_init(struct resample_spec *restrict spec, int in_rate,
+                             int out_rate) {
+    if (in_rate <= 0 || out_rate <= 0) {
+        return kResampleErrInvalidRate;
+    }
+    int gcd = resample_gcd(in_rate, out_rate);
+    int up = out_rate / gcd;
+    int down = in_rate / gcd;
+    if (up > kResampleMaxPhaseCount) {
+        return kResampleErrLargeRatio;
+    }
+    int tap_count;
+    if (up == down) {
+        tap_count = kResampleLaneCount;
+    } else {
+        // When downsampling, the filter is stretched to cut off below the
+        // output Nyquist frequency.
+        int half = kResampleZeroCrossings;
+        if (down > up) {
+            half = (kResampleZeroCrossings * down + up - 1) / up;
+        }
+        tap_count = 2 * half + kResampleLaneCount - 1;
+        tap_count -= tap_count % kResampleLaneCount;
+    }
+    spec->up = up;
+    spec->down = down;
+    spec->tap_count = tap_count;
+    return 0;
+}
+
+size_t resample_filter_size(const struct resample_spec *restrict spec) {
+    return (size_t)spec->up * spec->tap_count;
+}
+
+// Modified Bessel function of the first kind, order zero.
+static double resample_bessel_i0(double x) {
+    double sum = 1.0, term = 1.0, y = x * x * 0.25;
+    for (int k = 1; k < 50; k++) {
+        term *= y / ((double)k * k);
+        sum += term;
+        if (term < sum * 1.0e-16) {
+            break;
+        }
+    }
+    return sum;
+}
+
+void resample_make_filter(const struct resample_spec *restrict spec,
+                          float *restrict filter) {
+    int up = spec->up, tap_count = spec->tap_count;
+    int center = tap_count / 2 - 1;
+    if (spec->up == spec->down) {
+        // Identity.
+        memset(filter, 0, sizeof(*filter) * tap_count);
+        filter[center] = 1.0f;
+        return;
+    }
+    double fc = kResampleCutoff;
+    if (spec->down > up) {
+        fc *= (double)up / spec->down;
+    }
+    double half = 0.5 * tap_count;
+    double wscale = 1.0 / resample_bessel_i0(kResampleKaiserBeta);
+    for (int phase = 0; phase < up; phase++) {
+        // Tap k is applied to the input sample at distance d from the output
+        // sample position.
+        float *restrict h = filter + (size_t)phase * tap_count;
+        double frac = (double)phase / up;
+        double sum = 0.0;
+        for (int k = 0; k < tap_count; k++) {
+            double d = k - center - frac;
+            double s = fc * d;
+            double v = s == 0.0 ? fc : fc * sin(M_PI * s) / (M_PI * s);
+            double r = d / half;
+            double w = 0.0;
+            if (r > -1.0 && r < 1.0) {
+                w = wscale *
+                    resample_bessel_i0(kResampleKaiserBeta * sqrt(1.0 - r * r));
+            }
+            h[k] = (float)(v * w);
+            sum += (double)h[k];
+        }
+        // Normalize for unity gain at DC.
+        float a = (float)(1.0 / sum);
+        for (int k = 0; k < tap_count; k++) {
+            h[k] *= a;
+        }
+    }
+}
+
+size_t resample_output_count(const struct resample_spec *restrict spec,
+                             size_t input_count) {
+    return (input_count * spec->up + spec->down - 1) / spec->down;
+}
+
+size_t resample_scratch_size(const struct resample_spec *restrict spec,
+                             size_t input_count) {
+    return sizeof(float) * (input_count + spec->tap_count);
+}
+
+// Apply one phase of the filter. The taps are summed in separate lanes, so the
+// loop can be vectorized without reordering floating-point operations.
+static float resample_dot(int tap_count, const float *restrict h,
+                          const float *restrict x) {
+    float acc[kResampleLaneCount];
+    for (int j = 0; j < kResampleLaneCount; j++) {
+        acc[j] = 0.0f;
+    }
+    for (int k = 0; k < tap_count; k += kResampleLaneCount) {
+        for (int j = 0; j < kResampleLaneCount; j++) {
+            acc[j] += h[k + j] * x[k + j];
+        }
+    }
+    for (int n = kResampleLaneCount / 2; n > 0; n /= 2) {
+        for (int j = 0; j < n; j++) {
+            acc[j] += acc[j + n];
+        }
+    }
+    return acc[0];
+}
+
+void resample(const struct resample_spec *restrict spec,
+              const float *restrict filter, size_t output_count,
+              int16_t *restrict dest, size_t input_count,
+              const int16_t *restrict src, void *scratch) {
+    int up = spec->up, down = spec->down, tap_count = spec->tap_count;
+
+    // Convert input to floating-point, with silence on either side. The
+    // window of input for output sample n starts at index floor(n*down/up).
+    float *restrict buf = scratch;
+    int pad = tap_count / 2 - 1;
+    for (int i = 0; i < pad; i++) {
+        buf[i] = 0.0f;
+    }
+    for (size_t i = 0; i < input_count; i++) {
+        buf[pad + i] = (float)src[i];
+    }
+    for (size_t i = pad + input_count; i < input_count + tap_count; i++) {
+        buf[i] = 0.0f;
+    }
+
+    int step = down / up, fstep = down % up;
+    size_t pos = 0;
+    int phase = 0;
+    for (size_t n = 0; n < output_count; n++) {
+        float x = resample_dot(tap_count, filter + (size_t)phase * tap_count,
+                               buf + pos);
+        long v = lrintf(x);
+        if (v > 0x7fff) {
+            v = 0x7fff;
+        } else if (v < -0x8000) {
+            v = -0x8000;
+        }
+        dest[n] = v;
+        pos += step;
+        phase += fstep;
+        if (phase >= up) {
+            phase -= up;
+            pos++;
+        }
+    }
+}
@@ -0,0 +1,100 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+// Sample rate conversion, using a polyphase windowed-sinc filter.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define RESAMPLE_RESTRICT
+extern "C" {
+#else
+#define RESAMPLE_RESTRICT restrict
+#endif
+
+// Library error codes.
+typedef enum {
+    // No error (success). Equal to 0.
+    kResampleErrNone,
+
+    // Sample rate is not positive.
+    kResampleErrInvalidRate,
+
+    // The ratio between the sample rates needs too many filter phases.
+    kResampleErrLargeRatio,
+} resample_error;
+
+// Return the short name of the resampler error code. Returns NULL for unknown
+// error codes.
+const char *resample_error_name(resample_error err);
+
+enum {
+    // The number of filter taps in each phase is a multiple of this number, so
+    // the filter loop can be vectorized.
+    kResampleLaneCount = 8,
+
+    // The maximum number of filter phases, which is the output rate divided by
+    // the greatest common divisor of the input and output rates.
+    kResampleMaxPhaseCount = 4096,
+};
+
+// Specification for a resampling filter.
+struct resample_spec {
+    // Ratio of output rate to input rate, in lowest terms. The filter has
+    // 'up' phases.
+    int up;
+    int down;
+
+    // Number of filter taps in each phase. A multiple of kResampleLaneCount.
+    int tap_count;
+};
+
+// Create the specification for a filter which converts audio from in_rate to
+// out_rate.
+//
+// Error codes:
+//   kResampleErrInvalidRate: A sample rate is not positive.
+//   kResampleErrLargeRatio: The filter would need more than
+//                           kResampleMaxPhaseCount phases.
+resample_error resample_init(struct resample_spec *RESAMPLE_RESTRICT spec,
+                             int in_rate, int out_rate);
+
+// Return the number of coefficients in the filter, which is up * tap_count.
+size_t resample_filter_size(const struct resample_spec *RESAMPLE_RESTRICT spec);
+
+// Calculate the filter coefficients. The filter array has
+// resample_filter_size(spec) elements.
+void resample_make_filter(const struct resample_spec *RESAMPLE_RESTRICT spec,
+                          float *RESAMPLE_RESTRICT filter);
+
+// Return the number of output samples for the given number of input samples.
+size_t resample_output_count(const struct resample_spec *RESAMPLE_RESTRICT spec,
+                             size_t input_count);
+
+// Return the amount of scratch space needed to resample the given number of
+// input samples.
+size_t resample_scratch_size(const struct resample_spec *RESAMPLE_RESTRICT spec,
+                             size_t input_count);
+
+// Resample audio. The audio before the start and after the end of the input is
+// treated as silence.
+//
+// Arguments:
+//   spec: Filter specification
+//   filter: Filter coefficients, from resample_make_filter
+//   output_count: Number of samples to write to dest, at most
+//                 resample_output_count(spec, input_count)
+//   dest: Output array of output_count samples
+//   input_count: Number of input samples
+//   src: Input array of input_count samples
+//   scratch: Scratch space with size resample_scratch_size(spec, input_count)
+void resample(const struct resample_spec *RESAMPLE_RESTRICT spec,
+              const float *RESAMPLE_RESTRICT filter, size_t output_count,
+              int16_t *RESAMPLE_RESTRICT dest, size_t input_count,
+              const int16_t *RESAMPLE_RESTRICT src, void *scratch);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,140 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "lib/resample/resample.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failure_count;
+
+// Allocate memory, or abort on failure.
+static void *xmalloc(size_t nbytes) {
+    void *ptr = malloc(nbytes > 0 ? nbytes : 1);
+    if (ptr == NULL) {
+        fputs("error: no memory\n", stderr);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Resample a sine wave with the given amplitude and frequency, in Hz. Returns
+// the RMS level of the output, relative to full scale, and the RMS level of the
+// difference between the output and the ideal output. Samples near the ends
+// are not measured.
+static void resample_sine(int in_rate, int out_rate, double freq,
+                          double *level, double *error) {
+    struct resample_spec spec;
+    resample_error err = resample_init(&spec, in_rate, out_rate);
+    if (err != 0) {
+        fprintf(stderr, "error: resample_init(%d, %d): %s\n", in_rate,
+                out_rate, resample_error_name(err));
+        test_failure_count++;
+        *level = 0.0;
+        *error = 0.0;
+        return;
+    }
+    const double amplitude = 16384.0;
+    size_t input_count = in_rate / 4;
+    size_t output_count = resample_output_count(&spec, input_count);
+    float *filter = xmalloc(sizeof(*filter) * resample_filter_size(&spec));
+    int16_t *in = xmalloc(sizeof(*in) * input_count);
+    int16_t *out = xmalloc(sizeof(*out) * output_count);
+    void *scratch = xmalloc(resample_scratch_size(&spec, input_count));
+    for (size_t i = 0; i < input_count; i++) {
+        in[i] = lrint(amplitude * sin(2.0 * M_PI * freq * i / in_rate));
+    }
+    resample_make_filter(&spec, filter);
+    resample(&spec, filter, output_count, out, input_count, in, scratch);
+    double sig = 0.0, noise = 0.0;
+    size_t margin = output_count / 8, count = 0;
+    for (size_t i = margin; i < output_count - margin; i++) {
+        double x = out[i];
+        double ref = amplitude * sin(2.0 * M_PI * freq * i / out_rate);
+        sig += x * x;
+        noise += (x - ref) * (x - ref);
+        count++;
+    }
+    *level = sqrt(sig / count) / 32768.0;
+    *error = sqrt(noise / count) / 32768.0;
+    free(filter);
+    free(in);
+    free(out);
+    free(scratch);
+}
+
+static void test_identity(void) {
+    // Resampling at the same rate should not change the audio.
+    struct resample_spec spec;
+    resample_init(&spec, 22050, 22050);
+    int16_t in[100], out[100];
+    for (int i = 0; i < 100; i++) {
+        in[i] = (i * 7919) % 65536 - 32768;
+    }
+    float *filter = xmalloc(sizeof(*filter) * resample_filter_size(&spec));
+    void *scratch = xmalloc(resample_scratch_size(&spec, 100));
+    resample_make_filter(&spec, filter);
+    if (resample_output_count(&spec, 100) != 100) {
+        fputs("error: test_identity: wrong output count\n", stderr);
+        test_failure_count++;
+    }
+    resample(&spec, filter, 100, out, 100, in, scratch);
+    for (int i = 0; i < 100; i++) {
+        if (in[i] != out[i]) {
+            fprintf(stderr, "error: test_identity: index %d: %d != %d\n", i,
+                    in[i], out[i]);
+            test_failure_count++;
+            break;
+        }
+    }
+    free(filter);
+    free(scratch);
+}
+
+static void test_passband(void) {
+    // Tones well below the cutoff should be reproduced accurately.
+    static const int kRates[][2] = {
+        {44100, 32000},
+        {48000, 22050},
+        {22050, 32000},
+        {8000, 44100},
+    };
+    for (size_t i = 0; i < sizeof(kRates) / sizeof(*kRates); i++) {
+        double level, error;
+        resample_sine(kRates[i][0], kRates[i][1], 1000.0, &level, &error);
+        double snr = 20.0 * log10(level / error);
+        if (!(snr > 60.0)) {
+            fprintf(stderr, "error: test_passband %d -> %d: SNR = %.1f dB\n",
+                    kRates[i][0], kRates[i][1], snr);
+            test_failure_count++;
+        }
+    }
+}
+
+static void test_stopband(void) {
+    // Tones above the output Nyquist frequency should be removed.
+    double level, error;
+    resample_sine(44100, 16000, 12000.0, &level, &error);
+    double db = 20.0 * log10(level);
+    if (!(db < -70.0)) {
+        fprintf(stderr, "error: test_stopband: level = %.1f dB\n", db);
+        test_failure_count++;
+    }
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    test_identity();
+    test_passband();
+    test_stopband();
+
+    if (test_failure_count > 0) {
+        fprintf(stderr, "tests failed: %d\n", test_failure_count);
+        return 1;
+    }
+    fputs("all tests passed\n", stderr);
+    return 0;
+}
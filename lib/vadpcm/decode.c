@@ -4,6 +4,7 @@
 #include "lib/vadpcm/vadpcm.h"
 
 #include <limits.h>
+#include <string.h>
 
 #include <stdio.h>
 
@@ -83,6 +84,74 @@ vadpcm_error vadpcm_decode(int predictor_count, int order,
     return 0;
 }
 
+// Copy samples into a ring buffer, wrapping around at the end. Returns the new
+// position in the ring buffer.
+static size_t vadpcm_ring_write(int16_t *restrict dest, size_t dest_size,
+                                size_t dest_pos, const int16_t *restrict src,
+                                size_t count) {
+    size_t n = dest_size - dest_pos;
+    if (n > count) {
+        n = count;
+    }
+    memcpy(dest + dest_pos, src, sizeof(*dest) * n);
+    dest_pos += n;
+    if (n < count) {
+        memcpy(dest, src + n, sizeof(*dest) * (count - n));
+        dest_pos = count - n;
+    }
+    return dest_pos == dest_size ? 0 : dest_pos;
+}
+
+vadpcm_error vadpcm_decode_ring(int predictor_count, int order,
+                                const struct vadpcm_vector *restrict codebook,
+                                struct vadpcm_vector *restrict state,
+                                size_t start, size_t end,
+                                int16_t *restrict dest, size_t dest_size,
+                                size_t dest_pos, const void *restrict src) {
+    if (end <= start) {
+        return 0;
+    }
+    const uint8_t *sptr = src;
+    size_t frame = start / kVADPCMFrameSampleCount;
+    size_t end_frame = end / kVADPCMFrameSampleCount;
+    int16_t buf[kVADPCMFrameSampleCount];
+    vadpcm_error err;
+
+    // Frames before the first sample are only decoded to update the state.
+    for (size_t i = 0; i < frame; i++) {
+        err = vadpcm_decode(predictor_count, order, codebook, state, 1, buf,
+                            sptr + kVADPCMFrameByteSize * i);
+        if (err != 0) {
+            return err;
+        }
+    }
+    size_t pos = start % kVADPCMFrameSampleCount;
+    for (; frame < end_frame; frame++) {
+        err = vadpcm_decode(predictor_count, order, codebook, state, 1, buf,
+                            sptr + kVADPCMFrameByteSize * frame);
+        if (err != 0) {
+            return err;
+        }
+        dest_pos = vadpcm_ring_write(dest, dest_size, dest_pos, buf + pos,
+                                     kVADPCMFrameSampleCount - pos);
+        pos = 0;
+    }
+
+    // The last frame is decoded with a copy of the state, so the state stays
+    // aligned to the start of this frame.
+    size_t rem = end % kVADPCMFrameSampleCount;
+    if (rem > pos) {
+        struct vadpcm_vector tstate = *state;
+        err = vadpcm_decode(predictor_count, order, codebook, &tstate, 1, buf,
+                            sptr + kVADPCMFrameByteSize * frame);
+        if (err != 0) {
+            return err;
+        }
+        vadpcm_ring_write(dest, dest_size, dest_pos, buf + pos, rem - pos);
+    }
+    return 0;
+}
+
 #if TEST
 #include "lib/vadpcm/test.h"
 
@@ -120,4 +189,86 @@ done:
     free(out_pcm);
 }
 
+
+void test_decode_ring(const char *name, int predictor_count, int order,
+                      struct vadpcm_vector *codebook, size_t frame_count,
+                      const void *vadpcm, const int16_t *pcm) {
+    // Decode in chunks of varying size, starting at varying offsets, into a
+    // ring buffer whose size is not a multiple of the frame size. The output
+    // should match the reference.
+    enum { kRingSize = 37 };
+    size_t sample_count = frame_count * kVADPCMFrameSampleCount;
+    int16_t ring[kRingSize];
+    struct vadpcm_vector state = {{0}};
+    const uint8_t *src = vadpcm;
+    size_t pos = 0, ring_pos = 0, start = 0;
+    uint32_t rng = 1;
+    while (pos < sample_count) {
+        size_t n = 1 + (rng >> 16) % kRingSize;
+        rng = rng * 1103515245 + 12345;
+        if (n > sample_count - pos) {
+            n = sample_count - pos;
+        }
+        vadpcm_error err =
+            vadpcm_decode_ring(predictor_count, order, codebook, &state, start,
+                               start + n, ring, kRingSize, ring_pos, src);
+        if (err != 0) {
+            fprintf(stderr, "error: test_decode_ring %s: %s", name,
+                    vadpcm_error_name2(err));
+            test_failure_count++;
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            int16_t x = ring[(ring_pos + i) % kRingSize];
+            if (x != pcm[pos + i]) {
+                fprintf(stderr,
+                        "error: test_decode_ring %s: output does not match, "
+                        "index = %zu, expected %d, got %d\n",
+                        name, pos + i, pcm[pos + i], x);
+                test_failure_count++;
+                return;
+            }
+        }
+        pos += n;
+        ring_pos = (ring_pos + n) % kRingSize;
+        start += n;
+        src += kVADPCMFrameByteSize * (start / kVADPCMFrameSampleCount);
+        start %= kVADPCMFrameSampleCount;
+    }
+
+    // Decode from the beginning of the input, with start several frames in,
+    // so the earlier frames are only decoded to advance the state.
+    static const size_t kStarts[] = {
+        kVADPCMFrameSampleCount,
+        3 * kVADPCMFrameSampleCount + 5,
+        10 * kVADPCMFrameSampleCount + 15,
+    };
+    for (size_t i = 0; i < sizeof(kStarts) / sizeof(*kStarts); i++) {
+        start = kStarts[i];
+        if (start + kRingSize > sample_count) {
+            continue;
+        }
+        memset(&state, 0, sizeof(state));
+        vadpcm_error err = vadpcm_decode_ring(
+            predictor_count, order, codebook, &state, start, start + kRingSize,
+            ring, kRingSize, 0, vadpcm);
+        if (err != 0) {
+            fprintf(stderr, "error: test_decode_ring %s: %s", name,
+                    vadpcm_error_name2(err));
+            test_failure_count++;
+            return;
+        }
+        for (size_t j = 0; j < kRingSize; j++) {
+            if (ring[j] != pcm[start + j]) {
+                fprintf(stderr,
+                        "error: test_decode_ring %s: output does not match, "
+                        "start = %zu, index = %zu, expected %d, got %d\n",
+                        name, start, start + j, pcm[start + j], ring[j]);
+                test_failure_count++;
+                return;
+            }
+        }
+    }
+}
+
 #endif
@@ -16,6 +16,10 @@ enum {
 
     // Iterations for predictor assignment.
     kVADPCMIterations = 20,
+
+    // Iterations for each predictor added when choosing the predictor count
+    // automatically.
+    kVADPCMGrowIterations = 5,
 };
 
 // Autocorrelation is a symmetric 3x3 matrix.
@@ -312,6 +316,25 @@ static void vadpcm_assign_predictors(size_t frame_count, int predictor_count,
     }
 }
 
+// Add one predictor to an existing assignment of frames to predictors, and
+// refine the result. The first predictor_count - 1 predictors must already be
+// assigned, and the error array must contain the error for that assignment.
+static void vadpcm_grow_predictors(size_t frame_count, int predictor_count,
+                                   const float (*restrict corr)[6],
+                                   const float *restrict best_error,
+                                   float *restrict error,
+                                   uint8_t *restrict predictors) {
+    int unassigned = predictor_count - 1;
+    for (int iter = 0; iter < kVADPCMGrowIterations; iter++) {
+        if (unassigned < predictor_count) {
+            size_t worst = vadpcm_worst_frame(frame_count, best_error, error);
+            predictors[worst] = unassigned;
+        }
+        unassigned = vadpcm_refine_predictors(frame_count, predictor_count,
+                                              corr, error, predictors);
+    }
+}
+
 // Calculate codebook vectors for one predictor, given the predictor
 // coefficients.
 static void vadpcm_make_vectors(
@@ -488,6 +511,218 @@ static void vadpcm_encode_data(size_t frame_count, void *restrict dest,
     }
 }
 
+// Codebook for closed-loop encoding, transposed so that the predictor index is
+// the innermost index. The trial encoder runs every predictor in lockstep, and
+// this layout lets the compiler vectorize the loops across predictors.
+struct vadpcm_lanes {
+    int coeff[2][8][kVADPCMMaxPredictorCount];
+};
+
+// Result of encoding one frame with every predictor.
+struct vadpcm_trial {
+    double error[kVADPCMMaxPredictorCount];
+    int shift[kVADPCMMaxPredictorCount];
+    int state[2][kVADPCMMaxPredictorCount];
+    int residual[16][kVADPCMMaxPredictorCount];
+};
+
+// Transpose a codebook for closed-loop encoding. Unused predictors are zero.
+static void vadpcm_make_lanes(int predictor_count,
+                              const struct vadpcm_vector *restrict codebook,
+                              struct vadpcm_lanes *restrict lanes) {
+    memset(lanes, 0, sizeof(*lanes));
+    for (int p = 0; p < predictor_count; p++) {
+        for (int k = 0; k < 2; k++) {
+            for (int i = 0; i < 8; i++) {
+                lanes->coeff[k][i][p] = codebook[2 * p + k].v[i];
+            }
+        }
+    }
+}
+
+// Encode a frame with every predictor. This produces the same result for each
+// predictor as vadpcm_encode_data. The rounding bias for each sample is given
+// by the upper 16 bits of the random number generator state.
+static void vadpcm_encode_trial(const struct vadpcm_lanes *restrict lanes,
+                                const int16_t *restrict src,
+                                const int state[restrict static 2],
+                                const int bias[restrict static 16],
+                                struct vadpcm_trial *restrict out) {
+    enum { N = kVADPCMMaxPredictorCount };
+    const int(*restrict c0)[N] = lanes->coeff[0];
+    const int(*restrict c1)[N] = lanes->coeff[1];
+    int accumulator[8][N], res[N], min[N], max[N], shift[N];
+
+    // Calculate the residual with full precision, and figure out the scaling
+    // factor necessary to encode it.
+    for (int p = 0; p < N; p++) {
+        min[p] = 0;
+        max[p] = 0;
+    }
+    for (int vector = 0; vector < 2; vector++) {
+        int s0 = vector == 0 ? state[0] : src[6];
+        int s1 = vector == 0 ? state[1] : src[7];
+        for (int i = 0; i < 8; i++) {
+            for (int p = 0; p < N; p++) {
+                accumulator[i][p] = (src[vector * 8 + i] << 11) -
+                                    s0 * c0[i][p] - s1 * c1[i][p];
+            }
+        }
+        for (int i = 0; i < 8; i++) {
+            for (int p = 0; p < N; p++) {
+                int s = accumulator[i][p] >> 11;
+                res[p] = s;
+                min[p] = s < min[p] ? s : min[p];
+                max[p] = s > max[p] ? s : max[p];
+            }
+            for (int j = 0; j < 7 - i; j++) {
+                for (int p = 0; p < N; p++) {
+                    accumulator[i + 1 + j][p] -= res[p] * c1[j][p];
+                }
+            }
+        }
+    }
+    // Same as vadpcm_getshift, without the data-dependent loop.
+    for (int p = 0; p < N; p++) {
+        shift[p] = 0;
+    }
+    for (int k = 0; k < 12; k++) {
+        for (int p = 0; p < N; p++) {
+            shift[p] += (min[p] >> k) < -8 || 7 < (max[p] >> k);
+        }
+    }
+
+    // Try a range of 3 shift values, and keep the shift value that produces
+    // the lowest error. Out-of-range shift values are clamped, which repeats a
+    // trial but does not change the result.
+    for (int trial = 0; trial < 3; trial++) {
+        int tshift[N], s0[N], s1[N], residual[16][N];
+        double error[N];
+        for (int p = 0; p < N; p++) {
+            int t = shift[p] + trial - 1;
+            tshift[p] = t < 0 ? 0 : t > 12 ? 12 : t;
+            s0[p] = state[0];
+            s1[p] = state[1];
+            error[p] = 0.0;
+        }
+        for (int vector = 0; vector < 2; vector++) {
+            for (int i = 0; i < 8; i++) {
+                for (int p = 0; p < N; p++) {
+                    accumulator[i][p] = s0[p] * c0[i][p] + s1[p] * c1[i][p];
+                }
+            }
+            for (int i = 0; i < 8; i++) {
+                int s = src[vector * 8 + i];
+                int b = bias[vector * 8 + i];
+                for (int p = 0; p < N; p++) {
+                    int a = accumulator[i][p] >> 11;
+                    // Calculate the residual, encode as 4 bits.
+                    int r = (s - a + (b >> (16 - tshift[p]))) >> tshift[p];
+                    r = r > 7 ? 7 : r < -8 ? -8 : r;
+                    residual[vector * 8 + i][p] = r;
+                    res[p] = r << tshift[p];
+                    // Update state to match decoder.
+                    int sout = res[p] + a;
+                    s0[p] = s1[p];
+                    s1[p] = sout;
+                    // Track encoding error.
+                    double serror = s - sout;
+                    error[p] += serror * serror;
+                }
+                for (int j = 0; j < 7 - i; j++) {
+                    for (int p = 0; p < N; p++) {
+                        accumulator[i + 1 + j][p] += res[p] * c1[j][p];
+                    }
+                }
+            }
+        }
+        for (int p = 0; p < N; p++) {
+            if (trial == 0 || error[p] < out->error[p]) {
+                out->error[p] = error[p];
+                out->shift[p] = tshift[p];
+                out->state[0][p] = s0[p];
+                out->state[1][p] = s1[p];
+                for (int i = 0; i < 16; i++) {
+                    out->residual[i][p] = residual[i][p];
+                }
+            }
+        }
+    }
+}
+
+// Encode audio as VADPCM, choosing the predictor for each frame which gives
+// the lowest error.
+static void vadpcm_encode_data_closed(
+    size_t frame_count, int predictor_count, void *restrict dest,
+    const int16_t *restrict src,
+    const struct vadpcm_vector *restrict codebook) {
+    struct vadpcm_lanes lanes;
+    struct vadpcm_trial trial;
+    uint32_t rng_state = 0;
+    uint8_t *destptr = dest;
+    int state[2], bias[16];
+    state[0] = 0;
+    state[1] = 0;
+    vadpcm_make_lanes(predictor_count, codebook, &lanes);
+    for (size_t frame = 0; frame < frame_count; frame++) {
+        for (int i = 0; i < 16; i++) {
+            bias[i] = rng_state >> 16;
+            rng_state = vadpcm_rng(rng_state);
+        }
+        vadpcm_encode_trial(&lanes, src + frame * 16, state, bias, &trial);
+        int predictor = 0;
+        for (int p = 1; p < predictor_count; p++) {
+            if (trial.error[p] < trial.error[predictor]) {
+                predictor = p;
+            }
+        }
+        uint8_t *fout = destptr + frame * 9;
+        fout[0] = (trial.shift[predictor] << 4) | predictor;
+        for (int i = 0; i < 8; i++) {
+            fout[1 + i] = ((trial.residual[2 * i][predictor] & 15) << 4) |
+                          (trial.residual[2 * i + 1][predictor] & 15);
+        }
+        state[0] = trial.state[0][predictor];
+        state[1] = trial.state[1][predictor];
+    }
+}
+
+// Scratch memory for the encoder.
+struct vadpcm_scratch {
+    float (*corr)[6];
+    float *best_error;
+    float *error;
+    uint8_t *predictors;
+};
+
+// Divide up scratch memory.
+static void vadpcm_divide_scratch(size_t frame_count, void *scratch,
+                                  struct vadpcm_scratch *restrict out) {
+    char *ptr = scratch;
+    out->corr = (void *)ptr;
+    ptr += sizeof(*out->corr) * frame_count;
+    out->best_error = (void *)ptr;
+    ptr += sizeof(*out->best_error) * frame_count;
+    out->error = (void *)ptr;
+    ptr += sizeof(*out->error) * frame_count;
+    out->predictors = (void *)ptr;
+}
+
+// Encode audio, given the codebook and the assignment of each frame to a
+// predictor. The assignment is ignored for closed-loop encoding.
+static void vadpcm_encode_frames(
+    const struct vadpcm_params *restrict params, int predictor_count,
+    size_t frame_count, void *restrict dest, const int16_t *restrict src,
+    const uint8_t *restrict predictors,
+    const struct vadpcm_vector *restrict codebook) {
+    if (params->closed_loop) {
+        vadpcm_encode_data_closed(frame_count, predictor_count, dest, src,
+                                  codebook);
+    } else {
+        vadpcm_encode_data(frame_count, dest, src, predictors, codebook);
+    }
+}
+
 vadpcm_error vadpcm_encode(const struct vadpcm_params *restrict params,
                            struct vadpcm_vector *restrict codebook,
                            size_t frame_count, void *restrict dest,
@@ -503,21 +738,12 @@ vadpcm_error vadpcm_encode(const struct vadpcm_params *restrict params,
                sizeof(*codebook) * kVADPCMEncodeOrder * predictor_count);
     }
 
-    // Divide up scratch memory.
-    float(*restrict corr)[6];
-    float *restrict best_error;
-    float *restrict error;
-    uint8_t *restrict predictors;
-    {
-        char *ptr = scratch;
-        corr = (void *)ptr;
-        ptr += sizeof(*corr) * frame_count;
-        best_error = (void *)ptr;
-        ptr += sizeof(*best_error) * frame_count;
-        error = (void *)ptr;
-        ptr += sizeof(*error) * frame_count;
-        predictors = (void *)ptr;
-    }
+    struct vadpcm_scratch sc;
+    vadpcm_divide_scratch(frame_count, scratch, &sc);
+    float(*restrict corr)[6] = sc.corr;
+    float *restrict best_error = sc.best_error;
+    float *restrict error = sc.error;
+    uint8_t *restrict predictors = sc.predictors;
 
     vadpcm_autocorr(frame_count, corr, src);
     for (size_t i = 0; i < frame_count; i++) {
@@ -530,7 +756,89 @@ vadpcm_error vadpcm_encode(const struct vadpcm_params *restrict params,
     }
     vadpcm_make_codebook(frame_count, predictor_count, corr, predictors,
                          codebook);
-    vadpcm_encode_data(frame_count, dest, src, predictors, codebook);
+    vadpcm_encode_frames(params, predictor_count, frame_count, dest, src,
+                         predictors, codebook);
+    return 0;
+}
+
+// Calculate the signal-to-noise ratio of encoded audio, in dB. The signal
+// energy is passed in, since it does not change.
+static double vadpcm_measure_snr(int predictor_count,
+                                 const struct vadpcm_vector *restrict codebook,
+                                 size_t frame_count, const void *restrict data,
+                                 const int16_t *restrict src, double signal) {
+    struct vadpcm_vector state = {{0}};
+    int16_t out[kVADPCMFrameSampleCount];
+    double noise = 0.0;
+    const uint8_t *ptr = data;
+    for (size_t frame = 0; frame < frame_count; frame++) {
+        vadpcm_decode(predictor_count, kVADPCMEncodeOrder, codebook, &state, 1,
+                      out, ptr + kVADPCMFrameByteSize * frame);
+        for (int i = 0; i < kVADPCMFrameSampleCount; i++) {
+            double d = src[frame * kVADPCMFrameSampleCount + i] - out[i];
+            noise += d * d;
+        }
+    }
+    if (noise == 0.0) {
+        return INFINITY;
+    }
+    return 10.0 * log10(signal / noise);
+}
+
+vadpcm_error vadpcm_encode_auto(const struct vadpcm_params *restrict params,
+                                struct vadpcm_auto_result *restrict result,
+                                struct vadpcm_vector *restrict codebook,
+                                size_t frame_count, void *restrict dest,
+                                const int16_t *restrict src, void *scratch) {
+    int max_count = params->predictor_count;
+    if (max_count < 1 || kVADPCMMaxPredictorCount < max_count) {
+        return kVADPCMErrInvalidParams;
+    }
+
+    struct vadpcm_scratch sc;
+    vadpcm_divide_scratch(frame_count, scratch, &sc);
+    float(*restrict corr)[6] = sc.corr;
+    float *restrict best_error = sc.best_error;
+    float *restrict error = sc.error;
+    uint8_t *restrict predictors = sc.predictors;
+
+    // The autocorrelation, best-case error, and signal energy are shared by
+    // all predictor counts.
+    double signal = 0.0;
+    for (size_t i = 0; i < frame_count * kVADPCMFrameSampleCount; i++) {
+        double x = src[i];
+        signal += x * x;
+    }
+    vadpcm_autocorr(frame_count, corr, src);
+    vadpcm_best_error(frame_count, corr, best_error);
+    for (size_t i = 0; i < frame_count; i++) {
+        predictors[i] = 0;
+    }
+
+    // Grow the codebook one predictor at a time, starting from the assignment
+    // for the previous predictor count, and stop at the first predictor count
+    // which meets the target.
+    double snr = 0.0;
+    int predictor_count;
+    for (predictor_count = 1;; predictor_count++) {
+        if (predictor_count == 1) {
+            vadpcm_refine_predictors(frame_count, 1, corr, error, predictors);
+        } else {
+            vadpcm_grow_predictors(frame_count, predictor_count, corr,
+                                   best_error, error, predictors);
+        }
+        vadpcm_make_codebook(frame_count, predictor_count, corr, predictors,
+                             codebook);
+        vadpcm_encode_frames(params, predictor_count, frame_count, dest, src,
+                             predictors, codebook);
+        snr = vadpcm_measure_snr(predictor_count, codebook, frame_count, dest,
+                                 src, signal);
+        if (snr >= params->target_snr || predictor_count == max_count) {
+            break;
+        }
+    }
+    result->predictor_count = predictor_count;
+    result->snr = snr;
     return 0;
 }
 
@@ -759,4 +1067,170 @@ done:
     free(predictors);
 }
 
+
+// Return the sum of the squared difference between two signals.
+static double test_sqerror(size_t sample_count, const int16_t *ref,
+                           const int16_t *out) {
+    double error = 0.0;
+    for (size_t i = 0; i < sample_count; i++) {
+        double d = ref[i] - out[i];
+        error += d * d;
+    }
+    return error;
+}
+
+void test_closed_loop(const char *name, size_t frame_count,
+                      const int16_t *pcm) {
+    // Both encoders use the same codebook. With one predictor, closed-loop
+    // encoding must produce the same output as open-loop encoding. With more
+    // predictors, it must not have more error on the test data.
+    size_t sample_count = frame_count * kVADPCMFrameSampleCount;
+    void *scratch = xmalloc(vadpcm_encode_scratch_size(frame_count));
+    uint8_t *adpcm[2];
+    int16_t *out = xmalloc(sizeof(*out) * sample_count);
+    struct vadpcm_vector
+        codebook[2][kVADPCMEncodeOrder * kVADPCMMaxPredictorCount];
+    for (int i = 0; i < 2; i++) {
+        adpcm[i] = xmalloc(kVADPCMFrameByteSize * frame_count);
+    }
+    static const int kPredictorCounts[] = {1, 2, 4, kVADPCMMaxPredictorCount};
+    for (int n = 0; n < 4; n++) {
+        int predictor_count = kPredictorCounts[n];
+        double error[2];
+        for (int closed_loop = 0; closed_loop < 2; closed_loop++) {
+            struct vadpcm_params params = {
+                .predictor_count = predictor_count,
+                .closed_loop = closed_loop,
+            };
+            vadpcm_error err =
+                vadpcm_encode(&params, codebook[closed_loop], frame_count,
+                              adpcm[closed_loop], pcm, scratch);
+            if (err != 0) {
+                fprintf(stderr, "error: test_closed_loop %s: encode: %s\n",
+                        name, vadpcm_error_name2(err));
+                test_failure_count++;
+                goto done;
+            }
+            struct vadpcm_vector state = {{0}};
+            err = vadpcm_decode(predictor_count, kVADPCMEncodeOrder,
+                                codebook[closed_loop], &state, frame_count,
+                                out, adpcm[closed_loop]);
+            if (err != 0) {
+                fprintf(stderr, "error: test_closed_loop %s: decode: %s\n",
+                        name, vadpcm_error_name2(err));
+                test_failure_count++;
+                goto done;
+            }
+            error[closed_loop] = test_sqerror(sample_count, pcm, out);
+        }
+        if (predictor_count == 1 &&
+            memcmp(adpcm[0], adpcm[1], kVADPCMFrameByteSize * frame_count) !=
+                0) {
+            fprintf(stderr,
+                    "error: test_closed_loop %s: "
+                    "output does not match open-loop encoder\n",
+                    name);
+            test_failure_count++;
+        }
+        if (memcmp(codebook[0], codebook[1],
+                   sizeof(*codebook[0]) * kVADPCMEncodeOrder *
+                       predictor_count) != 0) {
+            fprintf(stderr,
+                    "error: test_closed_loop %s: predictor_count = %d, "
+                    "codebook does not match open-loop encoder\n",
+                    name, predictor_count);
+            test_failure_count++;
+        }
+        if (error[1] > error[0]) {
+            fprintf(stderr,
+                    "error: test_closed_loop %s: "
+                    "predictor_count = %d, "
+                    "open-loop error = %f, closed-loop error = %f\n",
+                    name, predictor_count, error[0], error[1]);
+            test_failure_count++;
+        }
+    }
+
+done:
+    for (int i = 0; i < 2; i++) {
+        free(adpcm[i]);
+    }
+    free(out);
+    free(scratch);
+}
+
+
+void test_encode_auto(const char *name, size_t frame_count,
+                      const int16_t *pcm) {
+    // A target of 0 dB should be met with one predictor. A target just above
+    // that SNR should need more predictors, and the reported SNR should match
+    // the decoded output.
+    size_t sample_count = frame_count * kVADPCMFrameSampleCount;
+    void *scratch = xmalloc(vadpcm_encode_scratch_size(frame_count));
+    uint8_t *adpcm = xmalloc(kVADPCMFrameByteSize * frame_count);
+    int16_t *out = xmalloc(sizeof(*out) * sample_count);
+    struct vadpcm_vector
+        codebook[kVADPCMEncodeOrder * kVADPCMMaxPredictorCount];
+    struct vadpcm_params params = {
+        .predictor_count = kVADPCMMaxPredictorCount,
+        .target_snr = 0.0,
+    };
+    struct vadpcm_auto_result result[2];
+    for (int i = 0; i < 2; i++) {
+        vadpcm_error err = vadpcm_encode_auto(&params, &result[i], codebook,
+                                              frame_count, adpcm, pcm, scratch);
+        if (err != 0) {
+            fprintf(stderr, "error: test_encode_auto %s: encode: %s\n", name,
+                    vadpcm_error_name2(err));
+            test_failure_count++;
+            goto done;
+        }
+        params.target_snr = result[i].snr + 0.1;
+    }
+    if (result[0].predictor_count != 1) {
+        fprintf(stderr,
+                "error: test_encode_auto %s: predictor count is %d, "
+                "expected 1\n",
+                name, result[0].predictor_count);
+        test_failure_count++;
+    }
+    if (result[1].predictor_count < 2 ||
+        (result[1].snr < params.target_snr - 0.1 &&
+         result[1].predictor_count != kVADPCMMaxPredictorCount)) {
+        fprintf(stderr,
+                "error: test_encode_auto %s: predictor count = %d, "
+                "SNR = %f, target = %f\n",
+                name, result[1].predictor_count, result[1].snr,
+                params.target_snr - 0.1);
+        test_failure_count++;
+    }
+    struct vadpcm_vector state = {{0}};
+    vadpcm_error err =
+        vadpcm_decode(result[1].predictor_count, kVADPCMEncodeOrder, codebook,
+                      &state, frame_count, out, adpcm);
+    if (err != 0) {
+        fprintf(stderr, "error: test_encode_auto %s: decode: %s\n", name,
+                vadpcm_error_name2(err));
+        test_failure_count++;
+        goto done;
+    }
+    double signal = 0.0;
+    for (size_t i = 0; i < sample_count; i++) {
+        signal += (double)pcm[i] * pcm[i];
+    }
+    double snr = 10.0 * log10(signal / test_sqerror(sample_count, pcm, out));
+    if (fabs(snr - result[1].snr) > 1.0e-6) {
+        fprintf(stderr,
+                "error: test_encode_auto %s: reported SNR = %f, "
+                "actual SNR = %f\n",
+                name, result[1].snr, snr);
+        test_failure_count++;
+    }
+
+done:
+    free(scratch);
+    free(adpcm);
+    free(out);
+}
+
 #endif // TEST
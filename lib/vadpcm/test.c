@@ -259,8 +259,12 @@ static void test_file(const char *name) {
     // Run tests.
     test_decode(name, cbspec.predictor_count, cbspec.order, cbvec, frame_count,
                 vadpcm, pcm);
+    test_decode_ring(name, cbspec.predictor_count, cbspec.order, cbvec,
+                     frame_count, vadpcm, pcm);
     test_reencode(name, cbspec.predictor_count, cbspec.order, cbvec,
                   frame_count, vadpcm);
+    test_closed_loop(name, frame_count, pcm);
+    test_encode_auto(name, frame_count, pcm);
 
 done:
     free(aiff.data.data);
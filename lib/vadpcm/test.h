@@ -27,10 +27,24 @@ void test_decode(const char *name, int predictor_count, int order,
                  struct vadpcm_vector *codebook, size_t frame_count,
                  const void *vadpcm, const int16_t *pcm);
 
+// Test that decoding into a ring buffer in pieces matches the known output.
+void test_decode_ring(const char *name, int predictor_count, int order,
+                      struct vadpcm_vector *codebook, size_t frame_count,
+                      const void *vadpcm, const int16_t *pcm);
+
 // Test that re-encoding the VADPCM doesn't change the decoded audio.
 void test_reencode(const char *name, int predictor_count, int order,
                    struct vadpcm_vector *codebook, size_t frame_count,
                    const void *vadpcm);
 
+// Test that closed-loop encoding matches open-loop encoding with one
+// predictor, and is no worse with several predictors.
+void test_closed_loop(const char *name, size_t frame_count,
+                      const int16_t *pcm);
+
+// Test that automatic predictor count selection meets the target SNR.
+void test_encode_auto(const char *name, size_t frame_count,
+                      const int16_t *pcm);
+
 // Internal encoder tests.
 void test_encoder(void);
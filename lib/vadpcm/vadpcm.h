@@ -127,10 +127,54 @@ vadpcm_error vadpcm_decode(int predictor_count, int order,
                            size_t frame_count, int16_t *VADPCM_RESTRICT dest,
                            const void *VADPCM_RESTRICT src);
 
+// Decode a range of samples from VADPCM-encoded audio into a ring buffer.
+//
+// The state must be the decoder state at the start of the first frame in src.
+// Samples are numbered from the start of src, and samples start..end-1 are
+// written to the ring buffer, starting at index dest_pos and wrapping around
+// at dest_size. Frames after the one containing sample end-1 are not decoded.
+//
+// On return, the state is the decoder state at the start of the frame
+// containing sample end, which may have been partially decoded. To continue
+// decoding, advance src by end / kVADPCMFrameSampleCount frames and pass
+// end % kVADPCMFrameSampleCount as the next start.
+//
+// Arguments:
+//   predictor_count: Number of predictors in codebook
+//   order: Predictor order in codebook
+//   codebook: Array of predictor_count * order vectors in codebook
+//   state: Decoder state, frame-aligned
+//   start: Index of first sample to decode
+//   end: Index after the last sample to decode, at least start
+//   dest: Ring buffer of dest_size elements
+//   dest_size: Size of the ring buffer, at least end - start
+//   dest_pos: Index in the ring buffer for the first sample, less than
+//             dest_size
+//   src: Input array of VADPCM frames
+//
+// Error codes:
+//   kVADPCMErrInvalidData: Predictor index out of range.
+vadpcm_error vadpcm_decode_ring(
+    int predictor_count, int order,
+    const struct vadpcm_vector *VADPCM_RESTRICT codebook,
+    struct vadpcm_vector *VADPCM_RESTRICT state, size_t start, size_t end,
+    int16_t *VADPCM_RESTRICT dest, size_t dest_size, size_t dest_pos,
+    const void *VADPCM_RESTRICT src);
+
 // Parameters for VADPCM encoding.
 struct vadpcm_params {
     // The number of predictors to put in the codebook.
     int predictor_count;
+
+    // If nonzero, choose the predictor for each frame by encoding the frame
+    // with every predictor in the codebook and keeping the one which gives the
+    // lowest error. This is slower, but it takes the encoder state and
+    // residual clamping into account, so it can give better quality than the
+    // predictor assignment used to create the codebook.
+    int closed_loop;
+
+    // The target signal-to-noise ratio, in dB, for vadpcm_encode_auto.
+    double target_snr;
 };
 
 // Return the amount of scratch space needed to encode a file with the given
@@ -159,6 +203,45 @@ vadpcm_error vadpcm_encode(const struct vadpcm_params *VADPCM_RESTRICT params,
                            size_t frame_count, void *VADPCM_RESTRICT dest,
                            const int16_t *VADPCM_RESTRICT src, void *scratch);
 
+// Result of encoding with an automatically chosen predictor count.
+struct vadpcm_auto_result {
+    // The number of predictors in the codebook.
+    int predictor_count;
+
+    // The signal-to-noise ratio of the encoded audio, in dB. This is infinite
+    // if the encoded audio is identical to the input.
+    double snr;
+};
+
+// Encode PCM as VADPCM, using the smallest predictor count which meets the
+// target signal-to-noise ratio. The params->predictor_count field is the
+// largest predictor count to try. If no predictor count meets the target, the
+// largest predictor count is used.
+//
+// Codebooks for each predictor count are created by adding one predictor to
+// the codebook for the previous count, so the result may differ from
+// vadpcm_encode with the same predictor count.
+//
+// Arguments:
+//   params: Encoding parameters
+//   result: On success, set to the chosen predictor count and resulting SNR
+//   codebook: Output array of params->predictor_count * kVADPCMEncodeOrder
+//             vectors, of which result->predictor_count * kVADPCMEncodeOrder
+//             are used
+//   frame_count: Number of frames of VADPCM to encode
+//   dest: Output array of frame_count * kVADPCMFrameByteSize bytes
+//   src: Input array of frame_count * kVADPCMFrameSampleCount elements
+//   scratch: Scratch space with size vadpcm_encode_scratch_size(frame_count)
+//
+// Error codes:
+//   kVADPCMErrInvalidParams: Invalid encoding parameters.
+vadpcm_error vadpcm_encode_auto(
+    const struct vadpcm_params *VADPCM_RESTRICT params,
+    struct vadpcm_auto_result *VADPCM_RESTRICT result,
+    struct vadpcm_vector *VADPCM_RESTRICT codebook, size_t frame_count,
+    void *VADPCM_RESTRICT dest, const int16_t *VADPCM_RESTRICT src,
+    void *scratch);
+
 #ifdef __cplusplus
 }
 #endif
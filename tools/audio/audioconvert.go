@@ -17,6 +17,7 @@ import (
 	"github.com/depp/extended"
 	"github.com/depp/skelly64/lib/audio/aiff"
 	"github.com/depp/skelly64/lib/audio/metadata"
+	"github.com/depp/skelly64/lib/audio/resample"
 	"github.com/depp/skelly64/lib/getpath"
 )
 
@@ -35,7 +36,7 @@ func getArgs() (o options, err error) {
 	flag.StringVar(&o.output, "output", "", "output audio file")
 	flag.IntVar(&o.rate, "rate", 0, "audio sample rate")
 	flag.StringVar(&o.flac, "flac", "", "flac executable")
-	flag.StringVar(&o.sox, "sox", "", "sox executable")
+	flag.StringVar(&o.sox, "sox", "", "sox executable, for formats other than AIFF, WAVE, and FLAC")
 	flag.Parse()
 	if args := flag.Args(); len(args) != 0 {
 		return o, fmt.Errorf("unexpected argument: %q", args[0])
@@ -82,33 +83,118 @@ type pcmdata struct {
 	samples   []int16
 }
 
-// readPCM reads the input as 16-bit mono PCM.
-func readPCM(opts *options) (*pcmdata, error) {
-	pcmfile := opts.input
+// errUnsupported is returned when the input is in a format which can only be
+// read with SoX, such as floating-point audio, compressed AIFF-C, or AIFF with
+// a sample rate which is not an integer.
+var errUnsupported = errors.New("unsupported format")
 
-	// Decode FLAC.
-	if strings.HasSuffix(opts.input, ".flac") {
-		wav, err := ioutil.TempFile(filepath.Dir(opts.output), "audioconvert.*.wav")
+// readPCM reads the input as 16-bit mono PCM. Inputs in a format which is not
+// supported directly are converted with SoX instead.
+func readPCM(opts *options) (*pcmdata, error) {
+	var samples []int16
+	var channels, rate int
+	var err error
+	switch ext := strings.ToLower(filepath.Ext(opts.input)); ext {
+	case ".aif", ".aiff", ".aifc":
+		samples, channels, rate, err = readAIFF(opts.input)
+	case ".wav":
+		var data []byte
+		data, err = ioutil.ReadFile(opts.input)
 		if err != nil {
 			return nil, err
 		}
-		defer func() {
-			wav.Close()
-			os.Remove(wav.Name())
-		}()
-		cmd := exec.Command(opts.flac, "--decode", "--stdout", "--silent", opts.input)
-		cmd.Stdout = wav
-		cmd.Stderr = os.Stderr
-		if err := cmd.Run(); err != nil {
-			return nil, fmt.Errorf("could not decode FLAC: %w", err)
+		samples, channels, rate, err = parseWAV(data)
+	case ".flac":
+		samples, channels, rate, err = readFLAC(opts)
+	default:
+		return readPCMSox(opts)
+	}
+	if err != nil {
+		if errors.Is(err, errUnsupported) {
+			return readPCMSox(opts)
 		}
-		pcmfile = wav.Name()
+		return nil, fmt.Errorf("%s: %w", opts.input, err)
+	}
+
+	// Convert to the right format and rate. SoX can resample between rates
+	// which the in-process resampler rejects.
+	samples = downmix(samples, channels)
+	if rate != opts.rate {
+		samples, err = resample.Resample(samples, rate, opts.rate)
+		if err != nil {
+			if errors.Is(err, resample.ErrLargeRatio) {
+				return readPCMSox(opts)
+			}
+			return nil, fmt.Errorf("could not resample audio: %w", err)
+		}
+	}
+	return &pcmdata{
+		rate:    opts.rate,
+		samples: samples,
+	}, nil
+}
+
+// readAIFF reads an uncompressed 16-bit AIFF or AIFF-C file. Returns
+// interleaved samples.
+func readAIFF(name string) (samples []int16, channels, rate int, err error) {
+	data, err := ioutil.ReadFile(name)
+	if err != nil {
+		return nil, 0, 0, err
+	}
+	a, err := aiff.Parse(data)
+	if err != nil {
+		return nil, 0, 0, err
+	}
+	if c := &a.Common; string(c.Compression[:]) != "NONE" || c.SampleSize != 16 {
+		return nil, 0, 0, fmt.Errorf("%w: compression %q, %d-bit",
+			errUnsupported, c.Compression[:], c.SampleSize)
 	}
+	frate := a.Common.SampleRate.Float64()
+	rate = int(math.Round(frate))
+	if float64(rate) != frate {
+		return nil, 0, 0, fmt.Errorf("%w: sample rate %f", errUnsupported, frate)
+	}
+	samples, err = a.GetSamples16()
+	if err != nil {
+		return nil, 0, 0, err
+	}
+	return samples, a.Common.NumChannels, rate, nil
+}
+
+// readFLAC decodes a FLAC file, in memory. Returns interleaved samples.
+func readFLAC(opts *options) (samples []int16, channels, rate int, err error) {
+	var buf bytes.Buffer
+	cmd := exec.Command(opts.flac, "--decode", "--stdout", "--silent", opts.input)
+	cmd.Stdout = &buf
+	cmd.Stderr = os.Stderr
+	if err := cmd.Run(); err != nil {
+		return nil, 0, 0, fmt.Errorf("could not decode FLAC: %w", err)
+	}
+	return parseWAV(buf.Bytes())
+}
+
+// downmix converts interleaved audio to mono by averaging the channels.
+func downmix(samples []int16, channels int) []int16 {
+	if channels <= 1 {
+		return samples
+	}
+	r := make([]int16, len(samples)/channels)
+	for i := range r {
+		var sum int
+		for _, x := range samples[i*channels : i*channels+channels] {
+			sum += int(x)
+		}
+		r[i] = int16(math.Round(float64(sum) / float64(channels)))
+	}
+	return r
+}
 
-	// Convert to the right format and rate.
+// readPCMSox reads the input as 16-bit mono PCM, using SoX to convert it. This
+// is used for input formats which are not supported directly.
+func readPCMSox(opts *options) (*pcmdata, error) {
 	cmd := exec.Command(
 		opts.sox,
-		pcmfile,
+		opts.input,
 		"--bits", "16",
 		"--channels", "1",
 		"--rate", strconv.Itoa(opts.rate),
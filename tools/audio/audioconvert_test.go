@@ -0,0 +1,147 @@
+package main
+
+import (
+	"encoding/binary"
+	"errors"
+	"io/ioutil"
+	"math"
+	"os"
+	"path/filepath"
+	"runtime"
+	"testing"
+
+	"github.com/depp/extended"
+	"github.com/depp/skelly64/lib/audio/aiff"
+)
+
+// floatWAV returns a mono 32-bit floating-point WAVE file.
+func floatWAV(samples []float32) []byte {
+	const formatFloat = 3
+	data := make([]byte, 44+4*len(samples))
+	copy(data[0:], "RIFF")
+	binary.LittleEndian.PutUint32(data[4:], uint32(len(data)-8))
+	copy(data[8:], "WAVEfmt ")
+	binary.LittleEndian.PutUint32(data[16:], 16)
+	binary.LittleEndian.PutUint16(data[20:], formatFloat)
+	binary.LittleEndian.PutUint16(data[22:], 1)
+	binary.LittleEndian.PutUint32(data[24:], 8000)
+	binary.LittleEndian.PutUint32(data[28:], 8000*4)
+	binary.LittleEndian.PutUint16(data[32:], 4)
+	binary.LittleEndian.PutUint16(data[34:], 32)
+	copy(data[36:], "data")
+	binary.LittleEndian.PutUint32(data[40:], uint32(4*len(samples)))
+	for i, x := range samples {
+		binary.LittleEndian.PutUint32(data[44+4*i:], math.Float32bits(x))
+	}
+	return data
+}
+
+// makeAIFF returns a mono AIFF file with the given sample data.
+func makeAIFF(t *testing.T, bits int, rate float64, frames int, data []byte) []byte {
+	a := aiff.AIFF{
+		Common: aiff.Common{
+			NumChannels: 1,
+			NumFrames:   frames,
+			SampleSize:  bits,
+			SampleRate:  extended.FromFloat64(rate),
+			Compression: [4]byte{'N', 'O', 'N', 'E'},
+		},
+		Chunks: []aiff.Chunk{&aiff.SoundData{Data: data}},
+	}
+	fdata, err := a.Write(aiff.AIFFKind)
+	if err != nil {
+		t.Fatal("could not create AIFF data:", err)
+	}
+	return fdata
+}
+
+// aiff8 returns a mono 8-bit AIFF file.
+func aiff8(t *testing.T, samples []int8) []byte {
+	data := make([]byte, len(samples))
+	for i, x := range samples {
+		data[i] = byte(x)
+	}
+	return makeAIFF(t, 8, 8000, len(samples), data)
+}
+
+// aiff16 returns a mono 16-bit AIFF file.
+func aiff16(t *testing.T, rate float64, samples []int16) []byte {
+	data := make([]byte, 2*len(samples))
+	for i, x := range samples {
+		binary.BigEndian.PutUint16(data[2*i:], uint16(x))
+	}
+	return makeAIFF(t, 16, rate, len(samples), data)
+}
+
+func TestUnsupported(t *testing.T) {
+	if _, _, _, err := parseWAV(floatWAV([]float32{0, 0.5})); !errors.Is(err, errUnsupported) {
+		t.Errorf("parseWAV float: err = %v, expected %v", err, errUnsupported)
+	}
+	name := filepath.Join(t.TempDir(), "in.aiff")
+	if err := ioutil.WriteFile(name, aiff8(t, []int8{0, 64}), 0666); err != nil {
+		t.Fatal(err)
+	}
+	if _, _, _, err := readAIFF(name); !errors.Is(err, errUnsupported) {
+		t.Errorf("readAIFF 8-bit: err = %v, expected %v", err, errUnsupported)
+	}
+	if err := ioutil.WriteFile(name, aiff16(t, 22254.545, []int16{0, 64}), 0666); err != nil {
+		t.Fatal(err)
+	}
+	if _, _, _, err := readAIFF(name); !errors.Is(err, errUnsupported) {
+		t.Errorf("readAIFF 22254.545 Hz: err = %v, expected %v", err, errUnsupported)
+	}
+}
+
+// TestSoxFallback checks that inputs which can't be read directly are
+// converted with SoX. SoX is replaced with a script which writes fixed output.
+func TestSoxFallback(t *testing.T) {
+	if runtime.GOOS == "windows" {
+		t.Skip("fake SoX is a shell script")
+	}
+	dir := t.TempDir()
+	sox := filepath.Join(dir, "sox")
+	// Output is the little-endian 16-bit samples 1, 2, -1.
+	const script = "#!/bin/sh\nprintf '\\001\\000\\002\\000\\377\\377'\n"
+	if err := ioutil.WriteFile(sox, []byte(script), 0777); err != nil {
+		t.Fatal(err)
+	}
+	inputs := []struct {
+		name string
+		rate int
+		data []byte
+	}{
+		{"in.wav", 8000, floatWAV([]float32{0, 0.5, -0.5})},
+		{"in.aiff", 8000, aiff8(t, []int8{0, 64, -64})},
+		{"in.aiff", 8000, aiff16(t, 22254.545, []int16{0, 64, -64})},
+		// The in-process resampler rejects this ratio.
+		{"in.aiff", 32001, aiff16(t, 44100, []int16{0, 64, -64})},
+	}
+	for _, in := range inputs {
+		name := filepath.Join(dir, in.name)
+		if err := ioutil.WriteFile(name, in.data, 0666); err != nil {
+			t.Fatal(err)
+		}
+		opts := options{input: name, rate: in.rate, sox: sox}
+		pcm, err := readPCM(&opts)
+		if err != nil {
+			t.Errorf("%s: %v", in.name, err)
+			continue
+		}
+		if expect := []int16{1, 2, -1}; !equalSamples(pcm.samples, expect) {
+			t.Errorf("%s: samples = %v, expected %v", in.name, pcm.samples, expect)
+		}
+		os.Remove(name)
+	}
+}
+
+func equalSamples(x, y []int16) bool {
+	if len(x) != len(y) {
+		return false
+	}
+	for i := range x {
+		if x[i] != y[i] {
+			return false
+		}
+	}
+	return true
+}
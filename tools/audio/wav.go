@@ -0,0 +1,113 @@
+package main
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+)
+
+const (
+	wavFormatPCM        = 1
+	wavFormatExtensible = 0xfffe
+)
+
+// parseWAV parses a WAVE file containing integer PCM audio. Returns
+// interleaved 16-bit samples.
+func parseWAV(data []byte) (samples []int16, channels, rate int, err error) {
+	if len(data) < 12 || string(data[0:4]) != "RIFF" || string(data[8:12]) != "WAVE" {
+		return nil, 0, 0, errors.New("not a WAVE file")
+	}
+	data = data[12:]
+	var bits int
+	var haveFormat bool
+	for len(data) >= 8 {
+		id := string(data[0:4])
+		size := binary.LittleEndian.Uint32(data[4:8])
+		data = data[8:]
+		if uint64(size) > uint64(len(data)) {
+			if id != "data" {
+				return nil, 0, 0, fmt.Errorf("chunk %q is truncated", id)
+			}
+			// Streaming encoders may not know the size of the data chunk.
+			size = uint32(len(data) &^ 1)
+		}
+		ck := data[:size]
+		if n := int(size+1) &^ 1; n < len(data) {
+			data = data[n:]
+		} else {
+			data = nil
+		}
+		switch id {
+		case "fmt ":
+			if len(ck) < 16 {
+				return nil, 0, 0, errors.New("fmt chunk is too short")
+			}
+			format := binary.LittleEndian.Uint16(ck[0:2])
+			channels = int(binary.LittleEndian.Uint16(ck[2:4]))
+			rate = int(binary.LittleEndian.Uint32(ck[4:8]))
+			bits = int(binary.LittleEndian.Uint16(ck[14:16]))
+			if format == wavFormatExtensible && len(ck) >= 26 {
+				format = binary.LittleEndian.Uint16(ck[24:26])
+			}
+			if format != wavFormatPCM {
+				return nil, 0, 0, fmt.Errorf("%w: WAVE format %d", errUnsupported, format)
+			}
+			if channels < 1 {
+				return nil, 0, 0, fmt.Errorf("invalid channel count: %d", channels)
+			}
+			haveFormat = true
+		case "data":
+			if !haveFormat {
+				return nil, 0, 0, errors.New("data chunk before fmt chunk")
+			}
+			samples, err = wavSamples16(ck, bits)
+			if err != nil {
+				return nil, 0, 0, err
+			}
+			return samples, channels, rate, nil
+		}
+	}
+	return nil, 0, 0, errors.New("no data chunk")
+}
+
+// wavSamples16 converts WAVE sample data to 16-bit, rounding to nearest.
+func wavSamples16(data []byte, bits int) ([]int16, error) {
+	switch bits {
+	case 8:
+		r := make([]int16, len(data))
+		for i, x := range data {
+			r[i] = int16(int(x)-128) << 8
+		}
+		return r, nil
+	case 16:
+		r := make([]int16, len(data)/2)
+		for i := range r {
+			r[i] = int16(binary.LittleEndian.Uint16(data[i*2:]))
+		}
+		return r, nil
+	case 24, 32:
+		n := bits / 8
+		shift := bits - 16
+		r := make([]int16, len(data)/n)
+		for i := range r {
+			var x int32
+			for j := 0; j < n; j++ {
+				x |= int32(data[i*n+j]) << (8*j + 32 - bits)
+			}
+			x >>= 32 - bits
+			r[i] = clamp16((int64(x) + 1<<(shift-1)) >> shift)
+		}
+		return r, nil
+	default:
+		return nil, fmt.Errorf("%w: %d-bit WAVE", errUnsupported, bits)
+	}
+}
+
+func clamp16(x int64) int16 {
+	if x > 0x7fff {
+		return 0x7fff
+	} else if x < -0x8000 {
+		return -0x8000
+	}
+	return int16(x)
+}
@@ -7,13 +7,24 @@
 #include "tools/model/displaylist.hpp"
 #include "tools/model/gbi.hpp"
 #include "tools/model/mesh.hpp"
+#include "tools/model/microcode.hpp"
+#include "tools/model/parallel.hpp"
+#include "tools/model/peephole.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <iterator>
 #include <limits>
+#include <map>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 
-#include <fmt/core.h>
+#include <fmt/format.h>
 
 namespace modelconvert {
 namespace gbi {
@@ -80,11 +91,15 @@ struct VertexSet {
         }
 
         vertex.resize(nvert);
-        const std::vector<std::array<int16_t, 3>> &vertexpos =
-            mesh.animation_frame.at(0);
+        // Every frame has the same size, so checking the size once lets the
+        // loops below index frames without bounds checks.
+        const FrameView vertexpos = mesh.animation_frame.at(0);
+        if (vertexpos.size() != static_cast<size_t>(nvert)) {
+            throw std::runtime_error("wrong number of vertex positions");
+        }
         for (int i = 0; i < nvert; i++) {
             VState &v = vertex.at(i);
-            v.vertex.pos = vertexpos.at(i);
+            v.vertex.pos = vertexpos[i];
             const VertexAttr &vv = mesh.vertex.at(i);
             v.vertex.pad = 0;
             v.vertex.texcoord = vv.texcoord;
@@ -107,7 +122,7 @@ struct VertexSet {
         for (int i = 0; i < nvert; i++) {
             VOrder &v = vorder.at(i);
             v.index = i;
-            v.pos = vertexpos.at(i);
+            v.pos = vertexpos[i];
             const VertexAttr &d = mesh.vertex.at(i);
             v.normal = d.normal;
             v.same = false;
@@ -121,12 +136,12 @@ struct VertexSet {
             x.same = x.pos == y.pos && x.normal == y.normal;
         }
         if (cfg.animate) {
-            for (const std::vector<std::array<int16_t, 3>> &frame :
-                 mesh.animation_frame) {
-                std::array<int16_t, 3> prev = frame.at(vorder.at(0).index);
+            for (size_t f = 0; f < mesh.animation_frame.size(); f++) {
+                const FrameView frame = mesh.animation_frame[f];
+                std::array<int16_t, 3> prev = frame[vorder[0].index];
                 for (int i = 1; i < nvert; i++) {
-                    VOrder &vo = vorder.at(i);
-                    std::array<int16_t, 3> cur = frame.at(vo.index);
+                    VOrder &vo = vorder[i];
+                    std::array<int16_t, 3> cur = frame[vo.index];
                     if (prev != cur) {
                         vo.same = false;
                     }
@@ -158,19 +173,148 @@ struct VertexSet {
     int group_count;
 };
 
+// A triangle in a batch, with the cache slot and texture coordinate of each of
+// its vertexes.
+struct BatchTriangle {
+    std::array<int, 3> slot;
+    std::array<std::array<int16_t, 2>, 3> texcoord;
+};
+
+// Return true if two triangles can be drawn by one SP2Triangle, which is true
+// if every cache slot they share has the same texture coordinate in both.
+bool CanPair(const BatchTriangle &x, const BatchTriangle &y) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (x.slot[i] == y.slot[j] && x.texcoord[i] != y.texcoord[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Return the order to draw the triangles in a batch, so as many triangles as
+// possible are drawn in pairs, with few vertex modifications. The texcoord
+// array is the texture coordinate in each cache slot before the batch is
+// drawn. Each pair is chosen greedily: the first triangle is one which still
+// has a partner, and then each triangle is the one which needs the fewest
+// modifications. Ties go to the triangle which comes first in the batch.
+std::vector<int> PairTriangles(
+    const std::vector<BatchTriangle> &triangle,
+    std::vector<std::array<int16_t, 2>> texcoord) {
+    const int n = triangle.size();
+    std::vector<int> order;
+    order.reserve(n);
+    {
+        // If the triangles agree on the texture coordinate in every slot, any
+        // two triangles can be paired, so keep the original order.
+        std::vector<const std::array<int16_t, 2> *> slot_texcoord(
+            texcoord.size(), nullptr);
+        bool conflict = false;
+        for (const BatchTriangle &tri : triangle) {
+            for (int i = 0; i < 3; i++) {
+                const std::array<int16_t, 2> *&t =
+                    slot_texcoord.at(tri.slot[i]);
+                if (t == nullptr) {
+                    t = &tri.texcoord[i];
+                } else if (*t != tri.texcoord[i]) {
+                    conflict = true;
+                }
+            }
+        }
+        if (!conflict) {
+            for (int i = 0; i < n; i++) {
+                order.push_back(i);
+            }
+            return order;
+        }
+    }
+    std::vector<bool> can_pair(n * n);
+    std::vector<int> partner_count(n, 0);
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            if (CanPair(triangle[i], triangle[j])) {
+                can_pair[i * n + j] = can_pair[j * n + i] = true;
+                partner_count[i]++;
+                partner_count[j]++;
+            }
+        }
+    }
+    std::vector<bool> done(n, false);
+    // Number of vertex modifications needed to draw a triangle.
+    const auto modify_count = [&](int index) {
+        const BatchTriangle &tri = triangle[index];
+        int count = 0;
+        for (int i = 0; i < 3; i++) {
+            if (texcoord.at(tri.slot[i]) != tri.texcoord[i]) {
+                count++;
+            }
+        }
+        return count;
+    };
+    const auto draw = [&](int index) {
+        const BatchTriangle &tri = triangle[index];
+        for (int i = 0; i < 3; i++) {
+            texcoord.at(tri.slot[i]) = tri.texcoord[i];
+        }
+        done[index] = true;
+        order.push_back(index);
+        for (int i = 0; i < n; i++) {
+            if (can_pair[index * n + i]) {
+                partner_count[i]--;
+            }
+        }
+    };
+    while (static_cast<int>(order.size()) < n) {
+        int first = -1, first_cost = 0;
+        for (int i = 0; i < n; i++) {
+            if (done[i]) {
+                continue;
+            }
+            const int cost = (partner_count[i] > 0 ? 0 : 4) + modify_count(i);
+            if (first == -1 || cost < first_cost) {
+                first = i;
+                first_cost = cost;
+            }
+        }
+        draw(first);
+        int second = -1, second_cost = 0;
+        for (int i = 0; i < n; i++) {
+            if (done[i] || !can_pair[first * n + i]) {
+                continue;
+            }
+            const int cost = modify_count(i);
+            if (second == -1 || cost < second_cost) {
+                second = i;
+                second_cost = cost;
+            }
+        }
+        if (second != -1) {
+            draw(second);
+        }
+    }
+    return order;
+}
+
+// Number of candidate first triangles to try for each batch, when optimizing.
+constexpr int OptimizeCandidates = 8;
+
 class Compiler {
 public:
-    Compiler(const VertexSet &vert, const Mesh &mesh, int material)
-        : m_vertex{vert.vertex} {
+    // Create a compiler for the given triangles, which are indexes into the
+    // mesh's triangles. If optimize is true, try several candidates for the
+    // first triangle in each batch, instead of just choosing greedily.
+    Compiler(const VertexSet &vert, const Mesh &mesh,
+             const std::vector<int> &triangle, bool optimize)
+        : m_vertex{vert.vertex}, m_optimize{optimize} {
         for (VState &v : m_vertex) {
             v.tri_count = 0;
         }
-        for (const Triangle &tri : mesh.triangle) {
-            if (tri.material == material) {
-                m_triangle.push_back(tri);
-                for (const int idx : tri.vertex) {
-                    m_vertex.at(idx).tri_count++;
-                }
+        for (const int triangle_id : triangle) {
+            const Triangle &tri = mesh.triangle.at(triangle_id);
+            m_triangle.push_back(tri);
+            for (const int idx : tri.vertex) {
+                m_vertex.at(idx).tri_count++;
             }
         }
         {
@@ -181,73 +325,239 @@ public:
         for (const VState &v : m_vertex) {
             m_group.at(v.group_id).tri_count += v.tri_count;
         }
+        for (const GState &g : m_group) {
+            if (g.tri_count > 0) {
+                m_position_count++;
+            }
+        }
+
+        // Build the group -> triangle adjacency and the initial queue.
+        const int n = m_triangle.size();
+        m_group_triangle.resize(m_group.size());
+        for (int i = 0; i < n; i++) {
+            const std::array<int, 3> groups = TriangleGroups(i);
+            for (int j = 0; j < 3; j++) {
+                if (j == 0 || groups[j] != groups[j - 1]) {
+                    m_group_triangle.at(groups[j]).push_back(i);
+                }
+            }
+        }
+        m_cost.resize(n);
+        m_removed.resize(n, false);
+        m_remaining = n;
+        for (int i = 0; i < n; i++) {
+            const Cost cost = TriangleCost(i);
+            m_cost[i] = cost;
+            m_queue.emplace(cost, i);
+        }
     }
 
+    // Number of vertex positions used by the triangles.
+    int position_count() const { return m_position_count; }
+
+    // Number of batches emitted, and the number of vertexes they load.
+    int batch_count() const { return m_batch_index; }
+    int batch_vertex_count() const { return m_total_vtx; }
+
+    // Emit the display list. Statistics are appended to stats, if not null.
     void Emit(DisplayList *dl, std::vector<int> *dl_vertex_id,
-              std::FILE *stats) {
+              std::string *stats) {
         // For each batch.
-        while (!m_triangle.empty()) {
+        while (m_remaining > 0) {
             StartBatch(dl);
-            while (true) {
-                int next_tri = BestTriangle();
-                if (next_tri == -1) {
-                    break;
-                }
-                AddTriangle(next_tri);
+            if (m_optimize) {
+                AddTriangle(BestFirstTriangle());
             }
+            FillBatch();
             EmitPrevBatch(dl, stats);
             std::swap(m_batch_vertex, m_prev_vertex);
             std::swap(m_batch_triangle, m_prev_triangle);
         }
         EmitPrevBatch(dl, stats);
         if (stats) {
-            fmt::print(stats, "    Final vertex count: {} ({:.2f}x)\n",
-                       m_total_vtx,
-                       static_cast<double>(m_total_vtx) /
-                           static_cast<double>(m_group.size()));
+            fmt::format_to(std::back_inserter(*stats),
+                           "    Final vertex count: {} ({:.2f}x)\n",
+                           m_total_vtx,
+                           static_cast<double>(m_total_vtx) /
+                               static_cast<double>(m_group.size()));
         }
         dl_vertex_id->insert(dl_vertex_id->end(), std::begin(m_dl_vertex),
                              std::end(m_dl_vertex));
     }
 
 private:
-    int BestTriangle() const {
-        int best = -1;
-        using Cost = std::array<int, 5>;
-        Cost best_cost{};
-        int n = m_triangle.size();
-        for (int i = 0; i < n; i++) {
-            const std::array<int, 3> tri = m_triangle.at(i).vertex;
-            int space_required = 0;
-            int transforms = 0;
-            std::array<int, 3> num_tris;
-            for (int j = 0; j < 3; j++) {
-                const int vertex_id = tri[j];
-                const VState &v = m_vertex.at(vertex_id);
-                const GState &g = m_group.at(v.group_id);
-                num_tris[j] = g.tri_count;
-                if (!g.in_current_batch) {
-                    space_required++;
-                    if (!g.can_reuse) {
-                        transforms++;
-                    }
+    // Cost of adding a triangle to the current batch, compared
+    // lexicographically: vertex cache space required, vertexes transformed,
+    // and then the sorted number of remaining triangles for each vertex.
+    using Cost = std::array<int, 5>;
+
+    // Get the vertex groups for a triangle.
+    std::array<int, 3> TriangleGroups(int triangle_id) const {
+        const std::array<int, 3> &tri = m_triangle[triangle_id].vertex;
+        std::array<int, 3> groups;
+        for (int j = 0; j < 3; j++) {
+            groups[j] = m_vertex.at(tri[j]).group_id;
+        }
+        Sort3(groups);
+        return groups;
+    }
+
+    // Calculate the current cost of adding a triangle to the batch.
+    Cost TriangleCost(int triangle_id) const {
+        const std::array<int, 3> &tri = m_triangle[triangle_id].vertex;
+        int space_required = 0;
+        int transforms = 0;
+        std::array<int, 3> num_tris;
+        for (int j = 0; j < 3; j++) {
+            const int vertex_id = tri[j];
+            const VState &v = m_vertex.at(vertex_id);
+            const GState &g = m_group.at(v.group_id);
+            num_tris[j] = g.tri_count;
+            if (!g.in_current_batch) {
+                space_required++;
+                if (!g.can_reuse) {
+                    transforms++;
                 }
             }
-            Sort3(num_tris);
-            Cost cost{space_required, transforms, num_tris[0], num_tris[1],
-                      num_tris[2]};
-            if (space_required <= m_vert_space &&
-                (cost < best_cost || best == -1)) {
-                best = i;
-                best_cost = cost;
+        }
+        Sort3(num_tris);
+        return Cost{space_required, transforms, num_tris[0], num_tris[1],
+                    num_tris[2]};
+    }
+
+    // Recalculate the cost of all remaining triangles which use a group.
+    void UpdateGroup(int group_id) {
+        for (const int triangle_id : m_group_triangle.at(group_id)) {
+            if (m_removed[triangle_id]) {
+                continue;
             }
+            Cost &cost = m_cost[triangle_id];
+            const Cost new_cost = TriangleCost(triangle_id);
+            if (new_cost != cost) {
+                m_queue.erase(std::make_pair(cost, triangle_id));
+                m_queue.emplace(new_cost, triangle_id);
+                cost = new_cost;
+            }
+        }
+    }
+
+    // Return the lowest-cost triangle which fits in the current batch, or -1
+    // if no triangle fits. Ties go to the triangle which comes first in the
+    // mesh. The queue is ordered by space required first, so only the first
+    // entry needs to be checked.
+    int BestTriangle() const {
+        if (m_queue.empty()) {
+            return -1;
+        }
+        const std::pair<Cost, int> &best = *m_queue.begin();
+        if (best.first[0] > m_vert_space) {
+            return -1;
+        }
+        return best.second;
+    }
+
+    // Add triangles to the current batch greedily, until it is full.
+    void FillBatch() {
+        while (true) {
+            int next_tri = BestTriangle();
+            if (next_tri == -1) {
+                break;
+            }
+            AddTriangle(next_tri);
+        }
+    }
+
+    // Choose the first triangle for a batch by trying the lowest-cost
+    // candidates, filling the batch greedily from each one, and then undoing
+    // the changes. The best candidate transforms the fewest vertexes per
+    // triangle. Ties go to the greedy choice.
+    int BestFirstTriangle() {
+        std::vector<int> candidates;
+        for (const std::pair<Cost, int> &entry : m_queue) {
+            if (static_cast<int>(candidates.size()) == OptimizeCandidates) {
+                break;
+            }
+            candidates.push_back(entry.second);
         }
+        if (candidates.size() <= 1) {
+            return candidates.empty() ? -1 : candidates[0];
+        }
+        int best = -1;
+        int best_transforms = 0, best_triangles = 0;
+        m_record_undo = true;
+        for (const int candidate : candidates) {
+            AddTriangle(candidate);
+            FillBatch();
+            const int transforms = m_batch_transforms;
+            const int triangles = m_batch_triangle.size();
+            const int64_t lhs = static_cast<int64_t>(transforms) *
+                                best_triangles;
+            const int64_t rhs = static_cast<int64_t>(best_transforms) *
+                                triangles;
+            if (best == -1 || lhs < rhs) {
+                best = candidate;
+                best_transforms = transforms;
+                best_triangles = triangles;
+            }
+            Undo();
+        }
+        m_record_undo = false;
         return best;
     }
 
+    // Undo all triangles added to the batch since recording started.
+    void Undo() {
+        std::vector<int> &changed = m_changed_group;
+        changed.clear();
+        for (auto it = m_undo.rbegin(), end = m_undo.rend(); it != end; ++it) {
+            const UndoRecord &u = *it;
+            const std::array<int, 3> &tri =
+                m_triangle[u.triangle_id].vertex;
+            for (int j = 2; j >= 0; j--) {
+                VState &v = m_vertex.at(tri[j]);
+                v.tri_count = u.vertex_tri_count[j];
+                m_group.at(v.group_id) = u.group[j];
+                changed.push_back(v.group_id);
+            }
+            m_vert_space = u.vert_space;
+            m_batch_transforms = u.batch_transforms;
+            m_removed[u.triangle_id] = false;
+            m_remaining++;
+        }
+        for (const UndoRecord &u : m_undo) {
+            const Cost cost = TriangleCost(u.triangle_id);
+            m_cost[u.triangle_id] = cost;
+            m_queue.emplace(cost, u.triangle_id);
+        }
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()),
+                      changed.end());
+        for (const int group_id : changed) {
+            UpdateGroup(group_id);
+        }
+        m_batch_vertex.resize(m_batch_vertex.size() - m_undo_vertex_count);
+        m_batch_triangle.resize(m_batch_triangle.size() - m_undo.size());
+        m_undo.clear();
+        m_undo_vertex_count = 0;
+    }
+
     void AddTriangle(int triangle_id) {
-        Triangle tri = m_triangle.at(triangle_id);
-        m_triangle.erase(m_triangle.begin() + triangle_id);
+        const Triangle tri = m_triangle.at(triangle_id);
+        if (m_record_undo) {
+            UndoRecord u;
+            u.triangle_id = triangle_id;
+            u.vert_space = m_vert_space;
+            u.batch_transforms = m_batch_transforms;
+            for (int j = 0; j < 3; j++) {
+                const VState &v = m_vertex.at(tri.vertex[j]);
+                u.vertex_tri_count[j] = v.tri_count;
+                u.group[j] = m_group.at(v.group_id);
+            }
+            m_undo.push_back(u);
+        }
+        m_queue.erase(std::make_pair(m_cost[triangle_id], triangle_id));
+        m_removed[triangle_id] = true;
+        m_remaining--;
         for (const int vertex_id : tri.vertex) {
             VState &v = m_vertex.at(vertex_id);
             GState &g = m_group.at(v.group_id);
@@ -255,6 +565,12 @@ private:
                 assert(m_vert_space > 0);
                 m_vert_space--;
                 m_batch_vertex.push_back(vertex_id);
+                if (m_record_undo) {
+                    m_undo_vertex_count++;
+                }
+                if (!g.can_reuse) {
+                    m_batch_transforms++;
+                }
             }
             assert(v.tri_count >= 1);
             v.tri_count--;
@@ -263,11 +579,29 @@ private:
             g.in_current_batch = true;
             g.current_attr = v.tri_count == 0 ? -1 : vertex_id;
         }
+        const std::array<int, 3> groups = TriangleGroups(triangle_id);
+        for (int j = 0; j < 3; j++) {
+            if (j == 0 || groups[j] != groups[j - 1]) {
+                UpdateGroup(groups[j]);
+            }
+        }
         m_batch_triangle.push_back(tri);
     }
 
     void StartBatch(DisplayList *dl) {
-        for (GState &g : m_group) {
+        // Only groups in the last two batches can have flags set. Clear them,
+        // mark the groups in the previous batch as reusable, and then update
+        // the costs for the affected triangles.
+        std::vector<int> &changed = m_changed_group;
+        changed.clear();
+        for (const int vertex_id : m_batch_vertex) {
+            changed.push_back(m_vertex.at(vertex_id).group_id);
+        }
+        for (const int vertex_id : m_prev_vertex) {
+            changed.push_back(m_vertex.at(vertex_id).group_id);
+        }
+        for (const int group_id : changed) {
+            GState &g = m_group.at(group_id);
             g.can_reuse = false;
             g.in_current_batch = false;
         }
@@ -276,12 +610,19 @@ private:
             GState &g = m_group.at(v.group_id);
             g.can_reuse = true;
         }
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()),
+                      changed.end());
+        for (const int group_id : changed) {
+            UpdateGroup(group_id);
+        }
         m_vert_space = dl->vertex_cache_size();
+        m_batch_transforms = 0;
         m_batch_vertex.clear();
         m_batch_triangle.clear();
     }
 
-    void EmitPrevBatch(DisplayList *dl, std::FILE *stats) {
+    void EmitPrevBatch(DisplayList *dl, std::string *stats) {
         (void)dl;
         const std::vector<int> &vertex = m_prev_vertex;
         const std::vector<Triangle> &triangle = m_prev_triangle;
@@ -368,9 +709,12 @@ private:
             dl->Vertex(start, vdata);
         }
 
-        // Emit triangles.
+        // Find the slots for each triangle. Triangles with two vertexes in
+        // the same slot are not drawn.
+        std::vector<BatchTriangle> batch_triangle;
+        batch_triangle.reserve(triangle.size());
         for (const Triangle &tri : triangle) {
-            std::array<int, 3> tidx;
+            BatchTriangle btri;
             for (int i = 0; i < 3; i++) {
                 const int vertex_id = tri.vertex[i];
                 const VState &v = m_vertex.at(vertex_id);
@@ -379,19 +723,36 @@ private:
                     throw std::runtime_error(
                         "Batch::EmitVertexes: vertex missing from cache");
                 }
-                tidx[i] = slot;
-                const Vtx *sv = dl->cache().Get(slot);
-                if (sv == nullptr) {
-                    throw std::runtime_error("missing slot data");
-                }
-                dl->SetVertexTexcoord(slot, v.vertex.texcoord);
+                btri.slot[i] = slot;
+                btri.texcoord[i] = v.vertex.texcoord;
+            }
+            const std::array<int, 3> &s = btri.slot;
+            if (s[0] != s[1] && s[1] != s[2] && s[2] != s[0]) {
+                batch_triangle.push_back(btri);
             }
-            dl->Triangle(tidx);
+        }
+
+        // Emit triangles, ordered so they can be paired.
+        std::vector<std::array<int16_t, 2>> slot_texcoord(cache_size);
+        for (int i = 0; i < cache_size; i++) {
+            const Vtx *sv = dl->cache().Get(i);
+            if (sv != nullptr) {
+                slot_texcoord[i] = sv->texcoord;
+            }
+        }
+        for (const int index :
+             PairTriangles(batch_triangle, std::move(slot_texcoord))) {
+            const BatchTriangle &btri = batch_triangle[index];
+            for (int i = 0; i < 3; i++) {
+                dl->SetVertexTexcoord(btri.slot[i], btri.texcoord[i]);
+            }
+            dl->Triangle(btri.slot);
         }
 
         if (stats) {
-            fmt::print(stats, "    Batch {}: vertexes={}, triangles={}\n",
-                       batch_index, vertex.size(), triangle.size());
+            fmt::format_to(std::back_inserter(*stats),
+                           "    Batch {}: vertexes={}, triangles={}\n",
+                           batch_index, vertex.size(), triangle.size());
         }
     }
 
@@ -400,9 +761,39 @@ private:
     std::vector<GState> m_group;
     std::vector<Triangle> m_triangle;
 
+    // The triangles which use each group.
+    std::vector<std::vector<int>> m_group_triangle;
+
+    // Triangles which have not been emitted, ordered by cost, and the cost of
+    // each triangle in the queue.
+    std::set<std::pair<Cost, int>> m_queue;
+    std::vector<Cost> m_cost;
+    std::vector<bool> m_removed;
+    int m_remaining;
+
+    // Temporary list of groups which changed state.
+    std::vector<int> m_changed_group;
+
     // Space remaining in vetrex cache in current batch.
     int m_vert_space;
 
+    // Number of vertexes in the current batch which are not reused from the
+    // previous batch.
+    int m_batch_transforms;
+
+    // State for undoing changes to the current batch, when optimizing.
+    struct UndoRecord {
+        int triangle_id;
+        int vert_space;
+        int batch_transforms;
+        std::array<int, 3> vertex_tri_count;
+        std::array<GState, 3> group;
+    };
+    bool m_optimize;
+    bool m_record_undo = false;
+    std::vector<UndoRecord> m_undo;
+    int m_undo_vertex_count = 0;
+
     // Vertexes to be transformed in current batch, previous batch.
     std::vector<int> m_batch_vertex;
     std::vector<int> m_prev_vertex;
@@ -416,6 +807,7 @@ private:
 
     // Total vertex count at end, including duplicates that were not merged.
     int m_total_vtx = 0;
+    int m_position_count = 0;
 
     // The indexes of vertexes in the emitted display list.
     std::vector<int> m_dl_vertex;
@@ -427,6 +819,9 @@ void EmitAnimations(Model *model, const Mesh &mesh,
         // Assertion.
         throw std::runtime_error("vertex size mismatch");
     }
+    if (!mesh.bone_frame.empty()) {
+        model->bone_count = mesh.bone_frame.at(0).size();
+    }
     std::unordered_map<int, int> frame_map;
     for (const auto &aptr : mesh.animation) {
         Animation anim{};
@@ -439,13 +834,27 @@ void EmitAnimations(Model *model, const Mesh &mesh,
                 if (lookup != frame_map.end()) {
                     index = lookup->second;
                 } else {
-                    const std::vector<std::array<int16_t, 3>> &frame =
-                        mesh.animation_frame.at(mesh_anim_frame.data_index);
                     FrameData fdata{};
-                    fdata.pos.reserve(dl_vertex_id.size());
-                    for (const int vertex_id : dl_vertex_id) {
-                        fdata.pos.push_back(
-                            FrameVertex{frame.at(vertex_id), 0});
+                    if (model->bone_count != 0) {
+                        const std::vector<BoneMatrix> &frame =
+                            mesh.bone_frame.at(mesh_anim_frame.data_index);
+                        fdata.bone.reserve(frame.size());
+                        for (const BoneMatrix &m : frame) {
+                            fdata.bone.push_back(Mtx::FromAffine(m));
+                        }
+                    } else {
+                        const FrameView frame = mesh.animation_frame.at(
+                            mesh_anim_frame.data_index);
+                        fdata.pos.reserve(dl_vertex_id.size());
+                        for (size_t i = 0; i < dl_vertex_id.size(); i++) {
+                            // Vertexes which are not from the mesh, like
+                            // bounding boxes, do not move.
+                            const int vertex_id = dl_vertex_id[i];
+                            fdata.pos.push_back(FrameVertex{
+                                vertex_id < 0 ? model->vertex[i].pos
+                                              : frame.at(vertex_id),
+                                0});
+                        }
                     }
                     index = model->frame.size();
                     model->frame.push_back(std::move(fdata));
@@ -460,27 +869,335 @@ void EmitAnimations(Model *model, const Mesh &mesh,
     }
 }
 
+// A part of the mesh which is compiled separately: some of the triangles with
+// one level of detail, one material, and one bone.
+struct Segment {
+    int lod;
+    int material;
+    int bone;
+    // Indexes of the triangles in the mesh, in mesh order.
+    std::vector<int> triangle;
+    // If true, the segment is drawn from its own display list, which is
+    // skipped if the segment's bounding box is outside the view.
+    bool cull;
+};
+
+// Split a list of triangles into clusters of at most max_size triangles which
+// are close together. This recursively splits the triangles at the median
+// centroid along the longest axis. The triangles in each cluster stay in their
+// original order.
+void SplitClusters(const Mesh &mesh, std::vector<int> triangle, int max_size,
+                   std::vector<std::vector<int>> *out) {
+    if (static_cast<int>(triangle.size()) <= max_size) {
+        out->push_back(std::move(triangle));
+        return;
+    }
+    const FrameView pos = mesh.animation_frame.at(0);
+    // Centroids, multiplied by 3.
+    auto centroid = [&](int triangle_id, int axis) {
+        int sum = 0;
+        for (const int v : mesh.triangle[triangle_id].vertex) {
+            sum += pos.at(v)[axis];
+        }
+        return sum;
+    };
+    int axis = 0, axis_size = -1;
+    for (int i = 0; i < 3; i++) {
+        int lo = std::numeric_limits<int>::max();
+        int hi = std::numeric_limits<int>::min();
+        for (const int t : triangle) {
+            const int c = centroid(t, i);
+            lo = std::min(lo, c);
+            hi = std::max(hi, c);
+        }
+        if (hi - lo > axis_size) {
+            axis = i;
+            axis_size = hi - lo;
+        }
+    }
+    std::vector<int> order = triangle;
+    std::sort(order.begin(), order.end(), [&](int x, int y) {
+        const int cx = centroid(x, axis), cy = centroid(y, axis);
+        return cx != cy ? cx < cy : x < y;
+    });
+    const size_t half = order.size() / 2;
+    std::vector<int> first(order.begin(), order.begin() + half);
+    std::vector<int> second(order.begin() + half, order.end());
+    std::sort(first.begin(), first.end());
+    std::sort(second.begin(), second.end());
+    SplitClusters(mesh, std::move(first), max_size, out);
+    SplitClusters(mesh, std::move(second), max_size, out);
+}
+
+// Calculate the corners of the bounding box for the vertexes in a segment. If
+// animate is true, the box contains the vertexes in every animation frame.
+std::array<Vtx, 8> BoundingBox(const Mesh &mesh, const Segment &seg,
+                               bool animate) {
+    std::array<int16_t, 3> lo, hi;
+    lo.fill(std::numeric_limits<int16_t>::max());
+    hi.fill(std::numeric_limits<int16_t>::min());
+    const size_t frame_count = animate ? mesh.animation_frame.size() : 1;
+    for (size_t i = 0; i < frame_count; i++) {
+        const FrameView frame = mesh.animation_frame[i];
+        for (const int triangle_id : seg.triangle) {
+            for (const int v : mesh.triangle[triangle_id].vertex) {
+                const std::array<int16_t, 3> &pos = frame.at(v);
+                for (int j = 0; j < 3; j++) {
+                    lo[j] = std::min(lo[j], pos[j]);
+                    hi[j] = std::max(hi[j], pos[j]);
+                }
+            }
+        }
+    }
+    std::array<Vtx, 8> box{};
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 3; j++) {
+            box[i].pos[j] = (i & (1 << j)) != 0 ? hi[j] : lo[j];
+        }
+    }
+    return box;
+}
+
+// The compiled output for one segment. The command list does not include the
+// end of the display list.
+struct SegmentResult {
+    std::vector<Gfx> command;
+    std::vector<Vtx> vertex;
+    std::vector<int> dl_vertex_id;
+    std::string stats;
+    SegmentStats counts;
+
+    // Return true if this result is smaller than another result.
+    bool operator<(const SegmentResult &r) const {
+        if (vertex.size() != r.vertex.size()) {
+            return vertex.size() < r.vertex.size();
+        }
+        return command.size() < r.command.size();
+    }
+};
+
+// Compile a single segment. Vertex addresses in the display list start at
+// zero, and must be relocated afterwards.
+void CompileSegmentWith(SegmentResult *result, const VertexSet &vert,
+                        const Mesh &mesh, const Segment &seg,
+                        const Microcode &microcode, bool optimize,
+                        bool stats) {
+    Compiler compiler{vert, mesh, seg.triangle, optimize};
+    DisplayList dl(microcode, 0);
+    compiler.Emit(&dl, &result->dl_vertex_id,
+                  stats ? &result->stats : nullptr);
+    SegmentStats &counts = result->counts;
+    counts.lod = seg.lod;
+    counts.material = seg.material;
+    counts.bone = seg.bone;
+    counts.cull = seg.cull;
+    counts.triangle_count = seg.triangle.size();
+    counts.position_count = compiler.position_count();
+    counts.batch_count = compiler.batch_count();
+    counts.batch_vertex_count = compiler.batch_vertex_count();
+    result->command = dl.command();
+    result->vertex = dl.vertex();
+    const size_t command_count = result->command.size();
+    const size_t vertex_count = result->vertex.size();
+    OptimizeDisplayList(&result->command, &result->vertex,
+                        &result->dl_vertex_id, microcode);
+    counts.command_count = result->command.size();
+    counts.vertex_count = result->vertex.size();
+    counts.drawn_triangle_count = 0;
+    counts.paired_triangle_count = 0;
+    for (const Gfx &g : result->command) {
+        std::array<std::array<int, 3>, 2> tri;
+        const int n = g.DecodeTriangles(&tri);
+        counts.drawn_triangle_count += n;
+        if (n == 2) {
+            counts.paired_triangle_count += n;
+        }
+    }
+    if (stats) {
+        fmt::format_to(std::back_inserter(result->stats),
+                       "    Peephole: commands {} -> {}, vertexes {} -> {}\n",
+                       command_count, result->command.size(), vertex_count,
+                       result->vertex.size());
+        const int drawn = counts.drawn_triangle_count;
+        const int paired = counts.paired_triangle_count;
+        fmt::format_to(std::back_inserter(result->stats),
+                       "    Paired triangles: {} of {} ({:.1f}%)\n", paired,
+                       drawn, drawn > 0 ? 100.0 * paired / drawn : 0.0);
+    }
+}
+
+// Compile a single segment. When optimizing, this compiles the segment both
+// greedily and with optimization, and keeps the smaller result, so
+// optimization never makes the output worse.
+void CompileSegment(SegmentResult *result, const VertexSet &vert,
+                    const Mesh &mesh, const Segment &seg, const Config &cfg,
+                    bool stats) {
+    const Microcode &microcode = TargetMicrocode(cfg);
+    CompileSegmentWith(result, vert, mesh, seg, microcode, false, stats);
+    if (!cfg.optimize) {
+        return;
+    }
+    SegmentResult opt;
+    CompileSegmentWith(&opt, vert, mesh, seg, microcode, true, stats);
+    std::string line;
+    if (stats) {
+        line = fmt::format(
+            "    Optimize: vertexes {} -> {}, commands {} -> {}\n",
+            result->vertex.size(), opt.vertex.size(), result->command.size(),
+            opt.command.size());
+    }
+    if (opt < *result) {
+        *result = std::move(opt);
+    }
+    result->stats.append(line);
+}
+
 } // namespace
 
-Model CompileMesh(const Mesh &mesh, const Config &cfg, std::FILE *stats) {
+Model CompileMesh(const Mesh &mesh, const Config &cfg, std::FILE *stats,
+                  CompileStats *compile_stats) {
     if (stats) {
         fmt::print(stats, "Compiling model\n");
     }
-    int mat_count = 0;
+    int mat_count = 0, lod_count = 1;
     for (const Triangle &tri : mesh.triangle) {
         mat_count = std::max(mat_count, tri.material + 1);
+        lod_count = std::max(lod_count, tri.lod + 1);
     }
     VertexSet vert{mesh, cfg, stats};
+    if (compile_stats != nullptr) {
+        compile_stats->raw_vertex_count = vert.vertex.size();
+        compile_stats->unique_position_count = vert.group_count;
+        compile_stats->segment.clear();
+    }
+
+    // Split the mesh into segments, sorted by level of detail, material, and
+    // then bone. If culling, each of these is split into clusters.
+    std::vector<Segment> segment;
+    {
+        std::map<std::tuple<int, int, int>, std::vector<int>> keys;
+        for (size_t i = 0; i < mesh.triangle.size(); i++) {
+            const Triangle &tri = mesh.triangle[i];
+            keys[std::make_tuple(tri.lod, tri.material, tri.bone)].push_back(
+                i);
+        }
+        for (auto &[key, triangle] : keys) {
+            const auto [lod, material, bone] = key;
+            if (cfg.cull_triangles <= 0) {
+                segment.push_back(
+                    Segment{lod, material, bone, std::move(triangle), false});
+                continue;
+            }
+            std::vector<std::vector<int>> clusters;
+            SplitClusters(mesh, std::move(triangle), cfg.cull_triangles,
+                          &clusters);
+            for (std::vector<int> &cluster : clusters) {
+                segment.push_back(
+                    Segment{lod, material, bone, std::move(cluster), true});
+            }
+        }
+    }
+    const int seg_count = segment.size();
+
+    // Compile each segment separately, with vertex addresses relative to the
+    // start of that segment's vertex data. Segments are independent, so they
+    // can be compiled concurrently.
+    std::vector<SegmentResult> result(seg_count);
+    ParallelFor(cfg, seg_count, [&](int i) {
+        CompileSegment(&result[i], vert, mesh, segment[i], cfg,
+                       stats != nullptr);
+    });
+
+    // Concatenate the results, in order, and relocate the vertex addresses.
+    // Segments with a bone are drawn with the bone's matrix. Each segment has
+    // its own range of vertex data, so levels of detail do not share vertexes,
+    // and each level's vertexes are also stored in every animation frame.
     Model model;
+    model.lod.resize(lod_count);
+    for (int i = 0; i < lod_count; i++) {
+        LevelOfDetail &level = model.lod[i];
+        level.distance = i == 0 ? 0.0f : cfg.lod_distance.at(i - 1);
+        level.command.resize(mat_count);
+    }
     std::vector<int> dl_vertex_id;
-    for (int mat = 0; mat < mat_count; mat++) {
-        Compiler compiler{vert, mesh, mat};
-        DisplayList dl(VertexCacheSize, dl_vertex_id.size() * Vtx::Size);
-        compiler.Emit(&dl, &dl_vertex_id, stats);
-        dl.End();
-        model.command.emplace_back(dl.command());
-        model.vertex.insert(model.vertex.end(), std::begin(dl.vertex()),
-                            std::end(dl.vertex()));
+    std::vector<size_t> lod_vertex_count(lod_count, 0);
+    for (int i = 0; i < seg_count; i++) {
+        const Segment &seg = segment[i];
+        SegmentResult &r = result[i];
+        const Segment *prev = i == 0 ? nullptr : &segment[i - 1];
+        const bool new_lod = prev == nullptr || prev->lod != seg.lod;
+        const bool new_bone = new_lod || prev->material != seg.material ||
+                              prev->bone != seg.bone;
+        if (stats) {
+            if (seg.lod > 0 && new_lod) {
+                fmt::print(stats, "    Level of detail {}:\n", seg.lod);
+            }
+            if (seg.bone >= 0 && new_bone) {
+                fmt::print(stats, "    Bone {}:\n", seg.bone);
+            }
+            std::fwrite(r.stats.data(), 1, r.stats.size(), stats);
+        }
+        if (compile_stats != nullptr) {
+            compile_stats->segment.push_back(r.counts);
+        }
+        std::vector<Gfx> &dl = model.lod.at(seg.lod).command.at(seg.material);
+        if (seg.bone >= 0 && new_bone) {
+            dl.push_back(Gfx::SPMatrix(BoneAddress(seg.bone)));
+        }
+        if (seg.cull) {
+            // Draw the segment from its own display list, which first loads
+            // the corners of the bounding box and ends early if they are all
+            // outside the view.
+            const std::array<Vtx, 8> box =
+                BoundingBox(mesh, seg, cfg.animate && mesh.bone_frame.empty());
+            const uint32_t box_offset = dl_vertex_id.size() * Vtx::Size;
+            model.vertex.insert(model.vertex.end(), std::begin(box),
+                                std::end(box));
+            dl_vertex_id.insert(dl_vertex_id.end(), box.size(), -1);
+            lod_vertex_count[seg.lod] += box.size();
+            dl.push_back(Gfx::SPDisplayList(
+                DataAddress(model.called.size() * Gfx::Size)));
+            model.called.push_back(
+                Gfx::SPVertex(RSPAddress(box_offset), box.size(), 0));
+            model.called.push_back(Gfx::SPCullDisplayList(0, box.size() - 1));
+        }
+        const uint32_t offset = dl_vertex_id.size() * Vtx::Size;
+        for (Gfx &g : r.command) {
+            g.RelocateVertex(offset);
+        }
+        std::vector<Gfx> &out = seg.cull ? model.called : dl;
+        out.insert(out.end(), std::begin(r.command), std::end(r.command));
+        if (seg.cull) {
+            out.push_back(Gfx::SPEndDisplayList());
+        }
+        const Segment *next = i + 1 == seg_count ? nullptr : &segment[i + 1];
+        if (seg.bone >= 0 &&
+            (next == nullptr || next->lod != seg.lod ||
+             next->material != seg.material || next->bone != seg.bone)) {
+            dl.push_back(Gfx::SPPopMatrix());
+        }
+        model.vertex.insert(model.vertex.end(), std::begin(r.vertex),
+                            std::end(r.vertex));
+        lod_vertex_count[seg.lod] += r.vertex.size();
+        dl_vertex_id.insert(dl_vertex_id.end(), std::begin(r.dl_vertex_id),
+                            std::end(r.dl_vertex_id));
+    }
+    for (LevelOfDetail &level : model.lod) {
+        for (std::vector<Gfx> &dl : level.command) {
+            dl.push_back(Gfx::SPEndDisplayList());
+        }
+    }
+    if (stats) {
+        std::vector<size_t> lod_triangle_count(lod_count, 0);
+        for (const Triangle &tri : mesh.triangle) {
+            lod_triangle_count[tri.lod]++;
+        }
+        for (int i = 0; i < lod_count; i++) {
+            fmt::print(stats,
+                       "    Level of detail {} total: {} triangles, {} "
+                       "vertexes\n",
+                       i, lod_triangle_count[i], lod_vertex_count[i]);
+        }
     }
     if (cfg.animate) {
         EmitAnimations(&model, mesh, dl_vertex_id);
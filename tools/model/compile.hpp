@@ -4,6 +4,7 @@
 #pragma once
 
 #include <cstdio>
+#include <vector>
 
 #include "tools/model/model.hpp"
 
@@ -16,8 +17,40 @@ namespace gbi {
 
 class DisplayList;
 
-// Compile a mesh into a model usable by the engine.
-Model CompileMesh(const Mesh &mesh, const Config &cfg, std::FILE *stats);
+// Statistics for one compiled segment: the triangles in one level of detail
+// and material which use the same bone, or one culled cluster of them.
+struct SegmentStats {
+    int lod;
+    int material;
+    int bone;
+    bool cull;
+    int triangle_count;
+    // Number of vertex positions used by the triangles.
+    int position_count;
+    // Number of vertex cache batches, and vertexes loaded by them.
+    int batch_count;
+    int batch_vertex_count;
+    // Size of the output, after peephole optimization.
+    int command_count;
+    int vertex_count;
+    // Number of triangles drawn, and the number drawn in pairs by
+    // SP2Triangle.
+    int drawn_triangle_count;
+    int paired_triangle_count;
+};
+
+// Statistics for compiling a mesh.
+struct CompileStats {
+    int raw_vertex_count;
+    int unique_position_count;
+    std::vector<SegmentStats> segment;
+};
+
+// Compile a mesh into a model usable by the engine. Human-readable statistics
+// are written to stats and structured statistics are stored in
+// compile_stats, if they are not null.
+Model CompileMesh(const Mesh &mesh, const Config &cfg, std::FILE *stats,
+                  CompileStats *compile_stats);
 
 } // namespace gbi
 } // namespace modelconvert
@@ -0,0 +1,239 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+
+// Benchmark for the display list compiler. Generates a synthetic grid mesh,
+// compiles it, and reports the time taken and a hash of the output, so that
+// changes to the compiler can be checked for both speed and identical output.
+#include "lib/cpp/flag.hpp"
+#include "lib/cpp/hash.hpp"
+#include "tools/model/compile.hpp"
+#include "tools/model/config.hpp"
+#include "tools/model/mesh.hpp"
+#include "tools/model/microcode.hpp"
+#include "tools/model/model.hpp"
+#include "tools/model/reorder.hpp"
+#include "tools/model/simplify.hpp"
+#include "tools/model/simulate.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <fmt/format.h>
+
+namespace modelconvert {
+namespace {
+
+struct Args {
+    int size = 64;
+    int materials = 1;
+    int iterations = 1;
+    int lod = 0;
+    bool shuffle = false;
+    bool split = false;
+    std::string microcode = "f3dex2";
+    Config config{};
+};
+
+void Help(FILE *fp, flag::Parser &fl) {
+    std::fputs("Usage: compile_benchmark [-size=<n>] [-shuffle]\n\n", fp);
+    fl.OptionHelp(fp);
+}
+
+Args ParseArgs(int argc, char **argv) {
+    Args args{};
+    flag::Parser fl;
+    fl.SetHelp(Help);
+    fl.AddFlag(flag::Int(&args.size), "size",
+               "generate a grid of N by N quads, default 64", "N");
+    fl.AddFlag(flag::Int(&args.materials), "materials",
+               "split the grid into N materials, default 1", "N");
+    fl.AddFlag(flag::Int(&args.iterations), "iterations",
+               "compile the mesh N times, default 1", "N");
+    fl.AddFlag(flag::Int(&args.lod), "lod",
+               "add N simplified levels of detail, default 0", "N");
+    fl.AddFlag(flag::Int(&args.config.cull_triangles), "cull",
+               "cull clusters of up to N triangles, default 0", "N");
+    fl.AddFlag(flag::Int(&args.config.thread_count), "threads",
+               "use N threads, default one per CPU", "N");
+    fl.AddFlag(flag::String(&args.microcode), "microcode",
+               "compile for microcode NAME, default f3dex2", "NAME");
+    fl.AddBoolFlag(&args.shuffle, "shuffle", "shuffle triangle order");
+    fl.AddBoolFlag(&args.config.optimize, "optimize",
+                   "search for a smaller display list");
+    fl.AddBoolFlag(&args.config.reorder, "reorder",
+                   "reorder triangles for locality before compiling");
+    fl.AddBoolFlag(&args.split, "split",
+                   "give each triangle its own vertexes, like a flat-shaded "
+                   "mesh");
+    fl.ParseMain(argc, argv);
+    if (args.size < 1 || args.size > 1000) {
+        flag::FailUsage("-size must be in the range 1-1000");
+    }
+    if (args.materials < 1) {
+        flag::FailUsage("-materials must be positive");
+    }
+    if (args.iterations < 1) {
+        flag::FailUsage("-iterations must be positive");
+    }
+    if (args.lod < 0 || args.lod >= gbi::MaxLevelsOfDetail) {
+        flag::FailUsage(fmt::format("-lod must be in the range 0-{}",
+                                    gbi::MaxLevelsOfDetail - 1));
+    }
+    if (args.config.cull_triangles < 0) {
+        flag::FailUsage("-cull must not be negative");
+    }
+    if (args.config.thread_count < 0) {
+        flag::FailUsage("-threads must not be negative");
+    }
+    args.config.microcode = gbi::Microcode::Find(args.microcode);
+    if (args.config.microcode == nullptr) {
+        flag::FailUsage(fmt::format("unknown -microcode, options are: {}",
+                                    gbi::Microcode::Names()));
+    }
+    return args;
+}
+
+// Create a grid mesh with size x size quads, each split into two triangles.
+Mesh GridMesh(int size, int materials, bool split, bool shuffle) {
+    const int row = size + 1;
+    Mesh mesh;
+    mesh.vertex.resize(row * row, VertexAttr{});
+    std::vector<std::array<int16_t, 3>> pos;
+    pos.reserve(row * row);
+    for (int y = 0; y < row; y++) {
+        for (int x = 0; x < row; x++) {
+            pos.push_back(std::array<int16_t, 3>{
+                {static_cast<int16_t>(x * 16), static_cast<int16_t>(y * 16),
+                 static_cast<int16_t>((x * y) & 15)}});
+        }
+    }
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            const int v = y * row + x;
+            const int material = y * materials / size;
+            mesh.triangle.push_back(
+                Triangle{material, {{v, v + 1, v + row}}});
+            mesh.triangle.push_back(
+                Triangle{material, {{v + 1, v + row + 1, v + row}}});
+        }
+    }
+    if (split) {
+        // Duplicate vertexes, so each triangle has its own copies. They are
+        // merged back together by position when compiled.
+        std::vector<std::array<int16_t, 3>> split_pos;
+        split_pos.reserve(mesh.triangle.size() * 3);
+        for (Triangle &tri : mesh.triangle) {
+            for (int &v : tri.vertex) {
+                split_pos.push_back(pos[v]);
+                v = split_pos.size() - 1;
+            }
+        }
+        pos = std::move(split_pos);
+        mesh.vertex.resize(pos.size(), VertexAttr{});
+    }
+    mesh.animation_frame.Append(pos);
+    if (shuffle) {
+        // Fixed LCG, so the output is the same on every platform.
+        uint32_t state = 1;
+        for (size_t i = mesh.triangle.size(); i > 1; i--) {
+            state = state * 1103515245u + 12345u;
+            size_t j = (state >> 8) % i;
+            std::swap(mesh.triangle[i - 1], mesh.triangle[j]);
+        }
+    }
+    return mesh;
+}
+
+// Hash the display lists and vertex data in a compiled model.
+uint32_t HashModel(const gbi::Model &model) {
+    util::Murmur3 h = util::Murmur3::Initial(0);
+    for (const gbi::LevelOfDetail &level : model.lod) {
+        for (const std::vector<gbi::Gfx> &dl : level.command) {
+            h.Update(dl.size());
+            for (const gbi::Gfx &g : dl) {
+                h.Update(g.hi);
+                h.Update(g.lo);
+            }
+        }
+    }
+    for (const gbi::Gfx &g : model.called) {
+        h.Update(g.hi);
+        h.Update(g.lo);
+    }
+    for (const gbi::Vtx &v : model.vertex) {
+        uint8_t data[gbi::Vtx::Size];
+        v.WriteBinary(data);
+        for (size_t i = 0; i < sizeof(data); i += 4) {
+            h.Update(data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) |
+                     (static_cast<uint32_t>(data[i + 3]) << 24));
+        }
+    }
+    return h.Hash();
+}
+
+void Main(int argc, char **argv) {
+    using Clock = std::chrono::steady_clock;
+    Args args = ParseArgs(argc, argv);
+    Mesh mesh = GridMesh(args.size, args.materials, args.split, args.shuffle);
+    fmt::print("Triangles: {}\n", mesh.triangle.size());
+    if (args.lod > 0) {
+        Clock::time_point start = Clock::now();
+        GenerateLODs(&mesh, args.lod + 1, 0.5f, nullptr);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        fmt::print("Simplify time: {:.3f} ms\n", elapsed.count() * 1e3);
+        for (int i = 0; i < args.lod; i++) {
+            args.config.lod_distance.push_back(100.0f * (i + 1));
+        }
+    }
+    if (args.config.reorder) {
+        Clock::time_point start = Clock::now();
+        ReorderTriangles(&mesh, args.config.microcode->vertex_cache_size,
+                         nullptr);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        fmt::print("Reorder time: {:.3f} ms\n", elapsed.count() * 1e3);
+    }
+    double best = 0.0;
+    uint32_t hash = 0;
+    for (int i = 0; i < args.iterations; i++) {
+        Clock::time_point start = Clock::now();
+        gbi::Model model =
+            gbi::CompileMesh(mesh, args.config, nullptr, nullptr);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+        hash = HashModel(model);
+        if (i == 0) {
+            size_t ncmd = 0;
+            for (const gbi::LevelOfDetail &level : model.lod) {
+                for (const std::vector<gbi::Gfx> &dl : level.command) {
+                    ncmd += dl.size();
+                }
+            }
+            ncmd += model.called.size();
+            fmt::print("Commands: {}\n", ncmd);
+            fmt::print("Vertexes: {}\n", model.vertex.size());
+            const gbi::CostModel &m =
+                *gbi::CostModel::Find(args.config.microcode->cost_model);
+            gbi::Cost cost;
+            for (const std::vector<gbi::Gfx> &dl : model.lod.at(0).command) {
+                cost += gbi::SimulateDisplayList(model, dl, m);
+            }
+            fmt::print("Estimated RSP cycles: {:.0f}\n", cost.Cycles(m));
+        }
+    }
+    fmt::print("Time: {:.3f} ms\n", best * 1e3);
+    fmt::print("Output hash: {:08x}\n", hash);
+}
+
+} // namespace
+} // namespace modelconvert
+
+int main(int argc, char **argv) {
+    modelconvert::Main(argc, argv);
+    return 0;
+}
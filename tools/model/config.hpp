@@ -5,8 +5,14 @@
 
 #include "tools/model/axes.hpp"
 
+#include <vector>
+
 namespace modelconvert {
 
+namespace gbi {
+struct Microcode;
+}
+
 // Configuration for importing / rendering the mesh.
 struct Config {
     // If true, the materials are given a primitive color equal to the
@@ -26,6 +32,34 @@ struct Config {
     Axes axes;
     // If true, create animations.
     bool animate;
+    // Animation frames are merged if no vertex coordinate differs by more
+    // than this amount. Zero only merges identical frames.
+    int frame_tolerance;
+    // Animation frames are removed if they can be reconstructed, within this
+    // tolerance, by interpolating between neighboring frames. Negative values
+    // keep every frame.
+    int keyframe_tolerance;
+    // If true, split the mesh into rigid segments, one per bone, and animate
+    // it with bone matrixes instead of vertex positions.
+    bool rigid;
+    // Distance at which each simplified level of detail is used, in the same
+    // units as vertex positions. Empty if only the full mesh is used.
+    std::vector<float> lod_distance;
+    // Fraction of the triangles in the previous level of detail to keep in
+    // each simplified level.
+    float lod_ratio;
+    // If positive, split the mesh into clusters of at most this many
+    // triangles, and skip each cluster at runtime if its bounding box is
+    // outside the view.
+    int cull_triangles;
+    // If true, reorder triangles for vertex locality before compiling.
+    bool reorder;
+    // If true, spend more time searching for a smaller display list.
+    bool optimize;
+    // Number of threads to use, or 0 to use one thread per CPU.
+    int thread_count;
+    // Microcode to compile for, or null for F3DEX2.
+    const gbi::Microcode *microcode;
 };
 
 } // namespace modelconvert
@@ -4,6 +4,7 @@
 #include "tools/model/displaylist.hpp"
 
 #include "lib/cpp/pack.hpp"
+#include "tools/model/microcode.hpp"
 
 #include <algorithm>
 #include <cassert>
@@ -12,8 +13,10 @@
 namespace modelconvert {
 namespace gbi {
 
-DisplayList::DisplayList(unsigned cache_size, unsigned vertex_offset)
-    : m_cache{cache_size}, m_vertex_offset{vertex_offset}, m_has_tri1{false} {}
+DisplayList::DisplayList(const Microcode &microcode, unsigned vertex_offset)
+    : m_cache{static_cast<unsigned>(microcode.vertex_cache_size)},
+      m_vertex_offset{vertex_offset},
+      m_has_tri1{false} {}
 
 void DisplayList::Triangle(std::array<int, 3> tri) {
     for (int i = 0; i < 3; i++) {
@@ -83,9 +86,8 @@ void DisplayList::SetVertexColor(int vertex, std::array<uint8_t, 4> value) {
     }
     if (vtx->color != value) {
         vtx->color = value;
-        FlushVertex(vertex);
-        m_cmds.push_back(Gfx::SPModifyVertex(vertex, VertexField::RGBA,
-                                             util::Pack8x4(value)));
+        ModifyVertex(vertex, Gfx::SPModifyVertex(vertex, VertexField::RGBA,
+                                                 util::Pack8x4(value)));
     }
 }
 
@@ -96,11 +98,22 @@ void DisplayList::SetVertexTexcoord(int vertex, std::array<int16_t, 2> value) {
     }
     if (vtx->texcoord != value) {
         vtx->texcoord = value;
-        FlushVertex(vertex);
         // HACK: We are just hard-coding the RSP scaling factor here.
-        m_cmds.push_back(
-            Gfx::SPModifyVertex(vertex, VertexField::ST,
-                                util::Pack16x2(value[0] >> 1, value[1] >> 1)));
+        const uint32_t st = util::Pack16x2(value[0] >> 1, value[1] >> 1);
+        ModifyVertex(vertex,
+                     Gfx::SPModifyVertex(vertex, VertexField::ST, st));
+    }
+}
+
+void DisplayList::ModifyVertex(int vertex, const Gfx &cmd) {
+    FlushVertex(vertex);
+    if (m_has_tri1) {
+        // The pending triangle does not use this vertex, so modify the vertex
+        // before drawing it. The triangle can then still be paired.
+        assert(!m_cmds.empty());
+        m_cmds.insert(m_cmds.end() - 1, cmd);
+    } else {
+        m_cmds.push_back(cmd);
     }
 }
 
@@ -12,14 +12,13 @@
 namespace modelconvert {
 namespace gbi {
 
-// Number of entries in the vertex cache.
-constexpr unsigned VertexCacheSize = 32;
+struct Microcode;
 
 // Display list builder. Performs minor optimizations, such as combining
 // multiple triangles into SP1Triangle and SP2Triangle.
 class DisplayList {
 public:
-    DisplayList(unsigned cache_size, unsigned vertex_offset);
+    DisplayList(const Microcode &microcode, unsigned vertex_offset);
 
     // Read-only access to the vertex cache.
     const VertexCache &cache() const { return m_cache; }
@@ -49,6 +48,9 @@ public:
     void End();
 
 private:
+    // Add a command which modifies a vertex in the cache.
+    void ModifyVertex(int vertex, const Gfx &cmd);
+
     // Flush pending triangles with the given vertex.
     void FlushVertex(int vertex);
 
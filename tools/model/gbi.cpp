@@ -5,7 +5,9 @@
 
 #include "lib/cpp/bswap.hpp"
 
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 
 #include <fmt/format.h>
@@ -23,8 +25,19 @@ uint32_t UnshiftL(unsigned v, unsigned s, unsigned w) {
     return (v >> s) & ((1u << w) - 1);
 }
 
+// Throw an exception if a vertex index cannot be encoded.
+void CheckVertexIndex(int v) {
+    if (v < 0 || v >= MaxVertexCacheSize) {
+        throw std::invalid_argument(
+            fmt::format("Gfx: vertex index out of range: {}", v));
+    }
+}
+
 // Pack the indexes of a triangle into a single word.
 uint32_t Triangle(std::array<int, 3> v) {
+    for (const int x : v) {
+        CheckVertexIndex(x);
+    }
     return ShiftL(v[0] * 2, 16, 8) | ShiftL(v[1] * 2, 8, 8) |
            ShiftL(v[2] * 2, 0, 8);
 }
@@ -52,14 +65,19 @@ std::array<uint8_t, 4> UnRGBA(uint32_t v) {
     return {{r, g, b, a}};
 }
 
-// GBI opcodes.
+// G_DL parameters.
+enum {
+    G_DL_PUSH = 0x00,
+};
+
+// G_MTX parameters. Note that G_MTX_PUSH is inverted in the command.
 enum {
-    G_VTX = 0x01,
-    G_MODIFYVTX = 0x02,
-    G_TRI1 = 0x05,
-    G_TRI2 = 0x06,
-    G_ENDDL = 0xdf,
-    G_SETPRIMCOLOR = 0xfa,
+    G_MTX_NOPUSH = 0x00,
+    G_MTX_PUSH = 0x01,
+    G_MTX_MUL = 0x00,
+    G_MTX_LOAD = 0x02,
+    G_MTX_MODELVIEW = 0x00,
+    G_MTX_PROJECTION = 0x04,
 };
 
 // Return the field
@@ -104,6 +122,44 @@ void Vtx::WriteSource(std::vector<uint8_t> *out) const {
                    color[1], color[2], color[3]);
 }
 
+Mtx Mtx::FromAffine(const std::array<float, 12> &a) {
+    Mtx r{};
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            float v;
+            if (j < 3) {
+                v = a[j * 4 + i];
+            } else {
+                v = i == 3 ? 1.0f : 0.0f;
+            }
+            const float fv = v * 65536.0f;
+            int32_t iv;
+            if (std::isnan(fv)) {
+                iv = 0;
+            } else if (fv <= std::numeric_limits<int32_t>::min()) {
+                iv = std::numeric_limits<int32_t>::min();
+            } else if (fv >= std::numeric_limits<int32_t>::max()) {
+                iv = std::numeric_limits<int32_t>::max();
+            } else {
+                iv = std::lrintf(fv);
+            }
+            r.m[i * 4 + j] = iv;
+        }
+    }
+    return r;
+}
+
+void Mtx::WriteBinary(uint8_t *ptr) const {
+    uint16_t data[32];
+    for (int i = 0; i < 16; i++) {
+        const uint32_t v = m[i];
+        data[i] = BSwap16(v >> 16);
+        data[i + 16] = BSwap16(v);
+    }
+    static_assert(sizeof(data) == Size);
+    std::memcpy(ptr, data, sizeof(data));
+}
+
 void Gfx::WriteBinary(uint8_t *ptr) const {
     static_assert(sizeof(Gfx) == Size);
     Gfx g;
@@ -135,6 +191,12 @@ void Gfx::WriteSource(std::vector<uint8_t> *out) const {
                        "gsSPModifyVertex({}, G_MWO_POINT_{}, {})", vpos,
                        fieldname, value);
     } break;
+    case G_CULLDL: {
+        uint32_t vstart = UnshiftL(hi, 0, 16) / 2;
+        uint32_t vend = UnshiftL(lo, 0, 16) / 2;
+        fmt::format_to(std::back_inserter(*out), "gsSPCullDisplayList({}, {})",
+                       vstart, vend);
+    } break;
     case G_TRI1: {
         std::array<int, 3> tri = UnTriangle(hi);
         fmt::format_to(std::back_inserter(*out), "gsSP1Triangle({}, {}, {}, 0)",
@@ -147,6 +209,23 @@ void Gfx::WriteSource(std::vector<uint8_t> *out) const {
                        tris[0][0], tris[0][1], tris[0][2], tris[1][0],
                        tris[1][1], tris[1][2]);
     } break;
+    case G_POPMTX:
+        fmt::format_to(std::back_inserter(*out),
+                       "gsSPPopMatrixN(G_MTX_MODELVIEW, {})", lo / 64);
+        break;
+    case G_MTX: {
+        const uint32_t p = UnshiftL(hi, 0, 8) ^ G_MTX_PUSH;
+        fmt::format_to(std::back_inserter(*out),
+                       "gsSPMatrix(0x{:x}, {} | {} | {})", lo,
+                       (p & G_MTX_PROJECTION) ? "G_MTX_PROJECTION"
+                                              : "G_MTX_MODELVIEW",
+                       (p & G_MTX_LOAD) ? "G_MTX_LOAD" : "G_MTX_MUL",
+                       (p & G_MTX_PUSH) ? "G_MTX_PUSH" : "G_MTX_NOPUSH");
+    } break;
+    case G_DL:
+        fmt::format_to(std::back_inserter(*out), "gsSPDisplayList(0x{:x})",
+                       lo);
+        break;
     case G_ENDDL:
         fmt::format_to(std::back_inserter(*out), "gsSPEndDisplayList()");
         break;
@@ -164,7 +243,65 @@ void Gfx::WriteSource(std::vector<uint8_t> *out) const {
     }
 }
 
+bool Gfx::DecodeVertex(VertexLoad *load) const {
+    if ((hi >> 24) != G_VTX) {
+        return false;
+    }
+    load->address = lo;
+    load->count = UnshiftL(hi, 12, 8);
+    load->start = UnshiftL(hi, 1, 7) - load->count;
+    return true;
+}
+
+bool Gfx::DecodeModifyVertex(VertexModify *modify) const {
+    if ((hi >> 24) != G_MODIFYVTX) {
+        return false;
+    }
+    modify->vertex = UnshiftL(hi, 0, 16) / 2;
+    modify->field = static_cast<VertexField>(UnshiftL(hi, 16, 8));
+    modify->value = lo;
+    return true;
+}
+
+int Gfx::DecodeTriangles(std::array<std::array<int, 3>, 2> *tri) const {
+    int count;
+    switch (hi >> 24) {
+    case G_TRI1:
+        count = 1;
+        break;
+    case G_TRI2:
+        count = 2;
+        break;
+    default:
+        return 0;
+    }
+    (*tri)[0] = UnTriangle(hi);
+    (*tri)[1] = UnTriangle(lo);
+    for (int i = 0; i < count; i++) {
+        for (int &v : (*tri)[i]) {
+            v /= 2;
+        }
+    }
+    return count;
+}
+
+void Gfx::RelocateVertex(uint32_t offset) {
+    if ((hi >> 24) == G_VTX) {
+        lo += offset;
+    }
+}
+
+void Gfx::RelocateDisplayList(uint32_t offset) {
+    if ((hi >> 24) == G_DL) {
+        lo += offset;
+    }
+}
+
 Gfx Gfx::SPVertex(unsigned v, unsigned n, unsigned v0) {
+    if (n == 0 || v0 + n > static_cast<unsigned>(MaxVertexCacheSize)) {
+        throw std::invalid_argument(
+            fmt::format("Gfx::SPVertex: bad range: {}+{}", v0, n));
+    }
     return Gfx{
         ShiftL(G_VTX, 24, 8) | ShiftL(n, 12, 8) | ShiftL(v0 + n, 1, 7),
         v,
@@ -172,6 +309,7 @@ Gfx Gfx::SPVertex(unsigned v, unsigned n, unsigned v0) {
 }
 
 Gfx Gfx::SPModifyVertex(int vertex, VertexField field, uint32_t value) {
+    CheckVertexIndex(vertex);
     return Gfx{
         ShiftL(G_MODIFYVTX, 24, 8) |
             ShiftL(static_cast<uint32_t>(field), 16, 8) |
@@ -194,10 +332,43 @@ Gfx Gfx::SP2Triangle(std::array<int, 3> v1, std::array<int, 3> v2) {
     };
 }
 
+Gfx Gfx::SPCullDisplayList(unsigned vstart, unsigned vend) {
+    CheckVertexIndex(vstart);
+    CheckVertexIndex(vend);
+    return Gfx{
+        ShiftL(G_CULLDL, 24, 8) | ShiftL(vstart * 2, 0, 16),
+        ShiftL(vend * 2, 0, 16),
+    };
+}
+
+Gfx Gfx::SPDisplayList(uint32_t dl) {
+    return Gfx{
+        ShiftL(G_DL, 24, 8) | ShiftL(G_DL_PUSH, 16, 8),
+        dl,
+    };
+}
+
 Gfx Gfx::SPEndDisplayList() {
     return Gfx{ShiftL(G_ENDDL, 24, 8), 0};
 }
 
+Gfx Gfx::SPMatrix(uint32_t m) {
+    const unsigned p = G_MTX_MODELVIEW | G_MTX_MUL | G_MTX_PUSH;
+    return Gfx{
+        ShiftL(G_MTX, 24, 8) | ShiftL((Mtx::Size - 1) / 8, 19, 5) |
+            ShiftL(p ^ G_MTX_PUSH, 0, 8),
+        m,
+    };
+}
+
+Gfx Gfx::SPPopMatrix() {
+    return Gfx{
+        ShiftL(G_POPMTX, 24, 8) | ShiftL((Mtx::Size - 1) / 8, 19, 5) |
+            ShiftL(2, 0, 8),
+        Mtx::Size,
+    };
+}
+
 Gfx Gfx::DPSetPrimColor(unsigned m, unsigned l, std::array<uint8_t, 4> rgba) {
     return Gfx{
         ShiftL(G_SETPRIMCOLOR, 24, 8) | ShiftL(m, 8, 8) | ShiftL(l, 0, 8),
@@ -11,11 +11,42 @@
 namespace modelconvert {
 namespace gbi {
 
+// GBI opcodes.
+enum {
+    G_VTX = 0x01,
+    G_MODIFYVTX = 0x02,
+    G_CULLDL = 0x03,
+    G_TRI1 = 0x05,
+    G_TRI2 = 0x06,
+    G_POPMTX = 0xd8,
+    G_MTX = 0xda,
+    G_DL = 0xde,
+    G_ENDDL = 0xdf,
+    G_SETPRIMCOLOR = 0xfa,
+};
+
+// Largest vertex cache of the supported microcodes. The command encoding could
+// address up to 127 entries, but the Gfx encoders reject indexes past this so
+// that out-of-range indexes are caught early.
+constexpr int MaxVertexCacheSize = 64;
+
 // Calculate the address of an object relative to the display list start.
 inline uint32_t RSPAddress(uint32_t x) {
     return (1u << 24) | x;
 }
 
+// Calculate the address of a bone matrix. The runtime points segment 2 at the
+// bone matrixes for the current frame.
+inline uint32_t BoneAddress(unsigned bone) {
+    return (2u << 24) | (bone * 64);
+}
+
+// Calculate the address of a display list, relative to the start of the
+// model's main data. The runtime points segment 3 at the main data.
+inline uint32_t DataAddress(uint32_t x) {
+    return (3u << 24) | x;
+}
+
 // Vertex data.
 struct alignas(8) Vtx {
     // Size of vertex data.
@@ -38,6 +69,24 @@ struct alignas(8) Vtx {
     void WriteSource(std::vector<uint8_t> *out) const;
 };
 
+// Fixed-point transformation matrix.
+struct Mtx {
+    // Size of matrix data.
+    static constexpr size_t Size = 64;
+
+    // Elements in s15.16 fixed-point. Vectors are multiplied as row vectors,
+    // so the translation is in elements 12-14.
+    std::array<int32_t, 16> m;
+
+    // Convert an affine transformation, given as the top three rows of a 4x4
+    // matrix in row-major order, for column vectors.
+    static Mtx FromAffine(const std::array<float, 12> &a);
+
+    // Write to buffer in binary format. The integer parts of all elements come
+    // first, followed by the fractional parts.
+    void WriteBinary(uint8_t *ptr) const;
+};
+
 // Offsets within the vertex cache.
 enum class VertexField {
     RGBA = 16,
@@ -46,6 +95,20 @@ enum class VertexField {
     Z = 28,
 };
 
+// Fields of an SPVertex command.
+struct VertexLoad {
+    uint32_t address;
+    unsigned count;
+    unsigned start; // First slot in the vertex cache.
+};
+
+// Fields of an SPModifyVertex command.
+struct VertexModify {
+    int vertex;
+    VertexField field;
+    uint32_t value;
+};
+
 // Microcode command.
 struct alignas(8) Gfx {
     // Size of microcode command.
@@ -54,6 +117,9 @@ struct alignas(8) Gfx {
     uint32_t hi;
     uint32_t lo;
 
+    // Return the command's opcode.
+    unsigned opcode() const { return hi >> 24; }
+
     // Write to buffer in binary format.
     void WriteBinary(uint8_t *ptr) const;
 
@@ -63,11 +129,41 @@ struct alignas(8) Gfx {
     //     "gsSPVertex(0, 1, 2)"
     void WriteSource(std::vector<uint8_t> *out) const;
 
+    // Decode an SPVertex command. Return false if this is a different command.
+    bool DecodeVertex(VertexLoad *load) const;
+
+    // Decode an SPModifyVertex command. Return false if this is a different
+    // command.
+    bool DecodeModifyVertex(VertexModify *modify) const;
+
+    // Decode an SP1Triangle or SP2Triangle command, and return the number of
+    // triangles. Return 0 if this is a different command.
+    int DecodeTriangles(std::array<std::array<int, 3>, 2> *tri) const;
+
+    // If this is an SPVertex command, add an offset to the vertex address.
+    // Other commands are unchanged.
+    void RelocateVertex(uint32_t offset);
+
+    // If this is an SPDisplayList command, add an offset to the display list
+    // address. Other commands are unchanged.
+    void RelocateDisplayList(uint32_t offset);
+
+    // Vertex commands throw std::invalid_argument if a vertex index is
+    // outside the vertex cache.
     static Gfx SPVertex(unsigned v, unsigned n, unsigned v0);
     static Gfx SPModifyVertex(int vertex, VertexField field, uint32_t value);
     static Gfx SP1Triangle(std::array<int, 3> v1);
     static Gfx SP2Triangle(std::array<int, 3> v1, std::array<int, 3> v2);
+    // End the current display list if vertexes vstart through vend,
+    // inclusive, are all outside the same edge of the view volume.
+    static Gfx SPCullDisplayList(unsigned vstart, unsigned vend);
+    // Call a display list.
+    static Gfx SPDisplayList(uint32_t dl);
     static Gfx SPEndDisplayList();
+    // Multiply the modelview matrix by a matrix, and push the result.
+    static Gfx SPMatrix(uint32_t m);
+    // Pop the modelview matrix.
+    static Gfx SPPopMatrix();
     static Gfx DPSetPrimColor(unsigned m, unsigned l,
                               std::array<uint8_t, 4> rgba);
 };
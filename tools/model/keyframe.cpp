@@ -0,0 +1,200 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/keyframe.hpp"
+
+#include "tools/model/mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include <fmt/core.h>
+
+namespace modelconvert {
+
+namespace {
+
+class Reducer {
+public:
+    Reducer(const Mesh &mesh, float tolerance)
+        : m_mesh{mesh}, m_tolerance{tolerance} {
+        // For bone matrixes, the error is measured at the largest vertex
+        // coordinates, which bounds the error for every vertex.
+        for (const std::array<int16_t, 3> &pos : mesh.animation_frame.at(0)) {
+            for (int j = 0; j < 3; j++) {
+                m_extent[j] =
+                    std::max(m_extent[j], std::abs(static_cast<float>(pos[j])));
+            }
+        }
+    }
+
+    // Return the frames to keep for one animation. Each segment is greedily
+    // extended as far as it can go while the skipped frames still fit.
+    std::vector<AnimationFrame> Reduce(
+        const std::vector<AnimationFrame> &frame) const {
+        if (frame.size() <= 2) {
+            return frame;
+        }
+        std::vector<AnimationFrame> result;
+        result.push_back(frame[0]);
+        size_t start = 0;
+        for (size_t end = 2; end < frame.size(); end++) {
+            if (!SegmentFits(frame, start, end)) {
+                start = end - 1;
+                result.push_back(frame[start]);
+            }
+        }
+        result.push_back(frame.back());
+        return result;
+    }
+
+private:
+    // Return true if the frames between start and end, exclusive, are all
+    // within the tolerance of the linear interpolation between start and end.
+    bool SegmentFits(const std::vector<AnimationFrame> &frame, size_t start,
+                     size_t end) const {
+        const AnimationFrame &fa = frame[start], &fb = frame[end];
+        const float dt = fb.time - fa.time;
+        if (dt < 1.0e-3f) {
+            // The runtime does not interpolate across such a short interval.
+            return false;
+        }
+        for (size_t i = start + 1; i < end; i++) {
+            const AnimationFrame &fm = frame[i];
+            if (fm.data_index == fa.data_index &&
+                fa.data_index == fb.data_index) {
+                continue;
+            }
+            const float t = (fm.time - fa.time) / dt;
+            const bool fits =
+                m_mesh.bone_frame.empty()
+                    ? PositionsFit(fa.data_index, fb.data_index,
+                                   fm.data_index, t)
+                    : BonesFit(fa.data_index, fb.data_index, fm.data_index,
+                               t);
+            if (!fits) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Return true if the vertex positions in frame m are within tolerance of
+    // the interpolation between frames a and b.
+    bool PositionsFit(int ia, int ib, int im, float t) const {
+        const FrameView a = m_mesh.animation_frame.at(ia);
+        const FrameView b = m_mesh.animation_frame.at(ib);
+        const FrameView m = m_mesh.animation_frame.at(im);
+        for (size_t v = 0; v < m.size(); v++) {
+            for (int j = 0; j < 3; j++) {
+                const float x = a[v][j] + (b[v][j] - a[v][j]) * t;
+                if (std::abs(x - m[v][j]) > m_tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Return true if the bone matrixes in frame m, applied to any vertex,
+    // give positions within tolerance of the interpolated matrixes.
+    bool BonesFit(int ia, int ib, int im, float t) const {
+        const std::vector<BoneMatrix> &a = m_mesh.bone_frame.at(ia);
+        const std::vector<BoneMatrix> &b = m_mesh.bone_frame.at(ib);
+        const std::vector<BoneMatrix> &m = m_mesh.bone_frame.at(im);
+        for (size_t bone = 0; bone < m.size(); bone++) {
+            for (int i = 0; i < 3; i++) {
+                float error = 0.0f;
+                for (int j = 0; j < 4; j++) {
+                    const int k = i * 4 + j;
+                    const float x = a[bone][k] + (b[bone][k] - a[bone][k]) * t;
+                    const float scale = j < 3 ? m_extent[j] : 1.0f;
+                    error += std::abs(x - m[bone][k]) * scale;
+                }
+                if (error > m_tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    const Mesh &m_mesh;
+    const float m_tolerance;
+    std::array<float, 3> m_extent{};
+};
+
+// Renumber the frames used by animations, in order of first use. Frame 0 is
+// the bind pose, which is always kept. Returns the old index of each kept
+// frame, in the new order.
+std::vector<int> RenumberFrames(Mesh *mesh, size_t old_count) {
+    std::vector<int> remap(old_count, -1);
+    std::vector<int> kept{0};
+    remap.at(0) = 0;
+    for (const std::unique_ptr<Animation> &anim : mesh->animation) {
+        if (anim) {
+            for (AnimationFrame &frame : anim->frame) {
+                int &index = remap.at(frame.data_index);
+                if (index < 0) {
+                    index = kept.size();
+                    kept.push_back(frame.data_index);
+                }
+                frame.data_index = index;
+            }
+        }
+    }
+    return kept;
+}
+
+// Remove frame data which is not used by any animation. Returns the number of
+// frames kept.
+size_t RemoveUnusedFrames(Mesh *mesh, FrameArray *frame_data) {
+    const std::vector<int> kept = RenumberFrames(mesh, frame_data->size());
+    frame_data->Select(kept);
+    return kept.size();
+}
+
+size_t RemoveUnusedFrames(Mesh *mesh,
+                          std::vector<std::vector<BoneMatrix>> *frame_data) {
+    const std::vector<int> kept = RenumberFrames(mesh, frame_data->size());
+    std::vector<std::vector<BoneMatrix>> result;
+    result.reserve(kept.size());
+    for (const int i : kept) {
+        result.push_back(std::move((*frame_data)[i]));
+    }
+    *frame_data = std::move(result);
+    return kept.size();
+}
+
+} // namespace
+
+void ReduceKeyframes(Mesh *mesh, int tolerance, std::FILE *stats) {
+    const Reducer reducer{*mesh, static_cast<float>(tolerance)};
+    size_t old_keyframes = 0, new_keyframes = 0;
+    for (const std::unique_ptr<Animation> &anim : mesh->animation) {
+        if (anim) {
+            old_keyframes += anim->frame.size();
+            anim->frame = reducer.Reduce(anim->frame);
+            new_keyframes += anim->frame.size();
+        }
+    }
+
+    size_t old_data, new_data;
+    if (mesh->bone_frame.empty()) {
+        old_data = mesh->animation_frame.size();
+        new_data = RemoveUnusedFrames(mesh, &mesh->animation_frame);
+    } else {
+        old_data = mesh->bone_frame.size();
+        new_data = RemoveUnusedFrames(mesh, &mesh->bone_frame);
+    }
+
+    if (stats) {
+        fmt::print(stats, "Keyframes: {} -> {}\n", old_keyframes,
+                   new_keyframes);
+        fmt::print(stats, "Frame data: {} -> {}\n", old_data, new_data);
+    }
+}
+
+} // namespace modelconvert
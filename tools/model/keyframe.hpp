@@ -0,0 +1,20 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include <cstdio>
+
+namespace modelconvert {
+
+struct Mesh;
+
+// Remove animation frames which can be reconstructed, within the given
+// tolerance, by linearly interpolating between the frames kept on either
+// side. For rigidly skinned meshes, the bone matrixes are interpolated, and
+// the error is bounded using the largest vertex coordinates. The first and
+// last frame of each animation are always kept. Frame data which is no longer
+// used by any animation is removed, except for the bind pose.
+void ReduceKeyframes(Mesh *mesh, int tolerance, std::FILE *stats);
+
+} // namespace modelconvert
@@ -4,12 +4,16 @@
 #include "tools/model/mesh.hpp"
 
 #include "tools/model/config.hpp"
+#include "tools/model/parallel.hpp"
 #include "lib/cpp/hash.hpp"
 #include "lib/cpp/pack.hpp"
 #include "lib/cpp/quote.hpp"
 
+#include <algorithm>
 #include <assimp/scene.h>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <fmt/core.h>
 #include <unordered_map>
 
@@ -75,19 +79,63 @@ void QuantizeVectors(std::vector<std::array<int16_t, 3>> *out,
     }
 }
 
-// A single vertex under the influence of a bone.
-struct BoneVertex {
-    int index;
-    float weight;
-};
-
 struct Bone {
     int node;
     std::string name;
-    std::vector<BoneVertex> vertex;
     aiMatrix4x4 offset_matrix; // mesh space -> bone space
+
+    // The vertexes under the influence of this bone: vertex index,
+    // untransformed position, and weight. These are stored as separate arrays
+    // so the skinning loop can be vectorized.
+    std::vector<int> index;
+    std::vector<float> x, y, z;
+    std::vector<float> weight;
 };
 
+// Transform the vertexes under the influence of a bone and multiply them by
+// their weights, writing the results to the output arrays.
+void SkinBone(const aiMatrix4x4 &mat, const Bone &bone, float *out_x,
+              float *out_y, float *out_z) {
+    // Copy the matrix, so the compiler does not have to reload it after
+    // every store.
+    const float m00 = mat.a1, m01 = mat.a2, m02 = mat.a3, m03 = mat.a4;
+    const float m10 = mat.b1, m11 = mat.b2, m12 = mat.b3, m13 = mat.b4;
+    const float m20 = mat.c1, m21 = mat.c2, m22 = mat.c3, m23 = mat.c4;
+    const float *x = bone.x.data(), *y = bone.y.data(), *z = bone.z.data(),
+                *weight = bone.weight.data();
+    const int n = bone.index.size();
+    int i = 0;
+    // Process four vertexes at a time, loading everything before storing
+    // anything, so the block can be vectorized even though the compiler does
+    // not know that the input and output arrays are distinct.
+    for (; i + 4 <= n; i += 4) {
+        float vx[4], vy[4], vz[4], w[4];
+        for (int j = 0; j < 4; j++) {
+            vx[j] = x[i + j];
+            vy[j] = y[i + j];
+            vz[j] = z[i + j];
+            w[j] = weight[i + j];
+        }
+        float ox[4], oy[4], oz[4];
+        for (int j = 0; j < 4; j++) {
+            ox[j] = (m00 * vx[j] + m01 * vy[j] + m02 * vz[j] + m03) * w[j];
+            oy[j] = (m10 * vx[j] + m11 * vy[j] + m12 * vz[j] + m13) * w[j];
+            oz[j] = (m20 * vx[j] + m21 * vy[j] + m22 * vz[j] + m23) * w[j];
+        }
+        for (int j = 0; j < 4; j++) {
+            out_x[i + j] = ox[j];
+            out_y[i + j] = oy[j];
+            out_z[i + j] = oz[j];
+        }
+    }
+    for (; i < n; i++) {
+        const float vx = x[i], vy = y[i], vz = z[i], w = weight[i];
+        out_x[i] = (m00 * vx + m01 * vy + m02 * vz + m03) * w;
+        out_y[i] = (m10 * vx + m11 * vy + m12 * vz + m13) * w;
+        out_z[i] = (m20 * vx + m21 * vy + m22 * vz + m23) * w;
+    }
+}
+
 // Information about a node in the hierarchy.
 struct Node {
     Node(int parent, std::string name)
@@ -96,20 +144,76 @@ struct Node {
     int parent;
     std::string name;
     aiMatrix4x4 transform; // Node's transformation relative to parent.
+};
 
-    // Temporary matrixes for evaluating animations.
-    aiMatrix4x4 current_local;
-    aiMatrix4x4 current_global;
+// Scratch space for evaluating a frame of animation. Each thread has its own.
+struct Pose {
+    std::vector<aiMatrix4x4> local;   // Relative to parent node.
+    std::vector<aiMatrix4x4> global;  // Relative to root node.
+    std::vector<aiVector3D> position; // Skinned vertex positions.
+    std::vector<float> x, y, z;       // Output of SkinBone.
 };
 
-struct FrameData {
-    // Hash of position data.
-    uint32_t hash;
+// A frame of animation to evaluate.
+struct FrameJob {
+    const aiAnimation *animation;
+    double time;
+};
 
-    // Position data.
+// An evaluated frame of animation: vertex positions, or bone matrixes for
+// rigid meshes.
+struct BakedFrame {
     std::vector<std::array<int16_t, 3>> position;
+    std::vector<BoneMatrix> bone;
 };
 
+// Cell in the index of frames by their summed vertex position.
+using FrameCell = std::array<int64_t, 3>;
+
+struct HashFrameCell {
+    uint32_t operator()(const FrameCell &c) const {
+        util::Murmur3 h = util::Murmur3::Initial(0);
+        for (const int64_t x : c) {
+            h.Update(static_cast<uint32_t>(x));
+            h.Update(static_cast<uint32_t>(static_cast<uint64_t>(x) >> 32));
+        }
+        return h.Hash();
+    }
+};
+
+// Divide, rounding towards negative infinity.
+int64_t FloorDiv(int64_t x, int64_t y) {
+    int64_t q = x / y;
+    if ((x % y != 0) && ((x < 0) != (y < 0))) {
+        q--;
+    }
+    return q;
+}
+
+// Return true if no coordinate differs by more than the tolerance.
+bool FramesNear(FrameView x, FrameView y, int tolerance) {
+    if (x.size() != y.size()) {
+        return false;
+    }
+    // Compare the coordinates as one flat array, in blocks without branches
+    // inside, so the compiler can vectorize the inner loop.
+    constexpr size_t BlockSize = 256;
+    const int16_t *xp = x.data()->data();
+    const int16_t *yp = y.data()->data();
+    const size_t n = x.size() * 3;
+    for (size_t start = 0; start < n; start += BlockSize) {
+        const size_t end = std::min(n, start + BlockSize);
+        int far = 0;
+        for (size_t i = start; i < end; i++) {
+            far |= std::abs(xp[i] - yp[i]) > tolerance;
+        }
+        if (far != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // Bounding box.
 class Bounds {
 public:
@@ -174,25 +278,57 @@ private:
     // Add a AssImp mesh.
     void AddMesh(const aiMesh *mesh, const aiMatrix4x4 &transform);
 
-    // Add an animation to the mesh.
-    void AddAnimation(int index, const aiAnimation *animation);
+    // Add all animations in the scene to the mesh. The frames are evaluated
+    // concurrently, and then added in order, so the result does not depend on
+    // the number of threads.
+    void AddAnimations(const aiScene *scene);
+
+    // Add an animation to the mesh. The frames are appended to the list of
+    // frames to evaluate, and the frame data indexes refer to that list.
+    void AddAnimation(int index, const aiAnimation *animation,
+                      std::vector<FrameJob> *jobs);
+
+    // Split the mesh into rigid segments, one for each bone. Each triangle is
+    // assigned to the bone with the most influence over its vertexes, and
+    // vertex positions are made relative to that bone.
+    void MakeRigid();
+
+    // Calculate the global transform of every node at the given time in an
+    // animation. If the animation is null, calculate the bind pose.
+    void PoseNodes(Pose *pose, const aiAnimation *animation,
+                   double time) const;
 
-    // Create a frame of animation. Returns the index of the new frame.
-    int CreateFrame(const aiAnimation *animation, double time);
+    // Evaluate a frame of animation.
+    void BakeFrame(Pose *pose, const FrameJob &job, BakedFrame *frame) const;
+
+    // Get the bone matrixes for a pose.
+    std::vector<BoneMatrix> BoneFrame(const Pose &pose) const;
+
+    // Add a frame of bone matrixes. Returns the index of the new frame, or the
+    // index of an existing identical frame.
+    int AddBoneFrame(std::vector<BoneMatrix> &&frame);
 
     // Add a frame of animation, given the position data. Returns the index of
-    // the new frame.
-    int AddFrame(std::vector<std::array<int16_t, 3>> &&position);
+    // the new frame, or the index of an existing frame with the same data.
+    int AddFrame(FrameView position);
+
+    // Find an existing frame which is equal to the given position data, or
+    // within the frame tolerance. Returns -1 if there is no such frame.
+    int FindFrame(uint32_t hash, FrameView position,
+                  const FrameCell &cell) const;
+
+    // Get the cell for a frame in the near-duplicate index.
+    FrameCell GetFrameCell(FrameView position) const;
 
     const Config &m_cfg;
     std::FILE *m_stats;
 
-    // Model transformation.
+    // Model transformation, and its inverse.
     aiMatrix4x4 m_transform;
+    aiMatrix4x4 m_inv_transform;
 
     // Vertex data.
-    std::vector<aiVector3D> m_rawposition;  // Untransformed.
-    std::vector<aiVector3D> m_tempposition; // Bones.
+    std::vector<aiVector3D> m_rawposition; // Untransformed.
     std::vector<VertexAttr> m_vertex;
 
     // Triangles.
@@ -209,8 +345,24 @@ private:
     // Animations.
     std::vector<std::unique_ptr<Animation>> m_animation;
 
-    // Frame data.
-    std::vector<FrameData> m_frame;
+    // Frame position data.
+    FrameArray m_frame;
+
+    // Bone matrixes for each frame, for rigid meshes.
+    std::vector<std::vector<BoneMatrix>> m_bone_frame;
+
+    // Bone frame indexes by hash, for finding exact duplicates.
+    std::unordered_map<uint32_t, std::vector<int>> m_bone_frame_hash;
+
+    // Frame indexes by hash, for finding exact duplicates.
+    std::unordered_map<uint32_t, std::vector<int>> m_frame_hash;
+
+    // Frame indexes by cell, for finding near duplicates. A frame's cell is
+    // the sum of its vertex positions, divided by a cell size larger than the
+    // largest difference between the sums of near-duplicate frames. Near
+    // duplicates are therefore in the same or adjacent cells.
+    std::unordered_map<FrameCell, std::vector<int>, HashFrameCell>
+        m_frame_cell;
 };
 
 void Importer::Import(const aiScene *scene) {
@@ -221,23 +373,28 @@ void Importer::Import(const aiScene *scene) {
         fmt::print(m_stats, "Model bounds: {}\n", bounds.ToString());
     }
     m_transform = axes * m_cfg.scale;
+    // Multiplying by the scale also scales the bottom row, which does not
+    // affect transformed vectors, but does affect the inverse.
+    m_inv_transform = m_transform;
+    m_inv_transform.d4 = 1.0f;
+    m_inv_transform.Inverse();
     AddNodes(scene->mRootNode, -1);
     AddMeshes(scene, scene->mRootNode, aiMatrix4x4());
     if (m_rawposition.empty() || m_vertexpos.empty()) {
         throw MeshError("empty mesh");
     }
+    if (m_cfg.rigid) {
+        MakeRigid();
+    }
     {
-        int frame = AddFrame(std::move(m_vertexpos));
+        int frame = AddFrame(m_vertexpos);
         if (frame != 0) {
             // Assertion.
             throw std::runtime_error("bind pose is not frame 0");
         }
     }
     if (m_cfg.animate) {
-        int animcount = scene->mNumAnimations;
-        for (int i = 0; i < animcount; i++) {
-            AddAnimation(i, scene->mAnimations[i]);
-        }
+        AddAnimations(scene);
     }
     if (m_stats) {
         fmt::print(m_stats, "\n========== Model Stats ==========\n");
@@ -257,10 +414,8 @@ Mesh Importer::IntoMesh() {
     if (m_frame.empty()) {
         throw std::runtime_error("no frames");
     }
-    mesh.animation_frame.reserve(m_frame.size());
-    for (FrameData &frame : m_frame) {
-        mesh.animation_frame.emplace_back(std::move(frame.position));
-    }
+    mesh.animation_frame = std::move(m_frame);
+    mesh.bone_frame = std::move(m_bone_frame);
     return mesh;
 }
 
@@ -470,10 +625,17 @@ done_normals:;
             const unsigned num_weights = bone->mNumWeights;
             const aiVertexWeight *weights = bone->mWeights;
             for (unsigned i = 0; i < num_weights; i++) {
-                b.vertex.push_back(BoneVertex{
-                    offset + static_cast<int>(weights[i].mVertexId),
-                    weights[i].mWeight,
-                });
+                const unsigned vertex_id = weights[i].mVertexId;
+                if (vertex_id >= static_cast<unsigned>(nvert)) {
+                    throw MeshError("invalid bone vertex index");
+                }
+                const int index = offset + vertex_id;
+                const aiVector3D &pos = m_rawposition[index];
+                b.index.push_back(index);
+                b.x.push_back(pos.x);
+                b.y.push_back(pos.y);
+                b.z.push_back(pos.z);
+                b.weight.push_back(weights[i].mWeight);
             }
             m_bone.push_back(std::move(b));
         }
@@ -500,10 +662,11 @@ typename Key::elem_type ReadObject(double time, const Key *keys, unsigned count,
     if (count == 0) {
         return default_value;
     }
-    unsigned idx = 0;
-    while (idx < count && time >= keys[idx].mTime) {
-        idx++;
-    }
+    // Find the first key after the given time. Keys are sorted by time.
+    const unsigned idx =
+        std::upper_bound(keys, keys + count, time,
+                         [](double t, const Key &k) { return t < k.mTime; }) -
+        keys;
     if (idx == 0) {
         return keys[0].mValue;
     }
@@ -520,7 +683,38 @@ typename Key::elem_type ReadObject(double time, const Key *keys, unsigned count,
     return Interpolate(a.mValue, b.mValue, frac);
 }
 
-void Importer::AddAnimation(int index, const aiAnimation *animation) {
+void Importer::AddAnimations(const aiScene *scene) {
+    std::vector<FrameJob> jobs;
+    const int animcount = scene->mNumAnimations;
+    for (int i = 0; i < animcount; i++) {
+        AddAnimation(i, scene->mAnimations[i], &jobs);
+    }
+
+    std::vector<BakedFrame> baked(jobs.size());
+    ParallelFor(m_cfg, jobs.size(), Pose{}, [&](Pose *pose, int i) {
+        BakeFrame(pose, jobs[i], &baked[i]);
+    });
+
+    // Add frames in order, so duplicate frames are merged the same way no
+    // matter how the work was divided.
+    std::vector<int> data_index(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        BakedFrame &frame = baked[i];
+        data_index[i] = m_cfg.rigid ? AddBoneFrame(std::move(frame.bone))
+                                    : AddFrame(frame.position);
+        frame.position = {};
+    }
+    for (const std::unique_ptr<Animation> &anim : m_animation) {
+        if (anim) {
+            for (AnimationFrame &frame : anim->frame) {
+                frame.data_index = data_index.at(frame.data_index);
+            }
+        }
+    }
+}
+
+void Importer::AddAnimation(int index, const aiAnimation *animation,
+                            std::vector<FrameJob> *jobs) {
     const double duration = animation->mDuration;
     int framecount = std::lrint(duration + 1.0);
     std::unique_ptr<Animation> anim = std::make_unique<Animation>();
@@ -528,7 +722,8 @@ void Importer::AddAnimation(int index, const aiAnimation *animation) {
     anim->duration = 1.0f;
     if (framecount <= 1) {
         AnimationFrame frame{};
-        frame.data_index = CreateFrame(animation, 0.0);
+        frame.data_index = jobs->size();
+        jobs->push_back(FrameJob{animation, 0.0});
         anim->frame.push_back(frame);
     } else if (framecount > 100) {
         throw MeshError("too maniy frames in animation");
@@ -538,7 +733,8 @@ void Importer::AddAnimation(int index, const aiAnimation *animation) {
             double time = i * (duration / (framecount - 1));
             AnimationFrame frame{};
             frame.time = (double)i / (framecount - 1);
-            frame.data_index = CreateFrame(animation, time);
+            frame.data_index = jobs->size();
+            jobs->push_back(FrameJob{animation, time});
             anim->frame.push_back(frame);
         }
     }
@@ -552,100 +748,292 @@ void Importer::AddAnimation(int index, const aiAnimation *animation) {
     slot = std::move(anim);
 }
 
-int Importer::CreateFrame(const aiAnimation *animation, double time) {
-    int vertcount = m_vertex.size();
+void Importer::MakeRigid() {
+    const int nvert = m_vertex.size();
+
+    // Find the bone with the largest weight for each vertex.
+    std::vector<int> vertex_bone(nvert, -1);
+    {
+        std::vector<float> vertex_weight(nvert, 0.0f);
+        const int nbone = m_bone.size();
+        for (int i = 0; i < nbone; i++) {
+            const Bone &bone = m_bone[i];
+            for (size_t j = 0; j < bone.index.size(); j++) {
+                const int index = bone.index[j];
+                if (bone.weight[j] > vertex_weight[index]) {
+                    vertex_weight[index] = bone.weight[j];
+                    vertex_bone[index] = i;
+                }
+            }
+        }
+    }
+
+    // Assign each triangle to the bone used by the most vertexes, or by the
+    // first vertex if they all differ. Split vertexes used by triangles with
+    // different bones, and move vertexes into bone space.
+    std::vector<VertexAttr> vertex;
+    std::vector<std::array<int16_t, 3>> vertexpos;
+    std::unordered_map<uint64_t, int> vertex_map;
+    for (Triangle &tri : m_triangle) {
+        std::array<int, 3> bone;
+        for (int i = 0; i < 3; i++) {
+            bone[i] = vertex_bone[tri.vertex[i]];
+        }
+        tri.bone = bone[1] == bone[2] ? bone[1] : bone[0];
+        for (int &index : tri.vertex) {
+            const uint64_t key = (static_cast<uint64_t>(index) << 32) |
+                                 static_cast<uint32_t>(tri.bone + 1);
+            auto r = vertex_map.emplace(key, vertex.size());
+            if (r.second) {
+                vertex.push_back(m_vertex[index]);
+                if (tri.bone < 0) {
+                    vertexpos.push_back(m_vertexpos.at(index));
+                } else {
+                    const Bone &b = m_bone.at(tri.bone);
+                    vertexpos.push_back(QuantizeVector(
+                        m_transform *
+                        (b.offset_matrix * m_rawposition.at(index))));
+                }
+            }
+            index = r.first->second;
+        }
+    }
+    if (m_stats) {
+        fmt::print(m_stats, "Rigid vertexes: {} -> {}\n", nvert,
+                   vertex.size());
+    }
+    m_vertex = std::move(vertex);
+    m_vertexpos = std::move(vertexpos);
+    m_rawposition.clear();
+
+    Pose pose;
+    PoseNodes(&pose, nullptr, 0.0);
+    if (AddBoneFrame(BoneFrame(pose)) != 0) {
+        // Assertion.
+        throw std::runtime_error("bind pose is not frame 0");
+    }
+}
 
+void Importer::PoseNodes(Pose *pose, const aiAnimation *animation,
+                         double time) const {
     // Reset local transforms.
-    for (Node &node : m_node) {
-        node.current_local = node.transform;
+    const int nnode = m_node.size();
+    pose->local.resize(nnode);
+    pose->global.resize(nnode);
+    for (int i = 0; i < nnode; i++) {
+        pose->local[i] = m_node[i].transform;
     }
 
-    // Update local transforms from animation channels.
-    std::string node_name;
-    for (aiNodeAnim **cp = animation->mChannels,
-                    **ce = cp + animation->mNumChannels;
-         cp != ce; cp++) {
-        aiNodeAnim *chan = *cp;
-        node_name = std::string(Str(chan->mNodeName));
-        const auto entry = m_node_names.find(node_name);
-        if (entry == m_node_names.end()) {
-            throw MeshError(fmt::format(
-                "animation refers to unknown node, animation={}, node={}",
-                util::Quote(Str(animation->mName)), util::Quote(node_name)));
-        }
-        const int node_index = entry->second;
-        if (node_index == -1) {
-            throw MeshError(fmt::format(
-                "multiple nodes match animation channel, animation={}, node={}",
-                util::Quote(Str(animation->mName)), util::Quote(node_name)));
-        }
-        const aiVector3D position =
-            ReadObject(time, chan->mPositionKeys, chan->mNumPositionKeys,
-                       aiVector3D(0.0f));
-        aiQuaternion rotation = ReadObject(
-            time, chan->mRotationKeys, chan->mNumRotationKeys, aiQuaternion());
-        const aiVector3D scaling = ReadObject(
-            time, chan->mScalingKeys, chan->mNumScalingKeys, aiVector3D(1.0f));
-        m_node.at(node_index).current_local =
-            aiMatrix4x4(scaling, rotation, position);
+    // Update local transforms from animation channels. Without an animation,
+    // this is the bind pose.
+    if (animation != nullptr) {
+        std::string node_name;
+        for (aiNodeAnim **cp = animation->mChannels,
+                        **ce = cp + animation->mNumChannels;
+             cp != ce; cp++) {
+            aiNodeAnim *chan = *cp;
+            node_name = std::string(Str(chan->mNodeName));
+            const auto entry = m_node_names.find(node_name);
+            if (entry == m_node_names.end()) {
+                throw MeshError(fmt::format(
+                    "animation refers to unknown node, animation={}, node={}",
+                    util::Quote(Str(animation->mName)),
+                    util::Quote(node_name)));
+            }
+            const int node_index = entry->second;
+            if (node_index == -1) {
+                throw MeshError(
+                    fmt::format("multiple nodes match animation channel, "
+                                "animation={}, node={}",
+                                util::Quote(Str(animation->mName)),
+                                util::Quote(node_name)));
+            }
+            const aiVector3D position =
+                ReadObject(time, chan->mPositionKeys, chan->mNumPositionKeys,
+                           aiVector3D(0.0f));
+            aiQuaternion rotation =
+                ReadObject(time, chan->mRotationKeys, chan->mNumRotationKeys,
+                           aiQuaternion());
+            const aiVector3D scaling =
+                ReadObject(time, chan->mScalingKeys, chan->mNumScalingKeys,
+                           aiVector3D(1.0f));
+            pose->local.at(node_index) =
+                aiMatrix4x4(scaling, rotation, position);
+        }
     }
 
     // Update global transforms.
-    for (Node &node : m_node) {
-        if (node.parent == -1) {
-            node.current_global = node.current_local;
+    for (int i = 0; i < nnode; i++) {
+        const int parent = m_node[i].parent;
+        if (parent == -1) {
+            pose->global[i] = pose->local[i];
         } else {
             // Parent index is always < node index.
-            const aiMatrix4x4 &parent = m_node.at(node.parent).current_global;
-            node.current_global = parent * node.current_local;
+            pose->global[i] = pose->global.at(parent) * pose->local[i];
         }
     }
+}
 
-    // Evaluate bones.
-    m_tempposition.resize(vertcount);
-    for (aiVector3D &v : m_tempposition) {
-        v = aiVector3D();
+void Importer::BakeFrame(Pose *pose, const FrameJob &job,
+                         BakedFrame *frame) const {
+    PoseNodes(pose, job.animation, job.time);
+    if (m_cfg.rigid) {
+        frame->bone = BoneFrame(*pose);
+        return;
     }
+
+    // Evaluate bones. The vertexes for each bone are transformed in one pass,
+    // and then added to the vertex positions in a second pass.
+    const int vertcount = m_vertex.size();
+    pose->position.assign(vertcount, aiVector3D());
+    aiVector3D *position = pose->position.data();
     for (const Bone &bone : m_bone) {
-        aiMatrix4x4 mat =
-            m_node.at(bone.node).current_global * bone.offset_matrix;
-        for (const BoneVertex &v : bone.vertex) {
-            m_tempposition.at(v.index) +=
-                (mat * m_rawposition.at(v.index)) * v.weight;
+        const aiMatrix4x4 mat =
+            pose->global.at(bone.node) * bone.offset_matrix;
+        const size_t n = bone.index.size();
+        pose->x.resize(n);
+        pose->y.resize(n);
+        pose->z.resize(n);
+        SkinBone(mat, bone, pose->x.data(), pose->y.data(), pose->z.data());
+        for (size_t i = 0; i < n; i++) {
+            aiVector3D &pos = position[bone.index[i]];
+            pos.x += pose->x[i];
+            pos.y += pose->y[i];
+            pos.z += pose->z[i];
         }
     }
 
-    m_vertexpos.clear();
-    QuantizeVectors(&m_vertexpos, m_tempposition.data(), vertcount,
+    QuantizeVectors(&frame->position, pose->position.data(), vertcount,
                     m_transform);
-    return AddFrame(std::move(m_vertexpos));
 }
 
-int Importer::AddFrame(std::vector<std::array<int16_t, 3>> &&position) {
+std::vector<BoneMatrix> Importer::BoneFrame(const Pose &pose) const {
+    // The vertexes are already transformed into bone space and scaled, so
+    // scale and transform the bone matrix to match.
+    std::vector<BoneMatrix> frame;
+    frame.reserve(m_bone.size());
+    for (const Bone &bone : m_bone) {
+        const aiMatrix4x4 mat =
+            m_transform * pose.global.at(bone.node) * m_inv_transform;
+        BoneMatrix &m = frame.emplace_back();
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                m[i * 4 + j] = mat[i][j];
+            }
+        }
+    }
+    return frame;
+}
+
+int Importer::AddBoneFrame(std::vector<BoneMatrix> &&frame) {
+    // Negative zero compares equal to zero, so it must hash the same.
+    util::Murmur3 hash_state = util::Murmur3::Initial(0);
+    for (const BoneMatrix &m : frame) {
+        for (const float x : m) {
+            uint32_t bits = 0;
+            if (x != 0.0f) {
+                std::memcpy(&bits, &x, sizeof(bits));
+            }
+            hash_state.Update(bits);
+        }
+    }
+    std::vector<int> &bucket = m_bone_frame_hash[hash_state.Hash()];
+    for (const int index : bucket) {
+        if (m_bone_frame[index] == frame) {
+            return index;
+        }
+    }
+    const int index = m_bone_frame.size();
+    m_bone_frame.push_back(std::move(frame));
+    bucket.push_back(index);
+    return index;
+}
+
+int Importer::AddFrame(FrameView position) {
     util::Murmur3 hash_state = util::Murmur3::Initial(0);
     for (const std::array<int16_t, 3> &pos : position) {
         hash_state.Update(util::Pack16x2(pos[0], pos[1]));
         hash_state.Update(pos[2]);
     }
     uint32_t hash = hash_state.Hash();
-    auto start = m_frame.begin(), end = m_frame.end();
-    for (auto ptr = start; ptr != end; ++ptr) {
-        FrameData &frame = *ptr;
-        if (frame.hash == hash && frame.position == position) {
-            int index = ptr - start;
-            if (m_stats) {
-                fmt::print(m_stats, "Reusing frame {}\n", index);
-            }
-            return index;
+    FrameCell cell{};
+    if (m_cfg.frame_tolerance > 0) {
+        cell = GetFrameCell(position);
+    }
+    int index = FindFrame(hash, position, cell);
+    if (index >= 0) {
+        if (m_stats) {
+            fmt::print(m_stats, "Reusing frame {}\n", index);
         }
+        return index;
+    }
+    index = m_frame.size();
+    m_frame.Append(position);
+    m_frame_hash[hash].push_back(index);
+    if (m_cfg.frame_tolerance > 0) {
+        m_frame_cell[cell].push_back(index);
     }
-    int index = m_frame.size();
-    FrameData &frame = m_frame.emplace_back();
-    frame.hash = hash;
-    frame.position = std::move(position);
     return index;
 }
 
+int Importer::FindFrame(uint32_t hash, FrameView position,
+                        const FrameCell &cell) const {
+    auto it = m_frame_hash.find(hash);
+    if (it != m_frame_hash.end()) {
+        for (const int index : it->second) {
+            if (m_frame[index] == position) {
+                return index;
+            }
+        }
+    }
+    const int tolerance = m_cfg.frame_tolerance;
+    if (tolerance <= 0) {
+        return -1;
+    }
+    // Search the adjacent cells. Choose the earliest matching frame, so the
+    // result does not depend on hash table order.
+    int best = -1;
+    FrameCell c;
+    for (int dx = -1; dx <= 1; dx++) {
+        c[0] = cell[0] + dx;
+        for (int dy = -1; dy <= 1; dy++) {
+            c[1] = cell[1] + dy;
+            for (int dz = -1; dz <= 1; dz++) {
+                c[2] = cell[2] + dz;
+                auto it = m_frame_cell.find(c);
+                if (it == m_frame_cell.end()) {
+                    continue;
+                }
+                for (const int index : it->second) {
+                    if ((best == -1 || index < best) &&
+                        FramesNear(m_frame[index], position, tolerance)) {
+                        best = index;
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+FrameCell Importer::GetFrameCell(FrameView position) const {
+    // If every coordinate differs by at most the tolerance, the sums differ
+    // by at most tolerance * count, which is less than the cell size.
+    const int64_t size =
+        static_cast<int64_t>(m_cfg.frame_tolerance) * position.size() + 1;
+    FrameCell sum{};
+    for (const std::array<int16_t, 3> &pos : position) {
+        for (int i = 0; i < 3; i++) {
+            sum[i] += pos[i];
+        }
+    }
+    FrameCell cell;
+    for (int i = 0; i < 3; i++) {
+        cell[i] = FloorDiv(sum[i], size);
+    }
+    return cell;
+}
+
 } // namespace
 
 Mesh Mesh::Import(const Config &cfg, std::FILE *stats, const aiScene *scene) {
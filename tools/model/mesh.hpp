@@ -6,7 +6,9 @@
 #include "tools/model/axes.hpp"
 
 #include <array>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -42,19 +44,120 @@ struct VertexAttr {
 struct Triangle {
     int material;
     std::array<int, 3> vertex;
+    // Bone which transforms the triangle's vertexes, or -1 if the vertexes are
+    // not transformed by a bone.
+    int bone = -1;
+    // Level of detail which contains the triangle. Level 0 is the full mesh,
+    // and higher levels are simplified versions of it.
+    int lod = 0;
 };
 
+// An affine bone transformation, as the top three rows of a 4x4 matrix in
+// row-major order. This transforms bone-relative vertex positions into model
+// positions, in the same units as vertex positions.
+using BoneMatrix = std::array<float, 12>;
+
 // A frame in a mesh animation.
 struct AnimationFrame {
     // Time at which the frame is displayed, in seconds, where 0 is the start of
     // the animation.
     float time;
 
-    // Index of the frame position data, in the frame array, to display at this
-    // point in the animation.
+    // Index of the frame data to display at this point in the animation. This
+    // is an index into bone_frame if the mesh has bones, otherwise it is an
+    // index into animation_frame.
     int data_index;
 };
 
+// A read-only view of the vertex positions in one frame of animation.
+class FrameView {
+public:
+    FrameView() = default;
+    FrameView(const std::array<int16_t, 3> *data, size_t size)
+        : m_data{data}, m_size{size} {}
+    FrameView(const std::vector<std::array<int16_t, 3>> &data)
+        : m_data{data.data()}, m_size{data.size()} {}
+
+    size_t size() const { return m_size; }
+    const std::array<int16_t, 3> *data() const { return m_data; }
+    const std::array<int16_t, 3> *begin() const { return m_data; }
+    const std::array<int16_t, 3> *end() const { return m_data + m_size; }
+
+    const std::array<int16_t, 3> &operator[](size_t i) const {
+        return m_data[i];
+    }
+    const std::array<int16_t, 3> &at(size_t i) const {
+        if (i >= m_size) {
+            throw std::out_of_range("FrameView::at");
+        }
+        return m_data[i];
+    }
+
+    bool operator==(FrameView other) const {
+        return m_size == other.m_size &&
+               (m_size == 0 || std::memcmp(m_data, other.m_data,
+                                           m_size * sizeof(*m_data)) == 0);
+    }
+    bool operator!=(FrameView other) const { return !(*this == other); }
+
+private:
+    const std::array<int16_t, 3> *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Vertex positions for a sequence of animation frames. Every frame has the
+// same number of vertexes, and the frames are stored one after another in a
+// single array.
+class FrameArray {
+public:
+    // Number of frames.
+    size_t size() const { return m_frame_count; }
+    bool empty() const { return m_frame_count == 0; }
+
+    // Number of vertexes in each frame.
+    size_t vertex_count() const { return m_vertex_count; }
+
+    FrameView operator[](size_t frame) const {
+        return FrameView{m_data.data() + frame * m_vertex_count,
+                         m_vertex_count};
+    }
+    FrameView at(size_t frame) const {
+        if (frame >= m_frame_count) {
+            throw std::out_of_range("FrameArray::at");
+        }
+        return (*this)[frame];
+    }
+
+    // Add a frame to the end. The first frame sets the number of vertexes,
+    // and every other frame must have the same number.
+    void Append(FrameView frame) {
+        if (m_frame_count == 0) {
+            m_vertex_count = frame.size();
+        } else if (frame.size() != m_vertex_count) {
+            throw std::invalid_argument("FrameArray::Append: wrong size");
+        }
+        m_data.insert(m_data.end(), frame.begin(), frame.end());
+        m_frame_count++;
+    }
+
+    // Keep only the given frames, in the given order.
+    void Select(const std::vector<int> &frames) {
+        std::vector<std::array<int16_t, 3>> data;
+        data.reserve(frames.size() * m_vertex_count);
+        for (const int i : frames) {
+            const FrameView frame = at(i);
+            data.insert(data.end(), frame.begin(), frame.end());
+        }
+        m_data = std::move(data);
+        m_frame_count = frames.size();
+    }
+
+private:
+    size_t m_frame_count = 0;
+    size_t m_vertex_count = 0;
+    std::vector<std::array<int16_t, 3>> m_data;
+};
+
 // A mesh animation.
 struct Animation {
     // Duration of animation, in seconds.
@@ -75,7 +178,13 @@ struct Mesh {
     // Animations, and the associated frame data. Some may be null. Frame 0 is
     // the bind pose, it is always present.
     std::vector<std::unique_ptr<Animation>> animation;
-    std::vector<std::vector<std::array<int16_t, 3>>> animation_frame;
+    FrameArray animation_frame;
+
+    // Bone matrixes for each frame, if the mesh is rigidly skinned. Vertex
+    // positions are then relative to the bone for each triangle, and
+    // animation_frame only contains the bind pose. Frame 0 is the bind pose.
+    // Empty if the mesh is not rigidly skinned.
+    std::vector<std::vector<BoneMatrix>> bone_frame;
 
     // Import a scene as a mesh.
     static Mesh Import(const Config &cfg, std::FILE *stats,
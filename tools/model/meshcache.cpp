@@ -0,0 +1,432 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/meshcache.hpp"
+
+#include "lib/cpp/error.hpp"
+#include "lib/cpp/hash.hpp"
+#include "lib/cpp/log.hpp"
+#include "lib/cpp/quote.hpp"
+#include "tools/model/config.hpp"
+#include "tools/model/mesh.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace modelconvert {
+
+namespace {
+
+// Magic number at the start of cache files, "S64M".
+constexpr uint32_t CacheMagic = 0x4d343653;
+
+// Version of the cache file format. Change this whenever the format or the
+// output of Mesh::Import changes, so old cache files are not used.
+constexpr uint32_t CacheVersion = 1;
+
+// A read-only memory mapping of an entire file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {
+        if (m_data != nullptr) {
+            munmap(m_data, m_size);
+        }
+    }
+
+    // Map a file. Return false if the file does not exist.
+    bool Open(const std::string &name) {
+        const int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            if (errno == ENOENT) {
+                return false;
+            }
+            throw util::IOError(name, "open", errno);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            const int e = errno;
+            close(fd);
+            throw util::IOError(name, "stat", e);
+        }
+        m_size = st.st_size;
+        if (m_size > 0) {
+            void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                const int e = errno;
+                close(fd);
+                throw util::IOError(name, "mmap", e);
+            }
+            m_data = ptr;
+        }
+        close(fd);
+        return true;
+    }
+
+    const uint8_t *data() const { return static_cast<const uint8_t *>(m_data); }
+    size_t size() const { return m_size; }
+
+private:
+    void *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Thrown when a cache file is corrupt.
+class CacheError : public std::runtime_error {
+public:
+    using runtime_error::runtime_error;
+};
+
+// Writes little-endian cache data.
+class Writer {
+public:
+    void U8(uint8_t x) { m_data.push_back(x); }
+    void U16(uint16_t x) {
+        U8(x);
+        U8(x >> 8);
+    }
+    void U32(uint32_t x) {
+        U16(x);
+        U16(x >> 16);
+    }
+    void U64(uint64_t x) {
+        U32(x);
+        U32(x >> 32);
+    }
+    void I32(int32_t x) { U32(x); }
+    void F32(float x) {
+        uint32_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        U32(u);
+    }
+    void Count(size_t n) { U32(n); }
+
+    const std::vector<uint8_t> &data() const { return m_data; }
+
+private:
+    std::vector<uint8_t> m_data;
+};
+
+// Reads little-endian cache data from a mapped file.
+class Reader {
+public:
+    Reader(const uint8_t *data, size_t size)
+        : m_ptr{data}, m_end{data + size} {}
+
+    uint8_t U8() {
+        Need(1);
+        return *m_ptr++;
+    }
+    uint16_t U16() {
+        Need(2);
+        const uint16_t x = m_ptr[0] | (m_ptr[1] << 8);
+        m_ptr += 2;
+        return x;
+    }
+    uint32_t U32() {
+        const uint32_t lo = U16();
+        return lo | (static_cast<uint32_t>(U16()) << 16);
+    }
+    uint64_t U64() {
+        const uint64_t lo = U32();
+        return lo | (static_cast<uint64_t>(U32()) << 32);
+    }
+    int32_t I32() { return U32(); }
+    float F32() {
+        const uint32_t u = U32();
+        float x;
+        std::memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+
+    // Read an element count, where each element uses at least min_size bytes.
+    // This rejects corrupt counts before anything is allocated.
+    size_t Count(size_t min_size) {
+        const size_t n = U32();
+        if (n > static_cast<size_t>(m_end - m_ptr) / min_size) {
+            throw CacheError("count too large");
+        }
+        return n;
+    }
+
+    bool AtEnd() const { return m_ptr == m_end; }
+
+private:
+    void Need(size_t n) {
+        if (static_cast<size_t>(m_end - m_ptr) < n) {
+            throw CacheError("unexpected end of file");
+        }
+    }
+
+    const uint8_t *m_ptr;
+    const uint8_t *m_end;
+};
+
+// Sizes of serialized elements, in bytes.
+constexpr size_t VertexAttrSize = 4 + 4 + 3;
+constexpr size_t TriangleSize = 6 * 4;
+constexpr size_t PositionSize = 3 * 2;
+constexpr size_t BoneMatrixSize = 12 * 4;
+
+void WriteMesh(Writer &w, const Mesh &mesh) {
+    w.Count(mesh.vertex.size());
+    for (const VertexAttr &v : mesh.vertex) {
+        for (const int16_t x : v.texcoord) {
+            w.U16(x);
+        }
+        for (const uint8_t x : v.color) {
+            w.U8(x);
+        }
+        for (const int8_t x : v.normal) {
+            w.U8(x);
+        }
+    }
+    w.Count(mesh.triangle.size());
+    for (const Triangle &tri : mesh.triangle) {
+        w.I32(tri.material);
+        for (const int x : tri.vertex) {
+            w.I32(x);
+        }
+        w.I32(tri.bone);
+        w.I32(tri.lod);
+    }
+    w.Count(mesh.animation.size());
+    for (const std::unique_ptr<Animation> &anim : mesh.animation) {
+        w.U8(anim != nullptr);
+        if (anim != nullptr) {
+            w.F32(anim->duration);
+            w.Count(anim->frame.size());
+            for (const AnimationFrame &frame : anim->frame) {
+                w.F32(frame.time);
+                w.I32(frame.data_index);
+            }
+        }
+    }
+    w.Count(mesh.animation_frame.size());
+    for (size_t i = 0; i < mesh.animation_frame.size(); i++) {
+        const FrameView frame = mesh.animation_frame[i];
+        w.Count(frame.size());
+        for (const std::array<int16_t, 3> &pos : frame) {
+            for (const int16_t x : pos) {
+                w.U16(x);
+            }
+        }
+    }
+    w.Count(mesh.bone_frame.size());
+    for (const std::vector<BoneMatrix> &frame : mesh.bone_frame) {
+        w.Count(frame.size());
+        for (const BoneMatrix &m : frame) {
+            for (const float x : m) {
+                w.F32(x);
+            }
+        }
+    }
+}
+
+void ReadMesh(Reader &r, Mesh *mesh) {
+    mesh->vertex.resize(r.Count(VertexAttrSize));
+    for (VertexAttr &v : mesh->vertex) {
+        for (int16_t &x : v.texcoord) {
+            x = r.U16();
+        }
+        for (uint8_t &x : v.color) {
+            x = r.U8();
+        }
+        for (int8_t &x : v.normal) {
+            x = r.U8();
+        }
+    }
+    const int nvert = mesh->vertex.size();
+    mesh->triangle.resize(r.Count(TriangleSize));
+    for (Triangle &tri : mesh->triangle) {
+        tri.material = r.I32();
+        for (int &x : tri.vertex) {
+            x = r.I32();
+            if (x < 0 || x >= nvert) {
+                throw CacheError("invalid vertex index");
+            }
+        }
+        tri.bone = r.I32();
+        tri.lod = r.I32();
+    }
+    mesh->animation.resize(r.Count(1));
+    for (std::unique_ptr<Animation> &anim : mesh->animation) {
+        if (r.U8() != 0) {
+            anim = std::make_unique<Animation>();
+            anim->duration = r.F32();
+            anim->frame.resize(r.Count(8));
+            for (AnimationFrame &frame : anim->frame) {
+                frame.time = r.F32();
+                frame.data_index = r.I32();
+            }
+        }
+    }
+    const size_t frame_count = r.Count(4);
+    std::vector<std::array<int16_t, 3>> frame;
+    for (size_t i = 0; i < frame_count; i++) {
+        frame.resize(r.Count(PositionSize));
+        if (i > 0 && frame.size() != mesh->animation_frame.vertex_count()) {
+            throw CacheError("inconsistent frame size");
+        }
+        for (std::array<int16_t, 3> &pos : frame) {
+            for (int16_t &x : pos) {
+                x = r.U16();
+            }
+        }
+        mesh->animation_frame.Append(frame);
+    }
+    mesh->bone_frame.resize(r.Count(4));
+    for (std::vector<BoneMatrix> &frame : mesh->bone_frame) {
+        frame.resize(r.Count(BoneMatrixSize));
+        for (BoneMatrix &m : frame) {
+            for (float &x : m) {
+                x = r.F32();
+            }
+        }
+    }
+    if (!r.AtEnd()) {
+        throw CacheError("extra data at end of file");
+    }
+}
+
+} // namespace
+
+uint64_t MeshCacheKey(const Config &cfg, const std::string &model_path) {
+    // Two 32-bit hashes with different seeds give a 64-bit key.
+    util::Murmur3 h[2] = {util::Murmur3::Initial(0x9e3779b9),
+                          util::Murmur3::Initial(0x7f4a7c15)};
+    const auto update = [&h](uint32_t x) {
+        h[0].Update(x);
+        h[1].Update(x);
+    };
+    const auto update_bytes = [&update](const uint8_t *data, size_t size) {
+        update(size);
+        for (size_t i = 0; i < size; i += 4) {
+            uint32_t x = 0;
+            std::memcpy(&x, data + i, std::min<size_t>(4, size - i));
+            update(x);
+        }
+    };
+    update(CacheVersion);
+    MappedFile file;
+    if (!file.Open(model_path)) {
+        throw util::IOError(model_path, "open", ENOENT);
+    }
+    update_bytes(file.data(), file.size());
+    const std::string axes = cfg.axes.ToString();
+    update_bytes(reinterpret_cast<const uint8_t *>(axes.data()), axes.size());
+    uint32_t scale;
+    std::memcpy(&scale, &cfg.scale, sizeof(scale));
+    update(scale);
+    update(cfg.use_normals);
+    update(cfg.use_texcoords);
+    update(cfg.use_vertex_colors);
+    update(cfg.texcoord_bits);
+    update(cfg.animate);
+    update(cfg.rigid);
+    update(cfg.frame_tolerance);
+    return (static_cast<uint64_t>(h[0].Hash()) << 32) | h[1].Hash();
+}
+
+std::string MeshCachePath(const std::string &cache_dir, uint64_t key) {
+    std::string result = cache_dir;
+    if (!result.empty() && result.back() != '/') {
+        result.push_back('/');
+    }
+    fmt::format_to(std::back_inserter(result), "{:016x}.mesh", key);
+    return result;
+}
+
+bool LoadMeshCache(const std::string &path, uint64_t key, Mesh *mesh) {
+    MappedFile file;
+    if (!file.Open(path)) {
+        return false;
+    }
+    Reader r{file.data(), file.size()};
+    try {
+        if (r.U32() != CacheMagic || r.U32() != CacheVersion ||
+            r.U64() != key) {
+            throw CacheError("wrong file type or version");
+        }
+        Mesh result;
+        ReadMesh(r, &result);
+        *mesh = std::move(result);
+    } catch (CacheError &ex) {
+        util::Warn("ignoring mesh cache {}: {}", util::Quote(path), ex.what());
+        return false;
+    }
+    return true;
+}
+
+void SaveMeshCache(const std::string &path, uint64_t key, const Mesh &mesh) {
+    Writer w;
+    w.U32(CacheMagic);
+    w.U32(CacheVersion);
+    w.U64(key);
+    WriteMesh(w, mesh);
+    // Threads in batch mode share a process ID, so the temporary file name
+    // also has a counter. The file is created with O_EXCL instead of mkstemp,
+    // so its permissions follow the umask like any other output file.
+    static std::atomic<unsigned> temp_counter;
+    std::string temp;
+    int fd;
+    for (int attempt = 0;; attempt++) {
+        temp = fmt::format("{}.{}.{}.tmp", path, getpid(), temp_counter++);
+        fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd != -1 || errno != EEXIST || attempt == 100) {
+            break;
+        }
+    }
+    if (fd == -1) {
+        util::Warn("could not save mesh cache {}: {}", util::Quote(path),
+                   util::StrError(errno));
+        return;
+    }
+    const char *op = nullptr;
+    int err = 0;
+    const uint8_t *ptr = w.data().data();
+    size_t rem = w.data().size();
+    while (rem > 0) {
+        const ssize_t amt = write(fd, ptr, rem);
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            op = "write";
+            err = errno;
+            break;
+        }
+        ptr += amt;
+        rem -= amt;
+    }
+    if (close(fd) != 0 && op == nullptr) {
+        op = "close";
+        err = errno;
+    }
+    if (op == nullptr && std::rename(temp.c_str(), path.c_str()) != 0) {
+        op = "rename";
+        err = errno;
+    }
+    if (op != nullptr) {
+        std::remove(temp.c_str());
+        util::Warn("could not save mesh cache {}: {}: {}", util::Quote(path),
+                   op, util::StrError(err));
+    }
+}
+
+} // namespace modelconvert
@@ -0,0 +1,31 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace modelconvert {
+
+struct Config;
+struct Mesh;
+
+// Return the cache key for importing a model file. This is a hash of the file
+// contents and the configuration fields which affect Mesh::Import. Other files
+// which the importer loads along with the model are not included.
+uint64_t MeshCacheKey(const Config &cfg, const std::string &model_path);
+
+// Return the path to the cache file for a key in a cache directory.
+std::string MeshCachePath(const std::string &cache_dir, uint64_t key);
+
+// Load a cached mesh. Return false if the cache file does not exist, or if
+// it is not a valid cache file for this key.
+bool LoadMeshCache(const std::string &path, uint64_t key, Mesh *mesh);
+
+// Save a mesh to the cache. The file is written under a unique temporary name
+// and then renamed, so a concurrent reader never sees a partial file. Errors
+// are reported as warnings, since the cache is only used to save time.
+void SaveMeshCache(const std::string &path, uint64_t key, const Mesh &mesh);
+
+} // namespace modelconvert
@@ -0,0 +1,62 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/microcode.hpp"
+
+#include "tools/model/config.hpp"
+
+namespace modelconvert {
+namespace gbi {
+
+namespace {
+
+// There are no separate cost measurements for the other microcodes yet, so
+// they use the F3DEX2 cost model.
+constexpr Microcode Microcodes[] = {
+    {"f3dex2", 32, "f3dex2"},
+    // F3DEX3 has a 56-entry vertex cache.
+    {"f3dex3", 56, "f3dex2"},
+    // F3DEX2.Rej has a 64-entry vertex cache, but does not clip triangles, so
+    // triangles crossing the edge of the screen are discarded.
+    {"f3dex2.rej", 64, "f3dex2"},
+};
+
+constexpr bool CacheSizesFit() {
+    for (const Microcode &m : Microcodes) {
+        if (m.vertex_cache_size > MaxVertexCacheSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(CacheSizesFit(), "vertex cache is too large");
+
+} // namespace
+
+const Microcode *Microcode::Find(std::string_view name) {
+    for (const Microcode &m : Microcodes) {
+        if (name == m.name) {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+std::string Microcode::Names() {
+    std::string result;
+    for (const Microcode &m : Microcodes) {
+        if (!result.empty()) {
+            result.append(", ");
+        }
+        result.append(m.name);
+    }
+    return result;
+}
+
+const Microcode &TargetMicrocode(const Config &cfg) {
+    return cfg.microcode != nullptr ? *cfg.microcode : Microcodes[0];
+}
+
+} // namespace gbi
+} // namespace modelconvert
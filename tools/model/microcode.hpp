@@ -0,0 +1,37 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include "tools/model/gbi.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace modelconvert {
+
+struct Config;
+
+namespace gbi {
+
+// The features of an RSP microcode which the compiler targets. Every microcode
+// here uses the F3DEX2 command encoding, including SP2Triangle.
+struct Microcode {
+    const char *name;
+    int vertex_cache_size;  // Number of entries in the vertex cache.
+    const char *cost_model; // Name of the cost model for estimating RSP time.
+
+    // Get the microcode with the given name, or return null if there is no
+    // microcode with that name.
+    static const Microcode *Find(std::string_view name);
+
+    // Get the names of all microcodes, separated by commas.
+    static std::string Names();
+};
+
+// Get the microcode to compile for. This is F3DEX2 if the configuration does
+// not choose a microcode.
+const Microcode &TargetMicrocode(const Config &cfg);
+
+} // namespace gbi
+} // namespace modelconvert
@@ -21,6 +21,7 @@ using util::BSwap32;
 namespace {
 
 constexpr size_t MaterialSlotCount = 4;
+constexpr size_t LODSlotCount = MaxLevelsOfDetail;
 
 size_t Align(size_t x) {
     return (x + 15) & ~static_cast<size_t>(15);
@@ -37,27 +38,35 @@ struct DataRef {
 };
 
 struct FHeader {
-    static constexpr size_t Size = 44;
+    static constexpr size_t Size = 116;
 
     // File format header. Parsed by asset packer.
     DataRef data[2];
 
     // Asset starts here.
     uint32_t vertex_offset;
-    uint32_t dl_offset[MaterialSlotCount];
+    uint32_t lod_count;
+    uint32_t lod_distance[LODSlotCount]; // Float.
+    uint32_t dl_offset[LODSlotCount][MaterialSlotCount];
     uint32_t animation_count;
     uint32_t frame_size;
+    uint32_t bone_count; // Frames contain bone matrixes if nonzero.
 
     void Swap() {
         for (DataRef &d : data) {
             d.Swap();
         }
         vertex_offset = BSwap32(vertex_offset);
-        for (size_t i = 0; i < MaterialSlotCount; i++) {
-            dl_offset[i] = BSwap32(dl_offset[i]);
+        lod_count = BSwap32(lod_count);
+        for (size_t i = 0; i < LODSlotCount; i++) {
+            lod_distance[i] = BSwap32(lod_distance[i]);
+            for (size_t j = 0; j < MaterialSlotCount; j++) {
+                dl_offset[i][j] = BSwap32(dl_offset[i][j]);
+            }
         }
         animation_count = BSwap32(animation_count);
         frame_size = BSwap32(frame_size);
+        bone_count = BSwap32(bone_count);
     }
 };
 
@@ -100,6 +109,19 @@ void WriteData(std::vector<uint8_t> *out, uint32_t pos, const T &data) {
     std::memcpy(out->data() + pos, &bedata, T::Size);
 }
 
+// Write a command as C source code. Calls to the display lists in the model's
+// called array refer to the array by name instead of through segment 3.
+void WriteCommandSource(std::vector<uint8_t> *out, const Gfx &g,
+                        std::string_view variable_name) {
+    if (g.opcode() == G_DL && (g.lo >> 24) == DataAddress(0) >> 24) {
+        fmt::format_to(std::back_inserter(*out),
+                       "gsSPDisplayList({}_called + {})", variable_name,
+                       (g.lo & 0xffffff) / Gfx::Size);
+        return;
+    }
+    g.WriteSource(out);
+}
+
 size_t FrameCount(const Model &model) {
     size_t n = 0;
     for (const Animation &anim : model.animation) {
@@ -110,12 +132,20 @@ size_t FrameCount(const Model &model) {
 
 } // namespace
 
-std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
+size_t Model::FrameSize() const {
+    if (bone_count != 0) {
+        return bone_count * Mtx::Size;
+    }
+    return vertex.size() * Vtx::Size;
+}
+
+std::vector<uint8_t> Model::EmitBinary(const Config &cfg,
+                                       SectionSizes *sizes) const {
     (void)&cfg;
 
-    // Size of position data for one frame.
+    // Size of position data or bone matrixes for one frame.
     const size_t vertexcount = vertex.size();
-    const size_t framedata_size = vertexcount * Vtx::Size;
+    const size_t framedata_size = FrameSize();
 
     // Calculate model layout.
     const size_t magiclen = 16;
@@ -129,14 +159,20 @@ std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
     const size_t framelen = FFrame::Size * FrameCount(*this);
 
     const size_t dlpos = Align(framepos + framelen);
-    size_t mat_count = std::min(command.size(), MaterialSlotCount);
-    size_t dlend = dlpos;
-    size_t cmd_offsets[MaterialSlotCount];
-    std::fill(std::begin(cmd_offsets), std::end(cmd_offsets), 0);
-    for (size_t i = 0; i < mat_count; i++) {
-        if (command[i].size() > 1) {
-            cmd_offsets[i] = dlend - base;
-            dlend += command[i].size() * Gfx::Size;
+    if (lod.size() > LODSlotCount) {
+        throw std::runtime_error("too many levels of detail");
+    }
+    const size_t calledpos = dlpos;
+    size_t dlend = calledpos + called.size() * Gfx::Size;
+    uint32_t cmd_offsets[LODSlotCount][MaterialSlotCount] = {};
+    for (size_t i = 0; i < lod.size(); i++) {
+        const std::vector<std::vector<Gfx>> &command = lod[i].command;
+        const size_t mat_count = std::min(command.size(), MaterialSlotCount);
+        for (size_t j = 0; j < mat_count; j++) {
+            if (command[j].size() > 1) {
+                cmd_offsets[i][j] = dlend - base;
+                dlend += command[j].size() * Gfx::Size;
+            }
         }
     }
     const size_t vertexpos = Align(dlend);
@@ -145,6 +181,14 @@ std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
     const size_t fdatalen = framedata_size * frame.size();
 
     const size_t endpos = Align(fdatapos + fdatalen);
+    if (sizes != nullptr) {
+        sizes->header = headerpos + headerlen;
+        sizes->animation = animlen + framelen;
+        sizes->display_list = dlend - dlpos;
+        sizes->vertex = vertexlen;
+        sizes->frame_data = fdatalen;
+        sizes->total = endpos;
+    }
 
     std::vector<uint8_t> data(endpos, 0);
 
@@ -162,10 +206,15 @@ std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
         h.data[1].offset = fdatapos;
         h.data[1].size = endpos - fdatapos;
         h.vertex_offset = vertexpos - base;
-        std::copy(std::begin(cmd_offsets), std::end(cmd_offsets),
-                  std::begin(h.dl_offset));
+        h.lod_count = lod.size();
+        for (size_t i = 0; i < lod.size(); i++) {
+            h.lod_distance[i] = util::PutFloat32(lod[i].distance);
+            std::copy(std::begin(cmd_offsets[i]), std::end(cmd_offsets[i]),
+                      std::begin(h.dl_offset[i]));
+        }
         h.animation_count = animation.size();
         h.frame_size = framedata_size;
+        h.bone_count = bone_count;
         WriteData(&data, headerpos, h);
     }
 
@@ -193,15 +242,27 @@ std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
         }
     }
 
-    // Emit the display lists.
+    // Emit the display lists. Calls to other display lists are relocated
+    // relative to the start of the main data.
     {
-        uint8_t *ptr = data.data() + dlpos;
-        for (size_t i = 0; i < mat_count; i++) {
-            const std::vector<Gfx> dlist = command[i];
-            if (dlist.size() > 1) {
-                for (const Gfx &g : dlist) {
-                    g.WriteBinary(ptr);
-                    ptr += Gfx::Size;
+        uint8_t *ptr = data.data() + calledpos;
+        for (Gfx g : called) {
+            g.RelocateDisplayList(calledpos - base);
+            g.WriteBinary(ptr);
+            ptr += Gfx::Size;
+        }
+        for (const LevelOfDetail &level : lod) {
+            const std::vector<std::vector<Gfx>> &command = level.command;
+            const size_t mat_count =
+                std::min(command.size(), MaterialSlotCount);
+            for (size_t i = 0; i < mat_count; i++) {
+                const std::vector<Gfx> &dlist = command[i];
+                if (dlist.size() > 1) {
+                    for (Gfx g : dlist) {
+                        g.RelocateDisplayList(calledpos - base);
+                        g.WriteBinary(ptr);
+                        ptr += Gfx::Size;
+                    }
                 }
             }
         }
@@ -220,6 +281,16 @@ std::vector<uint8_t> Model::EmitBinary(const Config &cfg) const {
     {
         uint8_t *ptr = data.data() + fdatapos;
         for (const FrameData &fdata : frame) {
+            if (bone_count != 0) {
+                if (fdata.bone.size() != bone_count) {
+                    throw std::runtime_error("bad frame data size");
+                }
+                for (const Mtx &m : fdata.bone) {
+                    m.WriteBinary(ptr);
+                    ptr += Mtx::Size;
+                }
+                continue;
+            }
             if (fdata.pos.size() != vertexcount) {
                 throw std::runtime_error("bad frame data size");
             }
@@ -247,22 +318,48 @@ std::vector<uint8_t> Model::EmitSource(const Config &cfg,
                    "/* This file is automatically generated. */\n"
                    "/* Generated by https://github.com/depp/skelly64 */\n");
 
-    // Emit display list for each material.
-    for (size_t i = 0; i < command.size(); i++) {
-        const std::vector<Gfx> &dl = command[i];
-        fmt::format_to(std::back_inserter(out), "\nconst Gfx {}_mat{}[] = {{",
-                       variable_name, i);
-        for (size_t j = 0; j < dl.size(); j++) {
-            if (j != 0) {
+    // Emit display lists called by the material display lists. Calls to these
+    // refer to this array by name.
+    if (!called.empty()) {
+        fmt::format_to(std::back_inserter(out), "\nconst Gfx {}_called[] = {{",
+                       variable_name);
+        for (size_t i = 0; i < called.size(); i++) {
+            if (i != 0) {
                 out.push_back(',');
             }
             fmt::format_to(std::back_inserter(out), "\n    ");
-            dl[j].WriteSource(&out);
+            WriteCommandSource(&out, called[i], variable_name);
         }
-        if (dl.size() != 0) {
-            out.push_back('\n');
+        fmt::format_to(std::back_inserter(out), "\n}};\n");
+    }
+
+    // Emit display list for each material. Simplified levels of detail are
+    // named with their level.
+    for (size_t i = 0; i < lod.size(); i++) {
+        const std::vector<std::vector<Gfx>> &command = lod[i].command;
+        for (size_t j = 0; j < command.size(); j++) {
+            const std::vector<Gfx> &dl = command[j];
+            if (i == 0) {
+                fmt::format_to(std::back_inserter(out),
+                               "\nconst Gfx {}_mat{}[] = {{", variable_name,
+                               j);
+            } else {
+                fmt::format_to(std::back_inserter(out),
+                               "\nconst Gfx {}_lod{}_mat{}[] = {{",
+                               variable_name, i, j);
+            }
+            for (size_t k = 0; k < dl.size(); k++) {
+                if (k != 0) {
+                    out.push_back(',');
+                }
+                fmt::format_to(std::back_inserter(out), "\n    ");
+                WriteCommandSource(&out, dl[k], variable_name);
+            }
+            if (dl.size() != 0) {
+                out.push_back('\n');
+            }
+            fmt::format_to(std::back_inserter(out), "}};\n");
         }
-        fmt::format_to(std::back_inserter(out), "}};\n");
     }
 
     // Emit vertexes.
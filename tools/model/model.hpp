@@ -21,9 +21,11 @@ struct FrameVertex {
     uint16_t pad;
 };
 
-// Vertex data for a frame of animation.
+// Data for a frame of animation. This is either vertex positions, or matrixes
+// for each bone if the model is rigidly skinned.
 struct FrameData {
     std::vector<FrameVertex> pos;
+    std::vector<Mtx> bone;
 };
 
 // A single frame of an animation.
@@ -38,15 +40,47 @@ struct Animation {
     std::vector<AnimationFrame> frame;
 };
 
+// Maximum number of levels of detail in a model file.
+constexpr int MaxLevelsOfDetail = 4;
+
+// A level of detail in a compiled model.
+struct LevelOfDetail {
+    // Distance at which this level replaces the previous, more detailed level.
+    // Zero for the first level.
+    float distance;
+    std::vector<std::vector<Gfx>> command; // Command list per material.
+};
+
+// Sizes of the sections of a model file, in bytes, not including padding.
+struct SectionSizes {
+    size_t header;       // Magic and header.
+    size_t animation;    // Animation and frame tables.
+    size_t display_list; // Display lists.
+    size_t vertex;       // Vertex data.
+    size_t frame_data;   // Vertex positions or bone matrixes for each frame.
+    size_t total;        // Entire file, including padding.
+};
+
 // A compiled model.
 struct Model {
-    std::vector<std::vector<Gfx>> command; // Command list per material.
+    std::vector<LevelOfDetail> lod; // Levels of detail, most detailed first.
+    // Display lists called from the material display lists, concatenated.
+    // Calls use DataAddress with offsets from the start of this list.
+    std::vector<Gfx> called;
     std::vector<Vtx> vertex;
     std::vector<Animation> animation;
     std::vector<FrameData> frame;
+    // Number of bones. If nonzero, frames contain bone matrixes instead of
+    // vertex positions.
+    unsigned bone_count = 0;
+
+    // Size of the data for one frame, in bytes.
+    size_t FrameSize() const;
 
-    // Emit model as a model file.
-    std::vector<uint8_t> EmitBinary(const Config &cfg) const;
+    // Emit model as a model file. The size of each section is stored in
+    // sizes, if it is not null.
+    std::vector<uint8_t> EmitBinary(const Config &cfg,
+                                    SectionSizes *sizes) const;
 
     // Emit model as a source file.
     std::vector<uint8_t> EmitSource(const Config &cfg,
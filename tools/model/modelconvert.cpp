@@ -1,6 +1,7 @@
 // Copyright 2022 Dietrich Epp.
 // This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
 // Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "lib/cpp/error.hpp"
 #include "lib/cpp/expr.hpp"
 #include "lib/cpp/expr_flag.hpp"
 #include "lib/cpp/file.hpp"
@@ -9,19 +10,33 @@
 #include "lib/cpp/quote.hpp"
 #include "tools/model/compile.hpp"
 #include "tools/model/config.hpp"
+#include "tools/model/keyframe.hpp"
 #include "tools/model/mesh.hpp"
+#include "tools/model/meshcache.hpp"
+#include "tools/model/microcode.hpp"
 #include "tools/model/model.hpp"
+#include "tools/model/parallel.hpp"
+#include "tools/model/reorder.hpp"
+#include "tools/model/simplify.hpp"
+#include "tools/model/simulate.hpp"
+#include "tools/model/statsjson.hpp"
 
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
-#include <err.h>
+#include <errno.h>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
-#include <fmt/core.h>
+#include <fmt/format.h>
 
 using util::Err;
 
@@ -49,18 +64,68 @@ public:
     }
 };
 
+class DistanceListFlag : public flag::FlagBase {
+    std::vector<float> *m_ptr;
+
+public:
+    explicit DistanceListFlag(std::vector<float> *ptr) : m_ptr{ptr} {}
+
+    flag::FlagArgument Argument() const override {
+        return flag::FlagArgument::Required;
+    }
+
+    void Parse(std::optional<std::string_view> arg) override {
+        assert(arg.has_value());
+        std::vector<float> result;
+        std::string_view rest = *arg;
+        while (true) {
+            const size_t comma = rest.find(',');
+            const std::string item{rest.substr(0, comma)};
+            char *end;
+            const float value = std::strtof(item.c_str(), &end);
+            if (item.empty() || *end != '\0' || !std::isfinite(value)) {
+                std::string msg =
+                    fmt::format("invalid distance: {}", util::Quote(item));
+                throw flag::UsageError(msg);
+            }
+            result.push_back(value);
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            rest = rest.substr(comma + 1);
+        }
+        *m_ptr = std::move(result);
+    }
+};
+
 struct Args {
     std::string model;
     std::string output;
     std::string output_c;
     std::string variable_name; // Name for variable for C source output.
     std::string output_stats;
+    std::string output_json;
+    std::string cache_dir; // Directory for cached imported meshes.
+    std::string microcode;  // Name of microcode to compile for.
+    std::string cost_model; // Name of cost model for estimating RSP time.
+    const gbi::CostModel *cost_model_ptr;
     util::Expr::Ref meter;
     util::Expr::Ref scale;
 
+    // Batch mode: job list file, and number of jobs to run at once.
+    std::string batch;
+    int batch_jobs;
+
     Config config;
 };
 
+// A model conversion job from a batch job list.
+struct Job {
+    int line; // Line number in the job list.
+    Args args;
+    std::string error; // Error message if the job failed.
+};
+
 void FixPath(std::string *path, std::string_view wd) {
     if (path->empty() || wd.empty() || (*path)[0] == '/') {
         return;
@@ -73,83 +138,211 @@ void FixPath(std::string *path, std::string_view wd) {
     *path = std::move(result);
 }
 
+// Return the directory which relative paths are relative to, or an empty
+// string for the current directory.
+std::string WorkspaceDirectory() {
+    const char *dir = std::getenv("BUILD_WORKSPACE_DIRECTORY");
+    return dir != nullptr ? std::string{dir} : std::string{};
+}
+
 void Help(FILE *fp, flag::Parser &fl) {
-    std::fputs("Usage: model -model=<model.fbx> -scale=<expr>\n\n", fp);
+    std::fputs("Usage: model -model=<model.fbx> -scale=<expr>\n"
+               "       model -batch=<jobs.txt> [<flags>]\n\n",
+               fp);
     fl.OptionHelp(fp);
 }
 
-Args ParseArgs(int argc, char **argv) {
-    std::string wd;
-    {
-        const char *dir = std::getenv("BUILD_WORKSPACE_DIRECTORY");
-        if (dir != nullptr) {
-            wd.assign(dir);
-        }
-    }
-    Args args{};
-    args.config.texcoord_bits = 11;
-    args.variable_name = "kModel";
-    flag::Parser fl;
-    fl.SetHelp(Help);
-    fl.AddFlag(flag::String(&args.model), "model", "input model file", "FILE");
-    fl.AddFlag(flag::String(&args.output), "output", "output data file",
+// Add the flags for converting a model.
+void AddFlags(flag::Parser &fl, Args *args) {
+    fl.AddFlag(flag::String(&args->model), "model", "input model file", "FILE");
+    fl.AddFlag(flag::String(&args->output), "output", "output data file",
                "FILE");
-    fl.AddFlag(flag::String(&args.output_c), "output-c",
+    fl.AddFlag(flag::String(&args->output_c), "output-c",
                "output C source code to FILE");
-    fl.AddFlag(flag::String(&args.variable_name), "variable-name",
+    fl.AddFlag(flag::String(&args->variable_name), "variable-name",
                "use NAME as variable name in C source output", "NAME");
-    fl.AddFlag(flag::String(&args.output_stats), "output-stats",
+    fl.AddFlag(flag::String(&args->cache_dir), "cache-dir",
+               "cache imported meshes in DIR", "DIR");
+    fl.AddFlag(flag::String(&args->output_stats), "output-stats",
                "write human-readable model information to FILE", "FILE");
-    fl.AddBoolFlag(&args.config.use_primitive_color, "use-primitive-color",
+    fl.AddFlag(flag::String(&args->output_json), "output-json",
+               "write model statistics as JSON to FILE", "FILE");
+    fl.AddBoolFlag(&args->config.use_primitive_color, "use-primitive-color",
                    "use primitive color from material");
-    fl.AddBoolFlag(&args.config.use_normals, "use-normals",
+    fl.AddBoolFlag(&args->config.use_normals, "use-normals",
                    "use vertex normals");
-    fl.AddBoolFlag(&args.config.use_vertex_colors, "use-vertex-colors",
+    fl.AddBoolFlag(&args->config.use_vertex_colors, "use-vertex-colors",
                    "use vertex colors");
-    fl.AddBoolFlag(&args.config.use_texcoords, "use-texcoords",
+    fl.AddBoolFlag(&args->config.use_texcoords, "use-texcoords",
                    "use texture coordinates");
-    fl.AddFlag(util::ExprFlag(&args.meter), "meter", "length of a meter",
+    fl.AddFlag(util::ExprFlag(&args->meter), "meter", "length of a meter",
                "EXPR");
-    fl.AddFlag(util::ExprFlag(&args.scale), "scale", "amount to scale model",
+    fl.AddFlag(util::ExprFlag(&args->scale), "scale", "amount to scale model",
                "EXPR");
-    fl.AddFlag(flag::Int(&args.config.texcoord_bits), "texcoord-bits",
+    fl.AddFlag(flag::Int(&args->config.texcoord_bits), "texcoord-bits",
                "fractional bits of precision for texture coordinates");
-    fl.AddFlag(AxesFlag(&args.config.axes), "axes",
+    fl.AddFlag(AxesFlag(&args->config.axes), "axes",
                "remap axes, default 'x,y,z'", "AXES");
-    fl.AddBoolFlag(&args.config.animate, "animate", "convert animations");
-    fl.ParseMain(argc, argv);
+    fl.AddBoolFlag(&args->config.animate, "animate", "convert animations");
+    fl.AddFlag(flag::Int(&args->config.frame_tolerance), "frame-tolerance",
+               "merge animation frames where vertexes differ by at most N",
+               "N");
+    fl.AddFlag(flag::Int(&args->config.keyframe_tolerance),
+               "keyframe-tolerance",
+               "remove animation frames which can be interpolated to within N",
+               "N");
+    fl.AddBoolFlag(&args->config.rigid, "rigid",
+                   "animate rigid segments with bone matrixes");
+    fl.AddFlag(DistanceListFlag(&args->config.lod_distance), "lod-distance",
+               "add simplified levels of detail, used at these distances",
+               "DIST,...");
+    fl.AddFlag(flag::Float32(&args->config.lod_ratio), "lod-ratio",
+               "keep this fraction of triangles in each level of detail, "
+               "default 0.5",
+               "RATIO");
+    fl.AddFlag(flag::Int(&args->config.cull_triangles), "cull",
+               "skip clusters of up to N triangles which are outside the view",
+               "N");
+    fl.AddBoolFlag(&args->config.reorder, "reorder",
+                   "reorder triangles for vertex locality before compiling");
+    fl.AddBoolFlag(&args->config.optimize, "optimize",
+                   "spend more time searching for a smaller display list");
+    fl.AddFlag(flag::Int(&args->config.thread_count), "threads",
+               "use N threads, default one per CPU", "N");
+    fl.AddFlag(flag::String(&args->microcode), "microcode",
+               "compile for microcode NAME, default f3dex2", "NAME");
+    fl.AddFlag(flag::String(&args->cost_model), "cost-model",
+               "estimate RSP time in stats using microcode NAME", "NAME");
+}
 
-    if (args.model.empty()) {
-        flag::FailUsage("missing required flag -model");
+// Check the flags for converting a model and resolve paths relative to wd.
+// Throws UsageError if they are invalid.
+void CheckArgs(Args *args, std::string_view wd) {
+    if (args->model.empty()) {
+        throw flag::UsageError("missing required flag -model");
+    }
+    FixPath(&args->model, wd);
+    FixPath(&args->output, wd);
+    FixPath(&args->output_stats, wd);
+    FixPath(&args->output_json, wd);
+    FixPath(&args->cache_dir, wd);
+    if (!args->scale) {
+        throw flag::UsageError("missing required flag -scale");
+    }
+    if (args->config.frame_tolerance < 0) {
+        throw flag::UsageError("-frame-tolerance must not be negative");
+    }
+    if (args->config.rigid && !args->config.animate) {
+        throw flag::UsageError("-rigid requires -animate");
+    }
+    if (args->config.lod_distance.size() >=
+        static_cast<size_t>(gbi::MaxLevelsOfDetail)) {
+        throw flag::UsageError(
+            fmt::format("-lod-distance accepts at most {} values",
+                        gbi::MaxLevelsOfDetail - 1));
+    }
+    for (size_t i = 0; i < args->config.lod_distance.size(); i++) {
+        const float prev = i == 0 ? 0.0f : args->config.lod_distance[i - 1];
+        if (!(args->config.lod_distance[i] > prev)) {
+            throw flag::UsageError(
+                "-lod-distance must be positive and increasing");
+        }
+    }
+    if (!(args->config.lod_ratio > 0.0f && args->config.lod_ratio < 1.0f)) {
+        throw flag::UsageError("-lod-ratio must be between 0 and 1");
+    }
+    if (args->config.cull_triangles < 0) {
+        throw flag::UsageError("-cull must not be negative");
+    }
+    if (args->config.thread_count < 0) {
+        throw flag::UsageError("-threads must not be negative");
+    }
+    const gbi::Microcode *microcode = gbi::Microcode::Find(args->microcode);
+    if (microcode == nullptr) {
+        throw flag::UsageError(
+            fmt::format("unknown -microcode {}, options are: {}",
+                        util::Quote(args->microcode),
+                        gbi::Microcode::Names()));
+    }
+    args->config.microcode = microcode;
+    if (args->cost_model.empty()) {
+        args->cost_model = microcode->cost_model;
     }
-    FixPath(&args.model, wd);
-    FixPath(&args.output, wd);
-    FixPath(&args.output_stats, wd);
-    if (!args.scale) {
-        flag::FailUsage("missing required flag -scale");
+    args->cost_model_ptr = gbi::CostModel::Find(args->cost_model);
+    if (args->cost_model_ptr == nullptr) {
+        throw flag::UsageError(
+            fmt::format("unknown -cost-model {}, options are: {}",
+                        util::Quote(args->cost_model),
+                        gbi::CostModel::Names()));
     }
+}
+
+// Return the arguments before any flags are parsed.
+Args DefaultArgs() {
+    Args args{};
+    args.config.texcoord_bits = 11;
+    args.config.keyframe_tolerance = -1;
+    args.config.lod_ratio = 0.5f;
+    args.variable_name = "kModel";
+    args.microcode = "f3dex2";
     return args;
 }
 
-void WriteFile(const std::string &out, const std::vector<uint8_t> &data) {
-    FILE *fp = std::fopen(out.c_str(), "wb");
-    if (fp == nullptr) {
-        err(1, "could not open %s", out.c_str());
-    }
-    size_t n = fwrite(data.data(), 1, data.size(), fp);
-    if (n != data.size()) {
-        err(1, "could not write %s", out.c_str());
+// Add the flags for batch mode.
+void AddBatchFlags(flag::Parser &fl, Args *args) {
+    fl.AddFlag(flag::String(&args->batch), "batch",
+               "convert each model in the job list FILE", "FILE");
+    fl.AddFlag(flag::Int(&args->batch_jobs), "batch-jobs",
+               "run N batch jobs at once, default one per CPU", "N");
+}
+
+Args ParseArgs(int argc, char **argv) {
+    const std::string wd = WorkspaceDirectory();
+    Args args = DefaultArgs();
+    flag::Parser fl;
+    fl.SetHelp(Help);
+    AddFlags(fl, &args);
+    AddBatchFlags(fl, &args);
+    fl.ParseMain(argc, argv);
+
+    if (!args.batch.empty()) {
+        FixPath(&args.batch, wd);
+        if (args.batch_jobs < 0) {
+            flag::FailUsage("-batch-jobs must not be negative");
+        }
+        return args;
     }
-    int r = fclose(fp);
-    if (r != 0) {
-        err(1, "could not write %s", out.c_str());
+    try {
+        CheckArgs(&args, wd);
+    } catch (flag::UsageError &ex) {
+        flag::FailUsage(ex.what());
     }
+    return args;
 }
 
-void Main(int argc, char **argv) {
-    Args args = ParseArgs(argc, argv);
+void WriteFile(const std::string &out, const std::vector<uint8_t> &data) {
+    util::OutputFile file;
+    file.Create(out);
+    file.Write(data.data(), data.size());
+    file.Commit();
+}
+
+// Convert one model. Throws an exception if conversion fails. If batch is
+// true, other models may be converting in the same process.
+void Convert(const Args &args, Assimp::Importer &importer, bool batch) {
+    using Clock = std::chrono::steady_clock;
     Config cfg = args.config;
-    Assimp::Importer importer;
+    const bool want_json = !args.output_json.empty();
+    ConvertStats json_stats{};
+    json_stats.batch = batch;
+    Clock::time_point phase_start = Clock::now();
+    // Record the time since the end of the previous phase.
+    const auto end_phase = [&](const char *name) {
+        const Clock::time_point now = Clock::now();
+        const std::chrono::duration<double> elapsed = now - phase_start;
+        json_stats.phase.push_back(PhaseTime{name, elapsed.count()});
+        phase_start = now;
+    };
 
     {
         util::Expr::Env env;
@@ -159,8 +352,8 @@ void Main(int argc, char **argv) {
         }
         double scale = args.scale->Eval(env);
         if (!std::isfinite(scale) || scale <= 0) {
-            Err("scale is not a positive number; scale = {}", scale);
-            std::exit(2);
+            throw std::runtime_error(fmt::format(
+                "scale is not a positive number; scale = {}", scale));
         }
         cfg.scale = scale;
     }
@@ -169,7 +362,7 @@ void Main(int argc, char **argv) {
     if (!args.output_stats.empty()) {
         stats = util::File{std::fopen(args.output_stats.c_str(), "w")};
         if (!stats) {
-            err(1, "could not open '%s'", args.output_stats.c_str());
+            throw util::IOError(args.output_stats, "create", errno);
         }
         fmt::print(stats, "Config:\n");
         fmt::print(stats, "    Primitive color: {}\n", cfg.use_primitive_color);
@@ -180,42 +373,239 @@ void Main(int argc, char **argv) {
         fmt::print(stats, "    Scale: {}\n", cfg.scale);
         fmt::print(stats, "    Axes: {}\n", cfg.axes.ToString());
         fmt::print(stats, "    Animate: {}\n", cfg.animate);
+        fmt::print(stats, "    Frame tolerance: {}\n", cfg.frame_tolerance);
+        fmt::print(stats, "    Keyframe tolerance: {}\n",
+                   cfg.keyframe_tolerance);
+        fmt::print(stats, "    Rigid: {}\n", cfg.rigid);
+        fmt::print(stats, "    LOD distance: {}\n",
+                   fmt::join(cfg.lod_distance, ", "));
+        fmt::print(stats, "    LOD ratio: {}\n", cfg.lod_ratio);
+        fmt::print(stats, "    Cull triangles: {}\n", cfg.cull_triangles);
+        fmt::print(stats, "    Reorder: {}\n", cfg.reorder);
+        fmt::print(stats, "    Optimize: {}\n", cfg.optimize);
+        fmt::print(stats, "    Microcode: {}\n",
+                   gbi::TargetMicrocode(cfg).name);
         fmt::print(stats, "\n");
     }
 
-    // Import mesh.
-    const aiScene *scene = importer.ReadFile(
-        args.model, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
-    if (scene == nullptr) {
-        Err("could not import {}: {}", util::Quote(args.model),
-            importer.GetErrorString());
-        std::exit(1);
+    // Import mesh, or load it from the cache.
+    Mesh mesh;
+    std::string cache_path;
+    uint64_t cache_key = 0;
+    bool cached = false;
+    if (!args.cache_dir.empty()) {
+        cache_key = MeshCacheKey(cfg, args.model);
+        cache_path = MeshCachePath(args.cache_dir, cache_key);
+        cached = LoadMeshCache(cache_path, cache_key, &mesh);
+        if (stats) {
+            fmt::print(stats, "Mesh cache: {}\n", cached ? "hit" : "miss");
+        }
+    }
+    if (!cached) {
+        const aiScene *scene = importer.ReadFile(
+            args.model,
+            aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+        if (scene == nullptr) {
+            throw std::runtime_error(
+                fmt::format("could not import {}: {}", util::Quote(args.model),
+                            importer.GetErrorString()));
+        }
+        mesh = Mesh::Import(cfg, stats, scene);
+        if (!cache_path.empty()) {
+            SaveMeshCache(cache_path, cache_key, mesh);
+        }
+    }
+    json_stats.cache_hit = cached;
+    end_phase("import");
+    if (cfg.keyframe_tolerance >= 0) {
+        ReduceKeyframes(&mesh, cfg.keyframe_tolerance, stats);
+        end_phase("keyframes");
+    }
+    if (!cfg.lod_distance.empty()) {
+        GenerateLODs(&mesh, cfg.lod_distance.size() + 1, cfg.lod_ratio, stats);
+        end_phase("lod");
+    }
+    if (cfg.reorder) {
+        ReorderTriangles(
+            &mesh, gbi::TargetMicrocode(cfg).vertex_cache_size, stats);
+        end_phase("reorder");
     }
 
-    Mesh mesh = Mesh::Import(cfg, stats, scene);
-
-    gbi::Model model = gbi::CompileMesh(mesh, cfg, stats);
+    gbi::Model model = gbi::CompileMesh(mesh, cfg, stats,
+                                        want_json ? &json_stats.compile
+                                                  : nullptr);
+    end_phase("compile");
     if (stats) {
-        fmt::print(stats, "Display list commands: {}\n", model.command.size());
+        size_t ncmd = 0;
+        for (const gbi::LevelOfDetail &level : model.lod) {
+            for (const std::vector<gbi::Gfx> &dl : level.command) {
+                ncmd += dl.size();
+            }
+        }
+        ncmd += model.called.size();
+        fmt::print(stats, "Display list commands: {}\n", ncmd);
         fmt::print(stats, "Vertexes: {}\n", model.vertex.size());
         fmt::print(stats, "Animations: {}\n", model.animation.size());
         fmt::print(stats, "Frames: {}\n", model.frame.size());
+        if (model.bone_count != 0) {
+            fmt::print(stats, "Bones: {}\n", model.bone_count);
+        }
+        fmt::print(stats, "Frame data size: {}\n",
+                   model.frame.size() * model.FrameSize());
+        gbi::WriteCostStats(model, *args.cost_model_ptr, stats);
     }
-    if (!args.output.empty()) {
-        std::vector<uint8_t> data = model.EmitBinary(cfg);
-        WriteFile(args.output, data);
+    if (!args.output.empty() || want_json) {
+        std::vector<uint8_t> data =
+            model.EmitBinary(cfg, want_json ? &json_stats.sections : nullptr);
+        if (!args.output.empty()) {
+            WriteFile(args.output, data);
+        }
     }
     if (!args.output_c.empty()) {
         std::vector<uint8_t> data = model.EmitSource(cfg, args.variable_name);
         if (args.output_c == "-") {
             size_t n = fwrite(data.data(), 1, data.size(), stdout);
             if (n != data.size()) {
-                err(1, "could not write");
+                throw util::IOError("<stdout>", "write", errno);
             }
         } else {
             WriteFile(args.output_c, data);
         }
     }
+    if (want_json) {
+        end_phase("emit");
+        const std::string text = StatsJSON(cfg, mesh, model, json_stats,
+                                           *args.cost_model_ptr);
+        WriteFile(args.output_json,
+                  std::vector<uint8_t>(text.begin(), text.end()));
+    }
+}
+
+// Per-worker state for batch mode. Each worker has its own importer, since
+// an importer may only be used by one thread at a time.
+struct BatchWorker {
+    std::unique_ptr<Assimp::Importer> importer;
+
+    BatchWorker() : importer{std::make_unique<Assimp::Importer>()} {}
+    BatchWorker(const BatchWorker &) : BatchWorker{} {}
+};
+
+// Read the job list for batch mode. Each line contains the flags for one
+// job, separated by spaces. Flags from the command line, given by argc and
+// argv, are the defaults for every job. Blank lines and lines starting with
+// '#' are ignored. Jobs with invalid flags are returned with an error, so
+// they fail without stopping the other jobs.
+std::vector<Job> ReadJobs(const Args &args, int argc, char **argv) {
+    const std::string wd = WorkspaceDirectory();
+    util::File fp{std::fopen(args.batch.c_str(), "r")};
+    if (!fp) {
+        throw util::IOError(args.batch, "open", errno);
+    }
+    std::vector<Job> jobs;
+    std::string line;
+    int lineno = 0;
+    int ch;
+    do {
+        ch = std::fgetc(fp);
+        if (ch != '\n' && ch != EOF) {
+            line.push_back(ch);
+            continue;
+        }
+        lineno++;
+        std::vector<std::string> words;
+        size_t pos = 0;
+        while (true) {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos == std::string::npos) {
+                break;
+            }
+            const size_t end = line.find_first_of(" \t\r", pos);
+            words.emplace_back(line.substr(pos, end - pos));
+            pos = end;
+        }
+        line.clear();
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+        Job &job = jobs.emplace_back(Job{lineno, DefaultArgs(), {}});
+        std::vector<char *> job_argv;
+        for (std::string &word : words) {
+            job_argv.push_back(word.data());
+        }
+        job_argv.push_back(nullptr);
+        try {
+            flag::Parser fl;
+            AddFlags(fl, &job.args);
+            AddBatchFlags(fl, &job.args);
+            fl.ParseList(argc - 1, argv + 1);
+            // Each job compiles on one thread, unless it says otherwise,
+            // since the jobs themselves run in parallel.
+            if (job.args.config.thread_count == 0) {
+                job.args.config.thread_count = 1;
+            }
+            fl.ParseList(words.size(), job_argv.data());
+            CheckArgs(&job.args, wd);
+        } catch (flag::UsageError &ex) {
+            job.error = ex.what();
+        }
+    } while (ch != EOF);
+    if (std::ferror(fp)) {
+        throw util::IOError(args.batch, "read", errno);
+    }
+    return jobs;
+}
+
+// Convert every model in a job list, and return the number of jobs which
+// failed.
+int RunBatch(const Args &args, int argc, char **argv) {
+    std::vector<Job> jobs = ReadJobs(args, argc, argv);
+    Config pool{};
+    pool.thread_count = args.batch_jobs;
+    ParallelFor(pool, jobs.size(), BatchWorker{},
+                [&jobs](BatchWorker *worker, int i) {
+                    Job &job = jobs[i];
+                    if (!job.error.empty()) {
+                        return;
+                    }
+                    try {
+                        Convert(job.args, *worker->importer, true);
+                    } catch (std::exception &ex) {
+                        job.error = ex.what();
+                    }
+                });
+    int failed = 0;
+    for (const Job &job : jobs) {
+        if (!job.error.empty()) {
+            Err("{}:{}: {}", args.batch, job.line, job.error);
+            failed++;
+        }
+    }
+    if (failed != 0) {
+        Err("{} of {} jobs failed", failed, jobs.size());
+    }
+    return failed;
+}
+
+void Main(int argc, char **argv) {
+    Args args = ParseArgs(argc, argv);
+    if (!args.batch.empty()) {
+        try {
+            if (RunBatch(args, argc, argv) != 0) {
+                std::exit(1);
+            }
+        } catch (std::exception &ex) {
+            Err("{}", ex.what());
+            std::exit(1);
+        }
+        return;
+    }
+    Assimp::Importer importer;
+    try {
+        Convert(args, importer, false);
+    } catch (std::exception &ex) {
+        Err("{}", ex.what());
+        std::exit(1);
+    }
 }
 
 } // namespace
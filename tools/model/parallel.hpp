@@ -0,0 +1,75 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include "tools/model/config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace modelconvert {
+
+// Get the number of threads to use.
+inline int ThreadCount(const Config &cfg) {
+    if (cfg.thread_count > 0) {
+        return cfg.thread_count;
+    }
+    const unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Call func(i) for each i from 0 to count-1, using up to the configured number
+// of threads. Each thread gets its own copy of the initial state, which is
+// passed as func(&state, i). If any call throws an exception, the exception
+// for the lowest index is rethrown after all threads finish.
+template <typename State, typename F>
+void ParallelFor(const Config &cfg, int count, const State &initial, F func) {
+    std::vector<std::exception_ptr> error(count);
+    std::atomic<int> next{0};
+    auto worker = [&]() {
+        State state{initial};
+        while (true) {
+            const int i = next++;
+            if (i >= count) {
+                break;
+            }
+            try {
+                func(&state, i);
+            } catch (...) {
+                error[i] = std::current_exception();
+            }
+        }
+    };
+    const int thread_count = std::min(ThreadCount(cfg), count);
+    if (thread_count <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count);
+        for (int i = 0; i < thread_count; i++) {
+            threads.emplace_back(worker);
+        }
+        for (std::thread &t : threads) {
+            t.join();
+        }
+    }
+    for (const std::exception_ptr &e : error) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+// Call func(i) for each i from 0 to count-1, using up to the configured number
+// of threads.
+template <typename F>
+void ParallelFor(const Config &cfg, int count, F func) {
+    struct NoState {};
+    ParallelFor(cfg, count, NoState{}, [&](NoState *, int i) { func(i); });
+}
+
+} // namespace modelconvert
@@ -0,0 +1,400 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/peephole.hpp"
+
+#include "tools/model/microcode.hpp"
+
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+
+namespace modelconvert {
+namespace gbi {
+
+namespace {
+
+// Unused vertexes in the middle of a load are only removed if there are at
+// least this many in a row, since splitting the load adds a command.
+constexpr int MinSplitGap = 4;
+
+// Get the index into the vertex data for a vertex address.
+int VertexIndex(uint32_t address) {
+    return (address & 0xffffff) / Vtx::Size;
+}
+
+// A vertex as seen by a triangle: the vertex which was loaded, and any
+// modifications made to it afterwards.
+struct DrawVertex {
+    int id; // Mesh vertex ID.
+    std::array<int16_t, 3> pos;
+    std::array<int16_t, 2> texcoord;
+    std::array<uint8_t, 4> color;
+    std::optional<uint32_t> st;
+    std::optional<uint32_t> rgba;
+
+    bool operator==(const DrawVertex &v) const {
+        return std::tie(id, pos, texcoord, color, st, rgba) ==
+               std::tie(v.id, v.pos, v.texcoord, v.color, v.st, v.rgba);
+    }
+};
+
+using DrawTriangle = std::array<DrawVertex, 3>;
+
+// Return the triangles drawn by a display list.
+std::vector<DrawTriangle> Draw(const std::vector<Gfx> &command,
+                               const std::vector<Vtx> &vertex,
+                               const std::vector<int> &vertex_id,
+                               int cache_size) {
+    std::vector<std::optional<DrawVertex>> cache(cache_size);
+    std::vector<DrawTriangle> result;
+    for (const Gfx &g : command) {
+        VertexLoad load;
+        VertexModify modify;
+        std::array<std::array<int, 3>, 2> tri;
+        if (g.DecodeVertex(&load)) {
+            const int index = VertexIndex(load.address);
+            if (load.start + load.count > cache.size() || index < 0 ||
+                index + load.count > vertex.size()) {
+                throw std::runtime_error("Draw: bad vertex load");
+            }
+            for (unsigned i = 0; i < load.count; i++) {
+                const Vtx &v = vertex[index + i];
+                cache[load.start + i] = DrawVertex{
+                    vertex_id[index + i], v.pos, v.texcoord, v.color, {}, {}};
+            }
+        } else if (g.DecodeModifyVertex(&modify)) {
+            std::optional<DrawVertex> &v = cache.at(modify.vertex);
+            if (!v) {
+                throw std::runtime_error("Draw: modified empty slot");
+            }
+            switch (modify.field) {
+            case VertexField::ST:
+                v->st = modify.value;
+                break;
+            case VertexField::RGBA:
+                v->rgba = modify.value;
+                break;
+            default:
+                throw std::runtime_error("Draw: unknown vertex field");
+            }
+        } else if (const int n = g.DecodeTriangles(&tri); n > 0) {
+            for (int i = 0; i < n; i++) {
+                DrawTriangle t;
+                for (int j = 0; j < 3; j++) {
+                    const std::optional<DrawVertex> &v = cache.at(tri[i][j]);
+                    if (!v) {
+                        throw std::runtime_error("Draw: vertex not loaded");
+                    }
+                    t[j] = *v;
+                }
+                result.push_back(t);
+            }
+        } else {
+            throw std::runtime_error("Draw: unexpected command");
+        }
+    }
+    return result;
+}
+
+// A single operation on the vertex cache. Loads are split into one operation
+// per vertex, and SP2Triangle is split into two triangles.
+struct Op {
+    enum class Kind { Load, Modify, Triangle };
+
+    Kind kind;
+    int slot;
+    int vertex; // Load: index into vertex data.
+    int load;   // Load: index of the load command.
+    VertexModify modify;
+    std::array<int, 3> tri;
+    bool keep;
+};
+
+// Split a display list into operations.
+std::vector<Op> SplitOps(const std::vector<Gfx> &command) {
+    std::vector<Op> ops;
+    int load_index = 0;
+    for (const Gfx &g : command) {
+        VertexLoad load;
+        VertexModify modify;
+        std::array<std::array<int, 3>, 2> tri;
+        if (g.DecodeVertex(&load)) {
+            const int index = VertexIndex(load.address);
+            for (int i = 0; i < static_cast<int>(load.count); i++) {
+                ops.push_back(Op{Op::Kind::Load,
+                                 static_cast<int>(load.start) + i, index + i,
+                                 load_index, {}, {}, true});
+            }
+            load_index++;
+        } else if (g.DecodeModifyVertex(&modify)) {
+            ops.push_back(
+                Op{Op::Kind::Modify, modify.vertex, -1, -1, modify, {}, true});
+        } else if (const int n = g.DecodeTriangles(&tri); n > 0) {
+            for (int i = 0; i < n; i++) {
+                ops.push_back(
+                    Op{Op::Kind::Triangle, -1, -1, -1, {}, tri[i], true});
+            }
+        } else {
+            throw std::runtime_error(
+                "OptimizeDisplayList: unexpected command");
+        }
+    }
+    return ops;
+}
+
+// Remove loads and modifications which leave the cache unchanged.
+void RemoveRedundant(std::vector<Op> *ops, const std::vector<Vtx> &vertex,
+                     const std::vector<int> &vertex_id, int cache_size) {
+    struct Slot {
+        int vertex = -1;
+        bool modified = false;
+        std::optional<uint32_t> st;
+        std::optional<uint32_t> rgba;
+    };
+    std::vector<Slot> cache(cache_size);
+    for (Op &op : *ops) {
+        switch (op.kind) {
+        case Op::Kind::Load: {
+            Slot &s = cache.at(op.slot);
+            if (s.vertex >= 0 && !s.modified && vertex_id[s.vertex] >= 0 &&
+                vertex_id[s.vertex] == vertex_id[op.vertex]) {
+                const Vtx &x = vertex[s.vertex], &y = vertex[op.vertex];
+                if (x.pos == y.pos && x.texcoord == y.texcoord &&
+                    x.color == y.color) {
+                    op.keep = false;
+                    break;
+                }
+            }
+            s = Slot{};
+            s.vertex = op.vertex;
+        } break;
+        case Op::Kind::Modify: {
+            Slot &s = cache.at(op.slot);
+            std::optional<uint32_t> *field;
+            switch (op.modify.field) {
+            case VertexField::ST:
+                field = &s.st;
+                break;
+            case VertexField::RGBA:
+                field = &s.rgba;
+                break;
+            default:
+                throw std::runtime_error(
+                    "OptimizeDisplayList: unknown vertex field");
+            }
+            if (*field == op.modify.value) {
+                op.keep = false;
+                break;
+            }
+            *field = op.modify.value;
+            s.modified = true;
+        } break;
+        case Op::Kind::Triangle:
+            break;
+        }
+    }
+}
+
+// Remove loads and modifications which are not used by any triangle.
+void RemoveDead(std::vector<Op> *ops, int cache_size) {
+    // Whether the vertex in each slot, or each field of it, is read later.
+    std::vector<bool> live_vertex(cache_size, false);
+    std::vector<bool> live_st(cache_size, false);
+    std::vector<bool> live_rgba(cache_size, false);
+    for (auto it = ops->rbegin(); it != ops->rend(); ++it) {
+        Op &op = *it;
+        if (!op.keep) {
+            continue;
+        }
+        switch (op.kind) {
+        case Op::Kind::Load:
+            if (!live_vertex.at(op.slot) && !live_st.at(op.slot) &&
+                !live_rgba.at(op.slot)) {
+                op.keep = false;
+            }
+            live_vertex[op.slot] = false;
+            live_st[op.slot] = false;
+            live_rgba[op.slot] = false;
+            break;
+        case Op::Kind::Modify: {
+            std::vector<bool> &live =
+                op.modify.field == VertexField::ST ? live_st : live_rgba;
+            if (!live.at(op.slot)) {
+                op.keep = false;
+            }
+            live[op.slot] = false;
+        } break;
+        case Op::Kind::Triangle:
+            for (const int slot : op.tri) {
+                live_vertex.at(slot) = true;
+                live_st.at(slot) = true;
+                live_rgba.at(slot) = true;
+            }
+            break;
+        }
+    }
+}
+
+// Builds the optimized display list from operations.
+class Builder {
+public:
+    // Add the operations from one load command, starting at ops[pos]. Returns
+    // the position after the last operation.
+    size_t AddLoad(const std::vector<Op> &ops, size_t pos) {
+        const int load = ops[pos].load;
+        size_t end = pos;
+        while (end < ops.size() && ops[end].kind == Op::Kind::Load &&
+               ops[end].load == load) {
+            end++;
+        }
+        // Find runs of vertexes to keep, keeping short gaps.
+        size_t i = pos;
+        while (i < end) {
+            if (!ops[i].keep) {
+                i++;
+                continue;
+            }
+            size_t run_end = i + 1;
+            while (true) {
+                size_t next = run_end;
+                while (next < end && !ops[next].keep) {
+                    next++;
+                }
+                if (next == end || next - run_end >= MinSplitGap) {
+                    break;
+                }
+                run_end = next + 1;
+            }
+            EmitLoad(ops[i].slot, ops[i].vertex, run_end - i);
+            i = run_end;
+        }
+        return end;
+    }
+
+    void AddModify(const VertexModify &modify) {
+        FlushSlot(modify.vertex);
+        m_command.push_back(
+            Gfx::SPModifyVertex(modify.vertex, modify.field, modify.value));
+    }
+
+    void AddTriangle(const std::array<int, 3> &tri) {
+        if (m_pending) {
+            m_command.push_back(Gfx::SP2Triangle(*m_pending, tri));
+            m_pending.reset();
+        } else {
+            m_pending = tri;
+        }
+    }
+
+    // Finish the display list, and return the commands, with vertex addresses
+    // pointing at the original vertex data.
+    std::vector<Gfx> Finish() {
+        Flush();
+        return std::move(m_command);
+    }
+
+private:
+    void EmitLoad(int slot, int vertex, int count) {
+        for (int i = 0; i < count; i++) {
+            FlushSlot(slot + i);
+        }
+        // Merge with the previous load, if it is adjacent.
+        VertexLoad prev;
+        if (!m_command.empty() && m_command.back().DecodeVertex(&prev) &&
+            static_cast<int>(prev.start + prev.count) == slot &&
+            VertexIndex(prev.address) + static_cast<int>(prev.count) ==
+                vertex) {
+            m_command.back() = Gfx::SPVertex(prev.address, prev.count + count,
+                                             prev.start);
+            return;
+        }
+        m_command.push_back(
+            Gfx::SPVertex(RSPAddress(vertex * Vtx::Size), count, slot));
+    }
+
+    // Emit the pending triangle, if it uses the given slot. Otherwise, the
+    // pending triangle can be drawn after the slot is changed.
+    void FlushSlot(int slot) {
+        if (m_pending) {
+            for (const int v : *m_pending) {
+                if (v == slot) {
+                    Flush();
+                    return;
+                }
+            }
+        }
+    }
+
+    void Flush() {
+        if (m_pending) {
+            m_command.push_back(Gfx::SP1Triangle(*m_pending));
+            m_pending.reset();
+        }
+    }
+
+    std::vector<Gfx> m_command;
+    std::optional<std::array<int, 3>> m_pending;
+};
+
+} // namespace
+
+void OptimizeDisplayList(std::vector<Gfx> *command, std::vector<Vtx> *vertex,
+                         std::vector<int> *vertex_id,
+                         const Microcode &microcode) {
+    const int cache_size = microcode.vertex_cache_size;
+    std::vector<Op> ops = SplitOps(*command);
+    RemoveRedundant(&ops, *vertex, *vertex_id, cache_size);
+    RemoveDead(&ops, cache_size);
+
+    Builder builder;
+    for (size_t pos = 0; pos < ops.size();) {
+        const Op &op = ops[pos];
+        switch (op.kind) {
+        case Op::Kind::Load:
+            pos = builder.AddLoad(ops, pos);
+            continue;
+        case Op::Kind::Modify:
+            if (op.keep) {
+                builder.AddModify(op.modify);
+            }
+            break;
+        case Op::Kind::Triangle:
+            builder.AddTriangle(op.tri);
+            break;
+        }
+        pos++;
+    }
+    std::vector<Gfx> new_command = builder.Finish();
+
+    // Copy the vertex data which is still loaded.
+    std::vector<Vtx> new_vertex;
+    std::vector<int> new_vertex_id;
+    for (Gfx &g : new_command) {
+        VertexLoad load;
+        if (g.DecodeVertex(&load)) {
+            const int index = VertexIndex(load.address);
+            g = Gfx::SPVertex(RSPAddress(new_vertex.size() * Vtx::Size),
+                              load.count, load.start);
+            new_vertex.insert(new_vertex.end(), vertex->begin() + index,
+                              vertex->begin() + index + load.count);
+            new_vertex_id.insert(new_vertex_id.end(),
+                                 vertex_id->begin() + index,
+                                 vertex_id->begin() + index + load.count);
+        }
+    }
+
+    if (Draw(*command, *vertex, *vertex_id, cache_size) !=
+        Draw(new_command, new_vertex, new_vertex_id, cache_size)) {
+        throw std::runtime_error(
+            "OptimizeDisplayList: optimized display list draws different "
+            "triangles");
+    }
+    *command = std::move(new_command);
+    *vertex = std::move(new_vertex);
+    *vertex_id = std::move(new_vertex_id);
+}
+
+} // namespace gbi
+} // namespace modelconvert
@@ -0,0 +1,34 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include "tools/model/gbi.hpp"
+
+#include <vector>
+
+namespace modelconvert {
+namespace gbi {
+
+struct Microcode;
+
+// Optimize a compiled display list by simulating the vertex cache. This removes
+// vertex loads which would not change the cache, loaded vertexes and vertex
+// modifications which no triangle uses, merges adjacent vertex loads, and
+// pairs triangles into SP2Triangle, if the microcode supports it. Vertex data
+// which is no longer loaded is removed.
+//
+// The display list may only contain SPVertex, SPModifyVertex, SP1Triangle,
+// and SP2Triangle commands. Vertex addresses are RSPAddress offsets into the
+// vertex data, and vertex_id identifies the mesh vertex for each entry in the
+// vertex data. Vertexes are only considered the same if they come from the
+// same mesh vertex, so the result is correct for every animation frame.
+//
+// The triangles drawn by the result are checked against the input, and an
+// exception is thrown if they differ.
+void OptimizeDisplayList(std::vector<Gfx> *command, std::vector<Vtx> *vertex,
+                         std::vector<int> *vertex_id,
+                         const Microcode &microcode);
+
+} // namespace gbi
+} // namespace modelconvert
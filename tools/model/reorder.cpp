@@ -0,0 +1,206 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/reorder.hpp"
+
+#include "lib/cpp/hash.hpp"
+#include "lib/cpp/pack.hpp"
+#include "tools/model/mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+
+namespace modelconvert {
+
+namespace {
+
+struct HashPos {
+    uint32_t operator()(const std::array<int16_t, 3> &p) const {
+        util::Murmur3 h = util::Murmur3::Initial(0);
+        h.Update(util::Pack16x2(p[0], p[1]));
+        h.Update(p[2]);
+        return h.Hash();
+    }
+};
+
+class Tipsify {
+public:
+    Tipsify(std::vector<std::array<int, 3>> triangle, int vertex_count,
+            int cache_size)
+        : m_triangle{std::move(triangle)},
+          m_cache_size{cache_size},
+          m_live(vertex_count, 0),
+          m_cache_time(vertex_count, 0),
+          m_vertex_start(vertex_count + 1, 0),
+          m_emitted(m_triangle.size(), false) {
+        // Build the vertex -> triangle adjacency.
+        for (const std::array<int, 3> &tri : m_triangle) {
+            for (const int v : tri) {
+                m_live[v]++;
+            }
+        }
+        for (int v = 0; v < vertex_count; v++) {
+            m_vertex_start[v + 1] = m_vertex_start[v] + m_live[v];
+        }
+        m_vertex_triangle.resize(m_vertex_start[vertex_count]);
+        std::vector<int> pos(m_vertex_start.begin(), m_vertex_start.end() - 1);
+        for (int t = 0; t < static_cast<int>(m_triangle.size()); t++) {
+            for (const int v : m_triangle[t]) {
+                m_vertex_triangle[pos[v]++] = t;
+            }
+        }
+    }
+
+    // Return the new order of the triangles, as indexes into the input.
+    std::vector<int> Run() {
+        std::vector<int> order;
+        order.reserve(m_triangle.size());
+        const int vertex_count = m_live.size();
+        int time = m_cache_size + 1;
+        int cursor = 0;
+        int vertex = vertex_count > 0 ? 0 : -1;
+        std::vector<int> candidates;
+        while (vertex >= 0) {
+            // Emit all remaining triangles which use this vertex.
+            candidates.clear();
+            for (int i = m_vertex_start[vertex],
+                     e = m_vertex_start[vertex + 1];
+                 i < e; i++) {
+                const int t = m_vertex_triangle[i];
+                if (m_emitted[t]) {
+                    continue;
+                }
+                m_emitted[t] = true;
+                order.push_back(t);
+                for (const int v : m_triangle[t]) {
+                    candidates.push_back(v);
+                    m_dead_end.push_back(v);
+                    m_live[v]--;
+                    if (time - m_cache_time[v] > m_cache_size) {
+                        m_cache_time[v] = time;
+                        time++;
+                    }
+                }
+            }
+            vertex = NextVertex(candidates, time, &cursor);
+        }
+        return order;
+    }
+
+private:
+    // Choose the next vertex to fan around. Prefer vertexes which are still
+    // in the cache and will stay there, otherwise go back to a recently used
+    // vertex, otherwise the next vertex in input order.
+    int NextVertex(const std::vector<int> &candidates, int time, int *cursor) {
+        int best = -1, best_priority = -1;
+        for (const int v : candidates) {
+            if (m_live[v] <= 0) {
+                continue;
+            }
+            int priority = 0;
+            if (time - m_cache_time[v] + 2 * m_live[v] <= m_cache_size) {
+                priority = time - m_cache_time[v];
+            }
+            if (priority > best_priority) {
+                best = v;
+                best_priority = priority;
+            }
+        }
+        if (best >= 0) {
+            return best;
+        }
+        while (!m_dead_end.empty()) {
+            const int v = m_dead_end.back();
+            m_dead_end.pop_back();
+            if (m_live[v] > 0) {
+                return v;
+            }
+        }
+        const int vertex_count = m_live.size();
+        while (*cursor < vertex_count) {
+            const int v = (*cursor)++;
+            if (m_live[v] > 0) {
+                return v;
+            }
+        }
+        return -1;
+    }
+
+    std::vector<std::array<int, 3>> m_triangle;
+    int m_cache_size;
+
+    // Number of triangles not yet emitted, for each vertex.
+    std::vector<int> m_live;
+
+    // Time each vertex last entered the cache.
+    std::vector<int> m_cache_time;
+
+    // Triangles using each vertex. The triangles for vertex v are
+    // m_vertex_triangle[m_vertex_start[v]] up to m_vertex_start[v + 1].
+    std::vector<int> m_vertex_start;
+    std::vector<int> m_vertex_triangle;
+
+    std::vector<bool> m_emitted;
+    std::vector<int> m_dead_end;
+};
+
+} // namespace
+
+void ReorderTriangles(Mesh *mesh, int cache_size, std::FILE *stats) {
+    // Identify vertexes by position in the bind pose, so vertexes which were
+    // split because their attributes differ are still treated as shared.
+    const FrameView vertexpos = mesh->animation_frame.at(0);
+    std::vector<int> pos_id(vertexpos.size());
+    int pos_count;
+    {
+        std::unordered_map<std::array<int16_t, 3>, int, HashPos> pos_map;
+        for (size_t i = 0; i < vertexpos.size(); i++) {
+            auto r = pos_map.emplace(vertexpos[i], pos_map.size());
+            pos_id[i] = r.first->second;
+        }
+        pos_count = pos_map.size();
+    }
+
+    std::vector<Triangle> &triangle = mesh->triangle;
+    std::stable_sort(triangle.begin(), triangle.end(),
+                     [](const Triangle &x, const Triangle &y) {
+                         if (x.lod != y.lod) {
+                             return x.lod < y.lod;
+                         }
+                         return x.material < y.material;
+                     });
+    std::vector<std::array<int, 3>> tris;
+    std::vector<Triangle> reordered;
+    for (size_t start = 0; start < triangle.size();) {
+        const int lod = triangle[start].lod;
+        const int material = triangle[start].material;
+        size_t end = start;
+        tris.clear();
+        while (end < triangle.size() && triangle[end].lod == lod &&
+               triangle[end].material == material) {
+            std::array<int, 3> tri;
+            for (int i = 0; i < 3; i++) {
+                tri[i] = pos_id.at(triangle[end].vertex[i]);
+            }
+            tris.push_back(tri);
+            end++;
+        }
+        Tipsify tipsify{tris, pos_count, cache_size};
+        const std::vector<int> order = tipsify.Run();
+        reordered.clear();
+        for (const int t : order) {
+            reordered.push_back(triangle[start + t]);
+        }
+        std::copy(reordered.begin(), reordered.end(), triangle.begin() + start);
+        start = end;
+    }
+    if (stats) {
+        fmt::print(stats, "Reordered triangles: {}\n", triangle.size());
+    }
+}
+
+} // namespace modelconvert
@@ -0,0 +1,20 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include <cstdio>
+
+namespace modelconvert {
+
+struct Mesh;
+
+// Reorder the triangles in a mesh so that triangles which share vertexes are
+// close together. This uses the Tipsify algorithm from Sander, Nehab, and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" (2007), with vertexes identified by position. Triangles are
+// sorted by level of detail and material, and each combination is reordered
+// separately.
+void ReorderTriangles(Mesh *mesh, int cache_size, std::FILE *stats);
+
+} // namespace modelconvert
@@ -0,0 +1,295 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/simplify.hpp"
+
+#include "tools/model/mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+namespace modelconvert {
+
+namespace {
+
+using Vec3 = std::array<double, 3>;
+
+Vec3 Sub(const Vec3 &x, const Vec3 &y) {
+    return Vec3{{x[0] - y[0], x[1] - y[1], x[2] - y[2]}};
+}
+
+Vec3 Cross(const Vec3 &x, const Vec3 &y) {
+    return Vec3{{x[1] * y[2] - x[2] * y[1], x[2] * y[0] - x[0] * y[2],
+                 x[0] * y[1] - x[1] * y[0]}};
+}
+
+double Dot(const Vec3 &x, const Vec3 &y) {
+    return x[0] * y[0] + x[1] * y[1] + x[2] * y[2];
+}
+
+// A quadric error function, the sum of squared distances to a set of planes.
+// Stored as the upper triangle of a symmetric 4x4 matrix.
+struct Quadric {
+    std::array<double, 10> q{};
+
+    // Return the quadric for the plane n·p + d = 0, scaled by weight.
+    static Quadric Plane(const Vec3 &n, double d, double weight) {
+        const double a = n[0], b = n[1], c = n[2];
+        return Quadric{{{a * a * weight, a * b * weight, a * c * weight,
+                         a * d * weight, b * b * weight, b * c * weight,
+                         b * d * weight, c * c * weight, c * d * weight,
+                         d * d * weight}}};
+    }
+
+    Quadric &operator+=(const Quadric &other) {
+        for (int i = 0; i < 10; i++) {
+            q[i] += other.q[i];
+        }
+        return *this;
+    }
+
+    // Evaluate the error at a point.
+    double Error(const Vec3 &p) const {
+        const double x = p[0], y = p[1], z = p[2];
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+               2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+               q[7] * z * z + 2 * q[8] * z + q[9];
+    }
+};
+
+// A candidate edge collapse, which moves one vertex onto another. The
+// versions record the state of the vertexes when the cost was calculated, so
+// stale candidates can be discarded.
+struct Collapse {
+    double cost;
+    int from;
+    int to;
+    unsigned from_version;
+    unsigned to_version;
+
+    // Order so that the lowest cost is at the top of a priority queue.
+    bool operator<(const Collapse &c) const {
+        if (cost != c.cost) {
+            return cost > c.cost;
+        }
+        if (from != c.from) {
+            return from > c.from;
+        }
+        return to > c.to;
+    }
+};
+
+class Simplifier {
+public:
+    explicit Simplifier(const Mesh &mesh) {
+        const FrameView pos = mesh.animation_frame.at(0);
+        const int nvert = pos.size();
+        m_pos.resize(nvert);
+        for (int i = 0; i < nvert; i++) {
+            for (int j = 0; j < 3; j++) {
+                m_pos[i][j] = pos[i][j];
+            }
+        }
+        for (const Triangle &tri : mesh.triangle) {
+            if (tri.lod == 0) {
+                m_triangle.push_back(tri);
+            }
+        }
+        m_live = m_triangle.size();
+        m_removed.resize(m_triangle.size(), false);
+        m_quadric.resize(nvert);
+        m_version.resize(nvert, 0);
+        m_vertex_triangle.resize(nvert);
+        m_locked.resize(nvert, false);
+        m_collapsed.resize(nvert, false);
+
+        // Each vertex starts with the planes of its triangles, weighted by
+        // area.
+        std::map<std::pair<int, int>, int> edge_count;
+        for (int t = 0; t < static_cast<int>(m_triangle.size()); t++) {
+            const std::array<int, 3> &v = m_triangle[t].vertex;
+            const Vec3 n = Normal(v);
+            const double len = std::sqrt(Dot(n, n));
+            if (len > 0.0) {
+                const Vec3 unit{{n[0] / len, n[1] / len, n[2] / len}};
+                const Quadric q =
+                    Quadric::Plane(unit, -Dot(unit, m_pos[v[0]]), len * 0.5);
+                for (const int i : v) {
+                    m_quadric[i] += q;
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                m_vertex_triangle[v[i]].push_back(t);
+                const int a = v[i], b = v[(i + 1) % 3];
+                edge_count[std::minmax(a, b)]++;
+            }
+        }
+
+        // Lock vertexes on borders and non-manifold edges.
+        for (const auto &[edge, count] : edge_count) {
+            if (count != 2) {
+                m_locked[edge.first] = true;
+                m_locked[edge.second] = true;
+            }
+        }
+
+        for (int v = 0; v < nvert; v++) {
+            PushCollapses(v);
+        }
+    }
+
+    // Number of triangles remaining.
+    int TriangleCount() const { return m_live; }
+
+    // Collapse edges until there are at most target triangles, or until no
+    // more edges can be collapsed.
+    void Run(int target) {
+        while (m_live > target && !m_queue.empty()) {
+            const Collapse c = m_queue.top();
+            m_queue.pop();
+            if (m_collapsed[c.from] || m_collapsed[c.to] ||
+                c.from_version != m_version[c.from] ||
+                c.to_version != m_version[c.to]) {
+                continue;
+            }
+            if (Flips(c.from, c.to)) {
+                continue;
+            }
+            Apply(c.from, c.to);
+        }
+    }
+
+    // Get the remaining triangles, with their lod set.
+    std::vector<Triangle> Triangles(int lod) const {
+        std::vector<Triangle> result;
+        result.reserve(m_live);
+        for (size_t t = 0; t < m_triangle.size(); t++) {
+            if (!m_removed[t]) {
+                Triangle tri = m_triangle[t];
+                tri.lod = lod;
+                result.push_back(tri);
+            }
+        }
+        return result;
+    }
+
+private:
+    // Return the normal of a triangle, with length equal to twice its area.
+    Vec3 Normal(const std::array<int, 3> &v) const {
+        return Cross(Sub(m_pos[v[1]], m_pos[v[0]]),
+                     Sub(m_pos[v[2]], m_pos[v[0]]));
+    }
+
+    // Add candidate collapses for every edge touching a vertex.
+    void PushCollapses(int v) {
+        for (const int t : m_vertex_triangle[v]) {
+            if (m_removed[t]) {
+                continue;
+            }
+            for (const int u : m_triangle[t].vertex) {
+                if (u != v) {
+                    PushCollapse(v, u);
+                    PushCollapse(u, v);
+                }
+            }
+        }
+    }
+
+    void PushCollapse(int from, int to) {
+        if (m_locked[from]) {
+            return;
+        }
+        Quadric q = m_quadric[from];
+        q += m_quadric[to];
+        m_queue.push(Collapse{q.Error(m_pos[to]), from, to, m_version[from],
+                              m_version[to]});
+    }
+
+    // Return true if moving one vertex onto another would flip any triangle
+    // which is not removed by the collapse.
+    bool Flips(int from, int to) const {
+        for (const int t : m_vertex_triangle[from]) {
+            if (m_removed[t]) {
+                continue;
+            }
+            std::array<int, 3> v = m_triangle[t].vertex;
+            if (std::find(v.begin(), v.end(), to) != v.end()) {
+                continue;
+            }
+            const Vec3 before = Normal(v);
+            std::replace(v.begin(), v.end(), from, to);
+            const Vec3 after = Normal(v);
+            if (Dot(before, after) <= 0.0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Move one vertex onto another, removing the triangles between them.
+    void Apply(int from, int to) {
+        std::vector<int> &to_tri = m_vertex_triangle[to];
+        for (const int t : m_vertex_triangle[from]) {
+            if (m_removed[t]) {
+                continue;
+            }
+            std::array<int, 3> &v = m_triangle[t].vertex;
+            if (std::find(v.begin(), v.end(), to) != v.end()) {
+                m_removed[t] = true;
+                m_live--;
+            } else {
+                std::replace(v.begin(), v.end(), from, to);
+                to_tri.push_back(t);
+            }
+        }
+        to_tri.erase(std::remove_if(to_tri.begin(), to_tri.end(),
+                                    [this](int t) { return m_removed[t]; }),
+                     to_tri.end());
+        m_vertex_triangle[from].clear();
+        m_collapsed[from] = true;
+        m_quadric[to] += m_quadric[from];
+        m_version[to]++;
+        PushCollapses(to);
+    }
+
+    std::vector<Vec3> m_pos;
+    std::vector<Triangle> m_triangle;
+    std::vector<bool> m_removed;
+    int m_live;
+    std::vector<Quadric> m_quadric;
+    std::vector<unsigned> m_version;
+    std::vector<std::vector<int>> m_vertex_triangle;
+    std::vector<bool> m_locked;
+    std::vector<bool> m_collapsed;
+    std::priority_queue<Collapse> m_queue;
+};
+
+} // namespace
+
+void GenerateLODs(Mesh *mesh, int level_count, float ratio, std::FILE *stats) {
+    Simplifier simplifier{*mesh};
+    if (stats) {
+        fmt::print(stats, "Level of detail 0: {} triangles\n",
+                   simplifier.TriangleCount());
+    }
+    double target = simplifier.TriangleCount();
+    for (int lod = 1; lod < level_count; lod++) {
+        target *= ratio;
+        simplifier.Run(static_cast<int>(target));
+        std::vector<Triangle> tri = simplifier.Triangles(lod);
+        if (stats) {
+            fmt::print(stats, "Level of detail {}: {} triangles\n", lod,
+                       tri.size());
+        }
+        mesh->triangle.insert(mesh->triangle.end(), tri.begin(), tri.end());
+    }
+}
+
+} // namespace modelconvert
@@ -0,0 +1,27 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include <cstdio>
+
+namespace modelconvert {
+
+struct Mesh;
+
+// Add simplified levels of detail to a mesh. Level 0 is the full mesh, and
+// each level after that keeps the given fraction of the triangles in the
+// previous level. The triangles for each level are added to the mesh, with
+// their lod field set to the level.
+//
+// This collapses edges in order of increasing error, using the quadric error
+// metric from Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics" (1997). Vertexes are only collapsed onto existing vertexes,
+// so the simplified levels use a subset of the mesh's vertexes. Each level is
+// still compiled with its own copy of the vertexes it uses, which adds to the
+// size of every animation frame. Vertexes on a border, including seams where
+// vertexes were split because their attributes differ, are never removed, so
+// seams do not crack.
+void GenerateLODs(Mesh *mesh, int level_count, float ratio, std::FILE *stats);
+
+} // namespace modelconvert
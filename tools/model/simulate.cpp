@@ -0,0 +1,189 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/simulate.hpp"
+
+#include "tools/model/model.hpp"
+
+#include <array>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace modelconvert {
+namespace gbi {
+
+namespace {
+
+// Maximum depth of display list calls.
+constexpr int MaxCallDepth = 18;
+
+const CostModel CostModels[] = {
+    // F3DEX2 fetches 21 commands at a time into a 0xA8 byte buffer.
+    {"f3dex2", 21, 12.0, 24.0, 0.5, 18.0, 140.0, 30.0, 120.0, 6.0},
+};
+
+class Simulator {
+public:
+    Simulator(const Model &model, const CostModel &m)
+        : m_model{model}, m_cost_model{m} {}
+
+    // Execute commands until the end of the display list.
+    void Execute(const Gfx *cmd, size_t size, int depth) {
+        if (depth > MaxCallDepth) {
+            throw std::runtime_error("SimulateDisplayList: calls too deep");
+        }
+        size_t n = 0;
+        while (true) {
+            if (n >= size) {
+                throw std::runtime_error(
+                    "SimulateDisplayList: missing end of display list");
+            }
+            const Gfx &g = cmd[n++];
+            if (!Step(g, depth)) {
+                break;
+            }
+        }
+        // Commands are fetched in blocks.
+        const size_t fetch = m_cost_model.fetch_commands;
+        cost.dma += (n + fetch - 1) / fetch;
+        cost.dma_bytes += n * Gfx::Size;
+    }
+
+    Cost cost;
+
+private:
+    // Execute one command, and return false if it ends the display list.
+    bool Step(const Gfx &g, int depth) {
+        cost.command++;
+        VertexLoad load;
+        std::array<std::array<int, 3>, 2> tri;
+        if (g.DecodeVertex(&load)) {
+            cost.dma++;
+            cost.dma_bytes += load.count * Vtx::Size;
+            cost.vertex += load.count;
+            return true;
+        }
+        if (const int n = g.DecodeTriangles(&tri); n > 0) {
+            cost.triangle += n;
+            return true;
+        }
+        switch (g.opcode()) {
+        case G_MODIFYVTX:
+            cost.modify++;
+            break;
+        case G_CULLDL: {
+            const unsigned vstart = (g.hi & 0xffff) / 2;
+            const unsigned vend = (g.lo & 0xffff) / 2;
+            if (vend >= vstart) {
+                cost.cull_vertex += vend - vstart + 1;
+            }
+        } break;
+        case G_MTX:
+            cost.dma++;
+            cost.dma_bytes += Mtx::Size;
+            cost.matrix++;
+            break;
+        case G_POPMTX:
+        case G_SETPRIMCOLOR:
+            break;
+        case G_DL: {
+            const size_t index = (g.lo & 0xffffff) / Gfx::Size;
+            const std::vector<Gfx> &called = m_model.called;
+            if (index >= called.size()) {
+                throw std::runtime_error(
+                    "SimulateDisplayList: bad display list address");
+            }
+            Execute(called.data() + index, called.size() - index, depth + 1);
+        } break;
+        case G_ENDDL:
+            return false;
+        default:
+            throw std::runtime_error(fmt::format(
+                "SimulateDisplayList: unknown opcode 0x{:02x}", g.opcode()));
+        }
+        return true;
+    }
+
+    const Model &m_model;
+    const CostModel &m_cost_model;
+};
+
+void WriteCost(std::FILE *stats, const char *indent, std::string_view name,
+               const Cost &cost, const CostModel &m) {
+    fmt::print(stats,
+               "{}{}: {:.0f} cycles, {} commands, {} vertexes, {} triangles, "
+               "{} DMA bytes\n",
+               indent, name, cost.Cycles(m), cost.command, cost.vertex,
+               cost.triangle, cost.dma_bytes);
+}
+
+} // namespace
+
+const CostModel *CostModel::Find(std::string_view name) {
+    for (const CostModel &m : CostModels) {
+        if (name == m.name) {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+std::string CostModel::Names() {
+    std::string result;
+    for (const CostModel &m : CostModels) {
+        if (!result.empty()) {
+            result.append(", ");
+        }
+        result.append(m.name);
+    }
+    return result;
+}
+
+Cost &Cost::operator+=(const Cost &c) {
+    command += c.command;
+    dma += c.dma;
+    dma_bytes += c.dma_bytes;
+    vertex += c.vertex;
+    triangle += c.triangle;
+    modify += c.modify;
+    matrix += c.matrix;
+    cull_vertex += c.cull_vertex;
+    return *this;
+}
+
+double Cost::Cycles(const CostModel &m) const {
+    return command * m.command + dma * m.dma + dma_bytes * m.dma_byte +
+           vertex * m.vertex + triangle * m.triangle + modify * m.modify +
+           matrix * m.matrix + cull_vertex * m.cull_vertex;
+}
+
+Cost SimulateDisplayList(const Model &model, const std::vector<Gfx> &dl,
+                         const CostModel &m) {
+    Simulator sim{model, m};
+    sim.Execute(dl.data(), dl.size(), 0);
+    return sim.cost;
+}
+
+void WriteCostStats(const Model &model, const CostModel &m, std::FILE *stats) {
+    fmt::print(stats, "RSP cost estimate ({}):\n", m.name);
+    for (size_t i = 0; i < model.lod.size(); i++) {
+        const std::vector<std::vector<Gfx>> &command = model.lod[i].command;
+        std::vector<Cost> material_cost;
+        Cost total;
+        for (const std::vector<Gfx> &dl : command) {
+            const Cost cost = SimulateDisplayList(model, dl, m);
+            material_cost.push_back(cost);
+            total += cost;
+        }
+        WriteCost(stats, "    ", fmt::format("Level of detail {}", i), total,
+                  m);
+        for (size_t j = 0; j < material_cost.size(); j++) {
+            WriteCost(stats, "        ", fmt::format("Material {}", j),
+                      material_cost[j], m);
+        }
+    }
+}
+
+} // namespace gbi
+} // namespace modelconvert
@@ -0,0 +1,70 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include "tools/model/gbi.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace modelconvert {
+namespace gbi {
+
+struct Model;
+
+// Estimated cost of RSP operations for one microcode, in RSP cycles. These
+// are rough estimates, which are useful for comparing models and compiler
+// settings against each other, but not for predicting frame times.
+struct CostModel {
+    const char *name;
+    int fetch_commands; // Number of commands fetched by one DMA.
+    double command;     // Decode and dispatch one command.
+    double dma;         // Start one DMA transfer.
+    double dma_byte;    // Transfer one byte by DMA.
+    double vertex;      // Transform one vertex.
+    double triangle;    // Set up one triangle.
+    double modify;      // Modify one vertex field.
+    double matrix;      // Multiply and push one matrix.
+    double cull_vertex; // Test one vertex for G_CULLDL.
+
+    // Get the cost model for a microcode, or return null if there is no cost
+    // model with that name.
+    static const CostModel *Find(std::string_view name);
+
+    // Get the names of all cost models, separated by commas.
+    static std::string Names();
+};
+
+// Counts of the operations executed by a display list.
+struct Cost {
+    size_t command = 0;
+    size_t dma = 0;
+    size_t dma_bytes = 0;
+    size_t vertex = 0;
+    size_t triangle = 0;
+    size_t modify = 0;
+    size_t matrix = 0;
+    size_t cull_vertex = 0;
+
+    Cost &operator+=(const Cost &c);
+
+    // Estimated number of RSP cycles for these operations.
+    double Cycles(const CostModel &m) const;
+};
+
+// Execute a display list from a model and count the operations it performs.
+// Calls to other display lists are followed. Display lists ended by G_CULLDL
+// are assumed to be visible, so the result is the cost when nothing is
+// culled.
+Cost SimulateDisplayList(const Model &model, const std::vector<Gfx> &dl,
+                         const CostModel &m);
+
+// Write the estimated cost of drawing each level of detail and material.
+void WriteCostStats(const Model &model, const CostModel &m, std::FILE *stats);
+
+} // namespace gbi
+} // namespace modelconvert
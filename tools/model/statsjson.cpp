@@ -0,0 +1,263 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#include "tools/model/statsjson.hpp"
+
+#include "lib/cpp/json.hpp"
+#include "tools/model/config.hpp"
+#include "tools/model/mesh.hpp"
+#include "tools/model/microcode.hpp"
+#include "tools/model/simulate.hpp"
+
+#include <map>
+#include <utility>
+
+#include <sys/resource.h>
+
+namespace modelconvert {
+
+namespace {
+
+// Totals for a group of segments, such as one level of detail and material.
+struct SegmentTotal {
+    int segment_count = 0;
+    int triangle_count = 0;
+    int position_count = 0;
+    int batch_count = 0;
+    int batch_vertex_count = 0;
+    int vertex_count = 0;
+    int drawn_triangle_count = 0;
+    int paired_triangle_count = 0;
+
+    void Add(const gbi::SegmentStats &s) {
+        segment_count++;
+        triangle_count += s.triangle_count;
+        position_count += s.position_count;
+        batch_count += s.batch_count;
+        batch_vertex_count += s.batch_vertex_count;
+        vertex_count += s.vertex_count;
+        drawn_triangle_count += s.drawn_triangle_count;
+        paired_triangle_count += s.paired_triangle_count;
+    }
+};
+
+// Return the peak resident memory of the process, in bytes, or -1 if it is
+// not available.
+int64_t PeakMemory() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+double Ratio(double x, double y) {
+    return y != 0.0 ? x / y : 0.0;
+}
+
+void WriteConfig(util::JSONWriter &w, const Config &cfg) {
+    w.BeginObject();
+    w.Key("primitive_color");
+    w.Bool(cfg.use_primitive_color);
+    w.Key("normals");
+    w.Bool(cfg.use_normals);
+    w.Key("texcoords");
+    w.Bool(cfg.use_texcoords);
+    w.Key("vertex_colors");
+    w.Bool(cfg.use_vertex_colors);
+    w.Key("texcoord_bits");
+    w.Int(cfg.texcoord_bits);
+    w.Key("scale");
+    w.Double(cfg.scale);
+    w.Key("axes");
+    w.String(cfg.axes.ToString());
+    w.Key("animate");
+    w.Bool(cfg.animate);
+    w.Key("frame_tolerance");
+    w.Int(cfg.frame_tolerance);
+    w.Key("keyframe_tolerance");
+    w.Int(cfg.keyframe_tolerance);
+    w.Key("rigid");
+    w.Bool(cfg.rigid);
+    w.Key("lod_distance");
+    w.BeginArray();
+    for (const float d : cfg.lod_distance) {
+        w.Double(d);
+    }
+    w.EndArray();
+    w.Key("lod_ratio");
+    w.Double(cfg.lod_ratio);
+    w.Key("cull_triangles");
+    w.Int(cfg.cull_triangles);
+    w.Key("reorder");
+    w.Bool(cfg.reorder);
+    w.Key("optimize");
+    w.Bool(cfg.optimize);
+    w.Key("microcode");
+    w.String(gbi::TargetMicrocode(cfg).name);
+    w.EndObject();
+}
+
+void WriteMaterials(util::JSONWriter &w, const gbi::Model &model,
+                    const gbi::CompileStats &stats,
+                    const gbi::CostModel &cost_model, int cache_size) {
+    std::map<std::pair<int, int>, SegmentTotal> totals;
+    for (const gbi::SegmentStats &s : stats.segment) {
+        totals[std::make_pair(s.lod, s.material)].Add(s);
+    }
+    w.BeginArray();
+    for (const auto &[key, t] : totals) {
+        const auto [lod, material] = key;
+        const std::vector<gbi::Gfx> &dl =
+            model.lod.at(lod).command.at(material);
+        const gbi::Cost cost = gbi::SimulateDisplayList(model, dl, cost_model);
+        w.BeginObject();
+        w.Key("lod");
+        w.Int(lod);
+        w.Key("material");
+        w.Int(material);
+        w.Key("segments");
+        w.Int(t.segment_count);
+        w.Key("triangles");
+        w.Int(t.triangle_count);
+        w.Key("batches");
+        w.Int(t.batch_count);
+        w.Key("average_cache_fill");
+        w.Double(Ratio(t.batch_vertex_count,
+                       static_cast<double>(t.batch_count) * cache_size));
+        w.Key("vertexes");
+        w.Int(t.vertex_count);
+        w.Key("transformed_vertex_ratio");
+        w.Double(Ratio(t.vertex_count, t.position_count));
+        w.Key("paired_triangle_ratio");
+        w.Double(Ratio(t.paired_triangle_count, t.drawn_triangle_count));
+        w.Key("commands");
+        w.Int(dl.size());
+        w.Key("estimated_rsp_cycles");
+        w.Double(cost.Cycles(cost_model));
+        w.EndObject();
+    }
+    w.EndArray();
+}
+
+} // namespace
+
+std::string StatsJSON(const Config &cfg, const Mesh &mesh,
+                      const gbi::Model &model, const ConvertStats &stats,
+                      const gbi::CostModel &cost_model) {
+    util::JSONWriter w;
+    w.BeginObject();
+    w.Key("config");
+    WriteConfig(w, cfg);
+
+    w.Key("time");
+    w.BeginObject();
+    double total = 0.0;
+    for (const PhaseTime &p : stats.phase) {
+        w.Key(p.name);
+        w.Double(p.seconds);
+        total += p.seconds;
+    }
+    w.Key("total");
+    w.Double(total);
+    w.EndObject();
+    // Peak memory is for the whole process, so it is omitted in batch mode,
+    // where it would include the other jobs.
+    if (!stats.batch) {
+        w.Key("peak_memory");
+        w.Int(PeakMemory());
+    }
+    w.Key("mesh_cache_hit");
+    w.Bool(stats.cache_hit);
+
+    w.Key("mesh");
+    w.BeginObject();
+    w.Key("vertexes");
+    w.Int(mesh.vertex.size());
+    w.Key("triangles");
+    w.Int(mesh.triangle.size());
+    w.Key("animations");
+    w.Int(mesh.animation.size());
+    w.Key("frames");
+    w.Int(mesh.animation_frame.size());
+    w.Key("bone_frames");
+    w.Int(mesh.bone_frame.size());
+    w.EndObject();
+
+    const gbi::CompileStats &cs = stats.compile;
+    const int cache_size = gbi::TargetMicrocode(cfg).vertex_cache_size;
+    SegmentTotal total_counts;
+    for (const gbi::SegmentStats &s : cs.segment) {
+        total_counts.Add(s);
+    }
+    const int batch_count = total_counts.batch_count;
+    const int batch_vertex_count = total_counts.batch_vertex_count;
+    w.Key("compile");
+    w.BeginObject();
+    w.Key("raw_vertexes");
+    w.Int(cs.raw_vertex_count);
+    w.Key("unique_vertex_positions");
+    w.Int(cs.unique_position_count);
+    w.Key("segments");
+    w.Int(cs.segment.size());
+    w.Key("batches");
+    w.Int(batch_count);
+    w.Key("batch_vertexes");
+    w.Int(batch_vertex_count);
+    w.Key("average_cache_fill");
+    w.Double(Ratio(batch_vertex_count,
+                   static_cast<double>(batch_count) * cache_size));
+    w.Key("transformed_vertex_ratio");
+    w.Double(Ratio(total_counts.vertex_count, total_counts.position_count));
+    w.Key("paired_triangle_ratio");
+    w.Double(Ratio(total_counts.paired_triangle_count,
+                   total_counts.drawn_triangle_count));
+    w.Key("materials");
+    WriteMaterials(w, model, cs, cost_model, cache_size);
+    w.EndObject();
+
+    size_t command_count = model.called.size();
+    for (const gbi::LevelOfDetail &level : model.lod) {
+        for (const std::vector<gbi::Gfx> &dl : level.command) {
+            command_count += dl.size();
+        }
+    }
+    const gbi::SectionSizes &sz = stats.sections;
+    w.Key("output");
+    w.BeginObject();
+    w.Key("commands");
+    w.Int(command_count);
+    w.Key("vertexes");
+    w.Int(model.vertex.size());
+    w.Key("frames");
+    w.Int(model.frame.size());
+    w.Key("bones");
+    w.Int(model.bone_count);
+    w.Key("cost_model");
+    w.String(cost_model.name);
+    w.Key("sections");
+    w.BeginObject();
+    w.Key("header");
+    w.Int(sz.header);
+    w.Key("animation");
+    w.Int(sz.animation);
+    w.Key("display_list");
+    w.Int(sz.display_list);
+    w.Key("vertex");
+    w.Int(sz.vertex);
+    w.Key("frame_data");
+    w.Int(sz.frame_data);
+    w.Key("total");
+    w.Int(sz.total);
+    w.EndObject();
+    w.EndObject();
+
+    w.EndObject();
+    return w.Finish();
+}
+
+} // namespace modelconvert
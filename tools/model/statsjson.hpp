@@ -0,0 +1,43 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+#pragma once
+
+#include "tools/model/compile.hpp"
+#include "tools/model/model.hpp"
+
+#include <string>
+#include <vector>
+
+namespace modelconvert {
+
+struct Config;
+struct Mesh;
+
+namespace gbi {
+struct CostModel;
+}
+
+// Wall time taken by one phase of converting a model.
+struct PhaseTime {
+    const char *name;
+    double seconds;
+};
+
+// Information recorded while converting a model, for JSON statistics.
+struct ConvertStats {
+    bool batch; // Other models may be converting in the same process.
+    bool cache_hit;
+    std::vector<PhaseTime> phase;
+    gbi::CompileStats compile;
+    gbi::SectionSizes sections;
+};
+
+// Return statistics for converting a model, as JSON text. This contains the
+// same information as the human-readable statistics, in a form which can be
+// compared across compiler versions.
+std::string StatsJSON(const Config &cfg, const Mesh &mesh,
+                      const gbi::Model &model, const ConvertStats &stats,
+                      const gbi::CostModel &cost_model);
+
+} // namespace modelconvert
@@ -3,23 +3,30 @@
 // Mozilla Public License, version 2.0. See LICENSE.txt for details.
 #include "tools/model/vertexcache.hpp"
 
-#include "lib/cpp/hash.hpp"
-
+#include <algorithm>
 #include <stdexcept>
 
 namespace modelconvert {
 namespace gbi {
 
-uint32_t VertexCache::HashPos::operator()(
-    const std::array<int16_t, 3> &p) const {
-    util::Murmur3 h = util::Murmur3::Initial(0);
-    h.Update(p[0]);
-    h.Update(p[1]);
-    h.Update(p[2]);
-    return h.Hash();
-}
+namespace {
+
+constexpr int SlotShift = 48;
+constexpr uint64_t PosMask = (uint64_t{1} << SlotShift) - 1;
 
-VertexCache::VertexCache(unsigned size) : m_entries(size, Entry{}) {}
+} // namespace
+
+VertexCache::VertexCache(unsigned size) : m_entries(size, Entry{}) {
+    if (size >= (1u << (64 - SlotShift)) - 1) {
+        throw std::range_error("VertexCache: size too large");
+    }
+    unsigned bits = 1;
+    while ((1u << bits) < size * 2) {
+        bits++;
+    }
+    m_pos.resize(1u << bits, 0);
+    m_pos_shift = 64 - bits;
+}
 
 const Vtx *VertexCache::Get(int cache_slot) const {
     if (cache_slot < 0 || cache_slot >= size()) {
@@ -38,11 +45,8 @@ Vtx *VertexCache::Get(int cache_slot) {
 }
 
 int VertexCache::CachePos(std::array<int16_t, 3> pos) const {
-    auto it = m_pos.find(pos);
-    if (it == m_pos.end()) {
-        return -1;
-    }
-    return it->second;
+    const uint64_t entry = m_pos[FindPos(PackPos(pos))];
+    return static_cast<int>(entry >> SlotShift) - 1;
 }
 
 void VertexCache::Erase(int cache_slot) {
@@ -56,7 +60,7 @@ void VertexCache::Clear() {
     for (Entry &e : m_entries) {
         e.valid = false;
     }
-    m_pos.clear();
+    std::fill(m_pos.begin(), m_pos.end(), 0);
 }
 
 void VertexCache::Set(int cache_slot, const Vtx &v) {
@@ -65,20 +69,68 @@ void VertexCache::Set(int cache_slot, const Vtx &v) {
     }
     Entry &e = m_entries.at(cache_slot);
     EraseEntry(cache_slot, e);
-    m_pos[v.pos] = cache_slot;
+    const uint64_t key = PackPos(v.pos);
+    m_pos[FindPos(key)] =
+        key | (static_cast<uint64_t>(cache_slot + 1) << SlotShift);
     e.valid = true;
     e.vertex = v;
 }
 
 void VertexCache::EraseEntry(int cache_slot, Entry &e) {
     if (e.valid) {
-        auto it = m_pos.find(e.vertex.pos);
-        if (it != m_pos.end() && it->second == cache_slot) {
-            m_pos.erase(it);
+        const unsigned index = FindPos(PackPos(e.vertex.pos));
+        if ((m_pos[index] >> SlotShift) ==
+            static_cast<uint64_t>(cache_slot + 1)) {
+            ErasePos(index);
         }
         e.valid = false;
     }
 }
 
+uint64_t VertexCache::PackPos(std::array<int16_t, 3> pos) {
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        key |= static_cast<uint64_t>(static_cast<uint16_t>(pos[i])) << (i * 16);
+    }
+    return key;
+}
+
+unsigned VertexCache::HomePos(uint64_t key) const {
+    // SplitMix64 finalizer. Plain multiplicative hashing clusters badly for
+    // small coordinates.
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9u;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebu;
+    key ^= key >> 31;
+    return key >> m_pos_shift;
+}
+
+unsigned VertexCache::FindPos(uint64_t key) const {
+    const unsigned mask = m_pos.size() - 1;
+    unsigned index = HomePos(key);
+    while (true) {
+        const uint64_t entry = m_pos[index];
+        if (entry == 0 || (entry & PosMask) == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void VertexCache::ErasePos(unsigned index) {
+    // Backward shift deletion: move later entries in the probe sequence into
+    // the hole, so lookups never need to skip over deleted entries.
+    const unsigned mask = m_pos.size() - 1;
+    unsigned hole = index;
+    for (unsigned next = (index + 1) & mask; m_pos[next] != 0;
+         next = (next + 1) & mask) {
+        const unsigned home = HomePos(m_pos[next] & PosMask);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            m_pos[hole] = m_pos[next];
+            hole = next;
+        }
+    }
+    m_pos[hole] = 0;
+}
+
 } // namespace gbi
 } // namespace modelconvert
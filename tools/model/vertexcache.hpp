@@ -7,7 +7,6 @@
 
 #include <array>
 #include <cstdint>
-#include <unordered_map>
 #include <vector>
 
 namespace modelconvert {
@@ -41,17 +40,33 @@ public:
 private:
     void EraseEntry(int cache_slot, Entry &e);
 
+    // Pack a position into the low 48 bits of a position table entry.
+    static uint64_t PackPos(std::array<int16_t, 3> pos);
+
+    // Get the index in the position table where a position would be stored,
+    // if there were no collisions.
+    unsigned HomePos(uint64_t key) const;
+
+    // Find the index of a packed position in the position table, or the empty
+    // index where it would be inserted.
+    unsigned FindPos(uint64_t key) const;
+
+    // Remove an entry from the position table.
+    void ErasePos(unsigned index);
+
     struct Entry {
         bool valid;
         Vtx vertex;
     };
 
-    struct HashPos {
-        uint32_t operator()(const std::array<int16_t, 3> &p) const;
-    };
-
     std::vector<Entry> m_entries;
-    std::unordered_map<std::array<int16_t, 3>, int, HashPos> m_pos;
+
+    // Open-addressed hash table mapping positions to cache slots, with linear
+    // probing. The size is a power of two, at least twice the cache size. Each
+    // entry contains the packed position in the low 48 bits and the slot plus
+    // one in the high 16 bits, or zero if the entry is empty.
+    std::vector<uint64_t> m_pos;
+    unsigned m_pos_shift;
 };
 
 } // namespace gbi
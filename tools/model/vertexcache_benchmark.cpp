@@ -0,0 +1,163 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+
+// Microbenchmark for the vertex cache model. Reports the time per operation
+// and a checksum of the lookup results, so that changes to the cache can be
+// checked for both speed and identical behavior.
+#include "lib/cpp/flag.hpp"
+#include "tools/model/microcode.hpp"
+#include "tools/model/vertexcache.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include <fmt/core.h>
+
+namespace modelconvert {
+namespace gbi {
+namespace {
+
+struct Args {
+    int size = Microcode::Find("f3dex2")->vertex_cache_size;
+    int positions = 48;
+    int iterations = 1000000;
+};
+
+void Help(FILE *fp, flag::Parser &fl) {
+    std::fputs("Usage: vertexcache_benchmark [-iterations=<n>]\n\n", fp);
+    fl.OptionHelp(fp);
+}
+
+Args ParseArgs(int argc, char **argv) {
+    Args args{};
+    flag::Parser fl;
+    fl.SetHelp(Help);
+    fl.AddFlag(flag::Int(&args.size), "size", "vertex cache size", "N");
+    fl.AddFlag(flag::Int(&args.positions), "positions",
+               "number of distinct vertex positions", "N");
+    fl.AddFlag(flag::Int(&args.iterations), "iterations",
+               "number of operations in each test", "N");
+    fl.ParseMain(argc, argv);
+    if (args.size < 1 || args.size > 1024) {
+        flag::FailUsage("-size must be in the range 1-1024");
+    }
+    if (args.positions < 1) {
+        flag::FailUsage("-positions must be positive");
+    }
+    if (args.iterations < 1) {
+        flag::FailUsage("-iterations must be positive");
+    }
+    return args;
+}
+
+// Fixed LCG, so the results are the same on every platform.
+class Random {
+public:
+    unsigned Next(unsigned n) {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 8) % n;
+    }
+
+private:
+    uint32_t m_state = 1;
+};
+
+class Benchmark {
+public:
+    explicit Benchmark(const Args &args)
+        : m_args{args}, m_cache(args.size), m_vertex(args.positions) {
+        Random rand;
+        for (Vtx &v : m_vertex) {
+            for (int i = 0; i < 3; i++) {
+                v.pos[i] = rand.Next(512) - 256;
+            }
+        }
+        m_pos.reserve(args.iterations);
+        m_slot.reserve(args.iterations);
+        for (int i = 0; i < args.iterations; i++) {
+            m_pos.push_back(rand.Next(args.positions));
+            m_slot.push_back(rand.Next(args.size));
+        }
+    }
+
+    void Run() {
+        Time("Set", [this]() {
+            for (int i = 0; i < m_args.iterations; i++) {
+                m_cache.Set(m_slot[i], m_vertex[m_pos[i]]);
+            }
+        });
+        Time("CachePos", [this]() {
+            for (int i = 0; i < m_args.iterations; i++) {
+                Add(m_cache.CachePos(m_vertex[m_pos[i]].pos));
+            }
+        });
+        Time("Erase+Set", [this]() {
+            for (int i = 0; i < m_args.iterations; i++) {
+                m_cache.Erase(m_slot[i]);
+                m_cache.Set(m_slot[i], m_vertex[m_pos[i]]);
+            }
+        });
+        // Mixed workload, similar to how batches use the cache.
+        Time("Mixed", [this]() {
+            for (int i = 0; i < m_args.iterations; i++) {
+                const unsigned op = m_pos[i] ^ m_slot[i];
+                if ((op & 3) == 0) {
+                    m_cache.Set(m_slot[i], m_vertex[m_pos[i]]);
+                } else if ((op & 15) == 1) {
+                    m_cache.Erase(m_slot[i]);
+                } else {
+                    Add(m_cache.CachePos(m_vertex[m_pos[i]].pos));
+                }
+            }
+        });
+        fmt::print("Checksum: {:08x}\n", m_checksum);
+    }
+
+private:
+    template <typename F>
+    void Time(const char *name, F func) {
+        using Clock = std::chrono::steady_clock;
+        m_cache.Clear();
+        Fill();
+        Clock::time_point start = Clock::now();
+        func();
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        fmt::print("{}: {:.2f} ns/op\n", name,
+                   elapsed.count() * 1e9 / m_args.iterations);
+    }
+
+    // Fill the cache with the first vertexes.
+    void Fill() {
+        for (int i = 0; i < m_args.size; i++) {
+            m_cache.Set(i, m_vertex[i % m_args.positions]);
+        }
+    }
+
+    void Add(int slot) {
+        m_checksum = (m_checksum * 31u) + static_cast<uint32_t>(slot);
+    }
+
+    const Args &m_args;
+    VertexCache m_cache;
+    std::vector<Vtx> m_vertex;
+    std::vector<unsigned> m_pos;
+    std::vector<unsigned> m_slot;
+    uint32_t m_checksum = 0;
+};
+
+void Main(int argc, char **argv) {
+    Args args = ParseArgs(argc, argv);
+    Benchmark bench{args};
+    bench.Run();
+}
+
+} // namespace
+} // namespace gbi
+} // namespace modelconvert
+
+int main(int argc, char **argv) {
+    modelconvert::gbi::Main(argc, argv);
+    return 0;
+}
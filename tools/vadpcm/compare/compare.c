@@ -0,0 +1,1017 @@
+// Copyright 2022 Dietrich Epp.
+// This file is part of Skelly 64. Skelly 64 is licensed under the terms of the
+// Mozilla Public License, version 2.0. See LICENSE.txt for details.
+
+// VADPCM quality comparison tool. Decodes VADPCM-encoded AIFC files and
+// compares them against the original PCM AIFF files, writing the results as
+// JSON. Directories of files are compared in parallel.
+#include "lib/c/tool.h"
+#include "lib/vadpcm/vadpcm.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Wmultichar"
+
+enum {
+    // Number of samples in each segment, for segmental SNR.
+    kSegmentSize = 256,
+
+    // Maximum number of worst frames to report.
+    kMaxWorst = 64,
+};
+
+// Limits for the SNR of each segment, in dB, for segmental SNR.
+static const double kSegmentMinSNR = -10.0;
+static const double kSegmentMaxSNR = 35.0;
+
+// Read a big-endian 16-bit integer.
+static uint16_t read16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Read a big-endian 32-bit integer.
+static uint32_t read32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static const uint8_t kCodebookHeader[] = {
+    's', 't', 'o', 'c', 11,  'V', 'A', 'D',
+    'P', 'C', 'M', 'C', 'O', 'D', 'E', 'S',
+};
+
+// Contents of an AIFF or AIFC file.
+struct aiff {
+    void *data; // Must be freed with free().
+    bool is_aifc;
+    int channels;
+    uint32_t frame_count;
+    int sample_size;
+    uint32_t compression;
+    const uint8_t *audio;
+    uint32_t audio_size;
+    const uint8_t *codebook;
+    uint32_t codebook_size;
+};
+
+// A comparison between a reference file and an encoded file.
+struct job {
+    char *reference;
+    char *encoded;
+
+    // Error message, empty if there is no error.
+    char error[256];
+
+    // Results.
+    size_t sample_count;
+    double snr;
+    double segmental_snr;
+    int peak_error;
+    size_t clip_count;
+    int worst_count;
+    size_t worst_frame[kMaxWorst];
+    double worst_error[kMaxWorst];
+};
+
+static void job_error(struct job *job, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void job_error(struct job *job, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(job->error, sizeof(job->error), fmt, ap);
+    va_end(ap);
+}
+
+// Read an entire file into memory.
+static bool read_file(struct job *job, const char *path, void **data,
+                      size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        job_error(job, "%s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        job_error(job, "%s: %s", path, strerror(errno));
+        fclose(fp);
+        return false;
+    }
+    size_t len = st.st_size;
+    uint8_t *ptr = malloc(len > 0 ? len : 1);
+    if (ptr == NULL) {
+        job_error(job, "%s: no memory", path);
+        fclose(fp);
+        return false;
+    }
+    size_t pos = 0;
+    while (pos < len) {
+        size_t amt = fread(ptr + pos, 1, len - pos, fp);
+        if (amt == 0) {
+            job_error(job, "%s: %s", path,
+                      ferror(fp) ? strerror(errno) : "unexpected EOF");
+            free(ptr);
+            fclose(fp);
+            return false;
+        }
+        pos += amt;
+    }
+    fclose(fp);
+    *data = ptr;
+    *size = len;
+    return true;
+}
+
+// Read and parse an AIFF or AIFC file.
+static bool read_aiff(struct job *job, struct aiff *aiff, const char *path) {
+    void *data;
+    size_t file_size;
+    if (!read_file(job, path, &data, &file_size)) {
+        return false;
+    }
+    *aiff = (struct aiff){.data = data};
+    const uint8_t *ptr = data;
+    if (file_size < 12) {
+        job_error(job, "%s: file too small", path);
+        goto fail;
+    }
+    uint32_t id = read32(ptr);
+    uint32_t size = read32(ptr + 4);
+    uint32_t form_type = read32(ptr + 8);
+    if (id != 'FORM' || (form_type != 'AIFF' && form_type != 'AIFC')) {
+        job_error(job, "%s: not an AIFF or AIFC file", path);
+        goto fail;
+    }
+    if (size > file_size - 8) {
+        job_error(job, "%s: missing data", path);
+        goto fail;
+    }
+    aiff->is_aifc = form_type == 'AIFC';
+    aiff->compression = 'NONE';
+    const uint8_t *end = ptr + 8 + size;
+    bool have_comm = false;
+    ptr += 12;
+    while (end - ptr >= 8) {
+        id = read32(ptr);
+        size = read32(ptr + 4);
+        ptr += 8;
+        uint32_t advance = (size + 1) & ~(uint32_t)1;
+        if (advance < size || size > (size_t)(end - ptr)) {
+            job_error(job, "%s: bad chunk", path);
+            goto fail;
+        }
+        if (id == 'COMM') {
+            if (size < (aiff->is_aifc ? 22 : 18)) {
+                job_error(job, "%s: bad COMM chunk", path);
+                goto fail;
+            }
+            aiff->channels = read16(ptr);
+            aiff->frame_count = read32(ptr + 2);
+            aiff->sample_size = read16(ptr + 6);
+            if (aiff->is_aifc) {
+                aiff->compression = read32(ptr + 18);
+            }
+            have_comm = true;
+        } else if (id == 'SSND') {
+            if (size < 8) {
+                job_error(job, "%s: bad SSND chunk", path);
+                goto fail;
+            }
+            uint32_t offset = read32(ptr);
+            if (offset > size - 8) {
+                job_error(job, "%s: bad SSND chunk", path);
+                goto fail;
+            }
+            aiff->audio = ptr + 8 + offset;
+            aiff->audio_size = size - 8 - offset;
+        } else if (id == 'APPL') {
+            if (size >= sizeof(kCodebookHeader) &&
+                memcmp(ptr, kCodebookHeader, sizeof(kCodebookHeader)) == 0) {
+                aiff->codebook = ptr + sizeof(kCodebookHeader);
+                aiff->codebook_size = size - sizeof(kCodebookHeader);
+            }
+        }
+        ptr += advance;
+    }
+    if (!have_comm) {
+        job_error(job, "%s: no COMM chunk", path);
+        goto fail;
+    }
+    if (aiff->channels != 1) {
+        job_error(job, "%s: audio has %d channels, only mono is supported",
+                  path, aiff->channels);
+        goto fail;
+    }
+    return true;
+fail:
+    free(data);
+    aiff->data = NULL;
+    return false;
+}
+
+// Read the reference PCM audio.
+static int16_t *read_reference(struct job *job, size_t *sample_count) {
+    struct aiff aiff;
+    if (!read_aiff(job, &aiff, job->reference)) {
+        return NULL;
+    }
+    int16_t *pcm = NULL;
+    if (aiff.compression != 'NONE' || aiff.sample_size != 16) {
+        job_error(job, "%s: audio is not 16-bit PCM", job->reference);
+        goto done;
+    }
+    size_t count = aiff.frame_count;
+    if (count > aiff.audio_size / 2) {
+        job_error(job, "%s: SSND chunk is too short", job->reference);
+        goto done;
+    }
+    pcm = malloc(sizeof(*pcm) * (count > 0 ? count : 1));
+    if (pcm == NULL) {
+        job_error(job, "%s: no memory", job->reference);
+        goto done;
+    }
+    for (size_t i = 0; i < count; i++) {
+        pcm[i] = read16(aiff.audio + 2 * i);
+    }
+    *sample_count = count;
+done:
+    free(aiff.data);
+    return pcm;
+}
+
+// Read and decode the encoded VADPCM audio. The output is padded to a whole
+// number of VADPCM frames.
+static int16_t *read_encoded(struct job *job, size_t *sample_count) {
+    struct aiff aiff;
+    if (!read_aiff(job, &aiff, job->encoded)) {
+        return NULL;
+    }
+    int16_t *pcm = NULL;
+    if (aiff.compression != 'VAPC') {
+        job_error(job, "%s: audio is not VADPCM", job->encoded);
+        goto done;
+    }
+    if (aiff.codebook == NULL) {
+        job_error(job, "%s: no VADPCM codebook", job->encoded);
+        goto done;
+    }
+    struct vadpcm_codebook_spec spec;
+    size_t offset;
+    vadpcm_error err = vadpcm_read_codebook_aifc(&spec, &offset, aiff.codebook,
+                                                 aiff.codebook_size);
+    if (err != 0) {
+        job_error(job, "%s: bad codebook: %s", job->encoded,
+                  vadpcm_error_name(err));
+        goto done;
+    }
+    struct vadpcm_vector codebook[kVADPCMMaxOrder * kVADPCMMaxPredictorCount];
+    vadpcm_read_vectors(spec.order * spec.predictor_count,
+                        aiff.codebook + offset, codebook);
+    size_t frame_count = aiff.frame_count / kVADPCMFrameSampleCount;
+    if (aiff.frame_count % kVADPCMFrameSampleCount != 0) {
+        frame_count++;
+    }
+    if (frame_count > aiff.audio_size / kVADPCMFrameByteSize) {
+        job_error(job, "%s: SSND chunk is too short", job->encoded);
+        goto done;
+    }
+    pcm = malloc(sizeof(*pcm) * kVADPCMFrameSampleCount *
+                 (frame_count > 0 ? frame_count : 1));
+    if (pcm == NULL) {
+        job_error(job, "%s: no memory", job->encoded);
+        goto done;
+    }
+    struct vadpcm_vector state = {{0}};
+    err = vadpcm_decode(spec.predictor_count, spec.order, codebook, &state,
+                        frame_count, pcm, aiff.audio);
+    if (err != 0) {
+        job_error(job, "%s: decode: %s", job->encoded, vadpcm_error_name(err));
+        free(pcm);
+        pcm = NULL;
+        goto done;
+    }
+    *sample_count = frame_count * kVADPCMFrameSampleCount;
+done:
+    free(aiff.data);
+    return pcm;
+}
+
+// Statistics for one VADPCM frame.
+struct frame_stats {
+    int64_t signal;
+    int64_t noise;
+    int peak;
+    int clip;
+};
+
+// Compare one frame of audio. The loop has a fixed length and no branches, so
+// it can be vectorized.
+static struct frame_stats compare_frame(const int16_t *restrict ref,
+                                        const int16_t *restrict out) {
+    int64_t signal = 0, noise = 0;
+    int peak = 0, clip = 0;
+    for (int i = 0; i < kVADPCMFrameSampleCount; i++) {
+        int r = ref[i], d = out[i] - r;
+        int a = d < 0 ? -d : d;
+        signal += r * r;
+        noise += (int64_t)d * d;
+        peak = a > peak ? a : peak;
+        clip += out[i] == -0x8000 || out[i] == 0x7fff;
+    }
+    return (struct frame_stats){signal, noise, peak, clip};
+}
+
+// Convert an energy ratio to decibels.
+static double ratio_db(double signal, double noise) {
+    if (noise == 0.0) {
+        return INFINITY;
+    }
+    return 10.0 * log10(signal / noise);
+}
+
+// Record a frame in the list of worst frames, which is sorted by decreasing
+// error.
+static void add_worst(struct job *job, int max_worst, size_t frame,
+                      double error) {
+    int n = job->worst_count;
+    if (n == max_worst && (n == 0 || error <= job->worst_error[n - 1])) {
+        return;
+    }
+    if (n < max_worst) {
+        n++;
+        job->worst_count = n;
+    }
+    int i = n - 1;
+    while (i > 0 && job->worst_error[i - 1] < error) {
+        job->worst_frame[i] = job->worst_frame[i - 1];
+        job->worst_error[i] = job->worst_error[i - 1];
+        i--;
+    }
+    job->worst_frame[i] = frame;
+    job->worst_error[i] = error;
+}
+
+// Compare decoded audio against the reference. The reference is padded with
+// zeroes to a whole number of frames.
+static void compare(struct job *job, int max_worst, size_t sample_count,
+                    const int16_t *restrict ref, const int16_t *restrict out) {
+    size_t frame_count = sample_count / kVADPCMFrameSampleCount;
+    int64_t signal = 0, noise = 0;
+    int64_t seg_signal = 0, seg_noise = 0;
+    double seg_total = 0.0;
+    size_t seg_count = 0;
+    int peak = 0;
+    size_t clip = 0;
+    for (size_t frame = 0; frame < frame_count; frame++) {
+        struct frame_stats st =
+            compare_frame(ref + frame * kVADPCMFrameSampleCount,
+                          out + frame * kVADPCMFrameSampleCount);
+        signal += st.signal;
+        noise += st.noise;
+        peak = st.peak > peak ? st.peak : peak;
+        clip += st.clip;
+        if (st.noise > 0) {
+            add_worst(job, max_worst, frame, (double)st.noise);
+        }
+        seg_signal += st.signal;
+        seg_noise += st.noise;
+        if ((frame + 1) % (kSegmentSize / kVADPCMFrameSampleCount) == 0 ||
+            frame + 1 == frame_count) {
+            // Silent segments are excluded.
+            if (seg_signal > 0) {
+                double snr = ratio_db((double)seg_signal, (double)seg_noise);
+                if (snr < kSegmentMinSNR) {
+                    snr = kSegmentMinSNR;
+                } else if (snr > kSegmentMaxSNR) {
+                    snr = kSegmentMaxSNR;
+                }
+                seg_total += snr;
+                seg_count++;
+            }
+            seg_signal = 0;
+            seg_noise = 0;
+        }
+    }
+    job->snr = ratio_db((double)signal, (double)noise);
+    job->segmental_snr = seg_count > 0 ? seg_total / seg_count : 0.0;
+    job->peak_error = peak;
+    job->clip_count = clip;
+}
+
+static void run_job(struct job *job, int max_worst) {
+    size_t ref_count, out_count;
+    int16_t *ref = read_reference(job, &ref_count);
+    int16_t *out = NULL;
+    if (ref == NULL) {
+        goto done;
+    }
+    out = read_encoded(job, &out_count);
+    if (out == NULL) {
+        goto done;
+    }
+    if (out_count < ref_count) {
+        job_error(job, "encoded audio is shorter than reference: %zu < %zu",
+                  out_count, ref_count);
+        goto done;
+    }
+    int16_t *padded =
+        realloc(ref, sizeof(*ref) * (out_count > 0 ? out_count : 1));
+    if (padded == NULL) {
+        job_error(job, "no memory");
+        goto done;
+    }
+    ref = padded;
+    memset(ref + ref_count, 0, sizeof(*ref) * (out_count - ref_count));
+    job->sample_count = ref_count;
+    compare(job, max_worst, out_count, ref, out);
+done:
+    free(ref);
+    free(out);
+}
+
+// Shared state for worker threads.
+struct pool {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t job_count;
+    struct job *jobs;
+    int max_worst;
+};
+
+static void *worker(void *arg) {
+    struct pool *pool = arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        size_t i = pool->next;
+        if (i < pool->job_count) {
+            pool->next = i + 1;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->job_count) {
+            return NULL;
+        }
+        run_job(&pool->jobs[i], pool->max_worst);
+    }
+}
+
+static void run_jobs(struct job *jobs, size_t job_count, int thread_count,
+                     int max_worst) {
+    struct pool pool = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .job_count = job_count,
+        .jobs = jobs,
+        .max_worst = max_worst,
+    };
+    if ((size_t)thread_count > job_count) {
+        thread_count = job_count;
+    }
+    if (thread_count <= 1) {
+        worker(&pool);
+        return;
+    }
+    pthread_t *threads = malloc(sizeof(*threads) * thread_count);
+    if (threads == NULL) {
+        die("no memory");
+    }
+    for (int i = 0; i < thread_count; i++) {
+        int err = pthread_create(&threads[i], NULL, worker, &pool);
+        if (err != 0) {
+            die_errno(err, "could not create thread");
+        }
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+static char *xstrdup(const char *s) {
+    char *p = strdup(s);
+    if (p == NULL) {
+        die("no memory");
+    }
+    return p;
+}
+
+static char *join_path(const char *dir, const char *name, size_t name_len,
+                       const char *ext) {
+    size_t dir_len = strlen(dir), ext_len = strlen(ext);
+    char *p = malloc(dir_len + name_len + ext_len + 2);
+    if (p == NULL) {
+        die("no memory");
+    }
+    memcpy(p, dir, dir_len);
+    p[dir_len] = '/';
+    memcpy(p + dir_len + 1, name, name_len);
+    memcpy(p + dir_len + 1 + name_len, ext, ext_len + 1);
+    return p;
+}
+
+static int compare_names(const void *x, const void *y) {
+    return strcmp(*(char *const *)x, *(char *const *)y);
+}
+
+// Create a job for each encoded file in a directory.
+static struct job *list_jobs(const char *ref_dir, const char *enc_dir,
+                             size_t *job_count) {
+    DIR *dir = opendir(enc_dir);
+    if (dir == NULL) {
+        die_errno(errno, "could not open directory '%s'", enc_dir);
+    }
+    char **names = NULL;
+    size_t count = 0, alloc = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len <= 5 || strcmp(ent->d_name + len - 5, ".aifc") != 0) {
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc > 0 ? alloc * 2 : 16;
+            names = realloc(names, sizeof(*names) * alloc);
+            if (names == NULL) {
+                die("no memory");
+            }
+        }
+        names[count++] = xstrdup(ent->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(*names), compare_names);
+    struct job *jobs = calloc(count > 0 ? count : 1, sizeof(*jobs));
+    if (jobs == NULL) {
+        die("no memory");
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(names[i]) - 5;
+        jobs[i].reference = join_path(ref_dir, names[i], len, ".aiff");
+        jobs[i].encoded = join_path(enc_dir, names[i], len, ".aifc");
+        free(names[i]);
+    }
+    free(names);
+    *job_count = count;
+    return jobs;
+}
+
+static void write_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Write a number in dB. JSON has no infinity, so infinite values (no noise)
+// are written as null.
+static void write_db(FILE *out, double x) {
+    if (isfinite(x)) {
+        fprintf(out, "%.3f", x);
+    } else {
+        fputs("null", out);
+    }
+}
+
+static void write_json(FILE *out, const struct job *jobs, size_t job_count) {
+    fputs("[", out);
+    for (size_t i = 0; i < job_count; i++) {
+        const struct job *job = &jobs[i];
+        fputs(i == 0 ? "\n  {" : ",\n  {", out);
+        fputs("\n    \"reference\": ", out);
+        write_string(out, job->reference);
+        fputs(",\n    \"encoded\": ", out);
+        write_string(out, job->encoded);
+        if (job->error[0] != '\0') {
+            fputs(",\n    \"error\": ", out);
+            write_string(out, job->error);
+            fputs("\n  }", out);
+            continue;
+        }
+        fprintf(out, ",\n    \"sampleCount\": %zu", job->sample_count);
+        fputs(",\n    \"snr\": ", out);
+        write_db(out, job->snr);
+        fputs(",\n    \"segmentalSNR\": ", out);
+        write_db(out, job->segmental_snr);
+        fprintf(out, ",\n    \"peakError\": %d", job->peak_error);
+        fprintf(out, ",\n    \"clipCount\": %zu", job->clip_count);
+        fputs(",\n    \"worstFrames\": [", out);
+        for (int j = 0; j < job->worst_count; j++) {
+            fprintf(out, "%s\n      {\"frame\": %zu, \"error\": %.0f}",
+                    j == 0 ? "" : ",", job->worst_frame[j],
+                    job->worst_error[j]);
+        }
+        fputs(job->worst_count > 0 ? "\n    ]" : "]", out);
+        fputs("\n  }", out);
+    }
+    fputs(job_count > 0 ? "\n]\n" : "]\n", out);
+}
+
+static bool is_dir(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        die_errno(errno, "could not stat '%s'", path);
+    }
+    return S_ISDIR(st.st_mode);
+}
+
+#if !TEST
+
+static void usage(FILE *fp) {
+    fputs(
+        "Usage:\n"
+        "    compare [-jobs=<n>] [-worst=<n>] [-output=<file.json>]\n"
+        "            <reference.aiff> <encoded.aifc>\n"
+        "    compare [-jobs=<n>] [-worst=<n>] [-output=<file.json>]\n"
+        "            <reference-dir> <encoded-dir>\n"
+        "\n"
+        "In directory mode, each <name>.aifc in the encoded directory is\n"
+        "compared against <name>.aiff in the reference directory.\n",
+        fp);
+}
+
+int main(int argc, char **argv) {
+    const char *arg_output = NULL;
+    int arg_jobs = 0;
+    int arg_worst = 5;
+    const char *paths[2];
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (arg[0] != '-') {
+            if (path_count == 2) {
+                usage(stderr);
+                die("unexpected argument: '%s'", arg);
+            }
+            paths[path_count++] = arg;
+            continue;
+        }
+        char *opt = arg + 1;
+        if (*opt == '-')
+            opt++;
+        char *eq = strchr(opt, '=');
+        char *value = NULL;
+        if (eq != NULL) {
+            *eq = '\0';
+            value = eq + 1;
+        }
+        if (strcmp(opt, "help") == 0 || strcmp(opt, "h") == 0) {
+            usage(stdout);
+            return 0;
+        } else if (strcmp(opt, "output") == 0) {
+            if (value == NULL)
+                die("-output requires parameter -output=<file>");
+            arg_output = value;
+        } else if (strcmp(opt, "jobs") == 0) {
+            if (value == NULL)
+                die("-jobs requires parameter -jobs=<n>");
+            arg_jobs = xatoi(value);
+            if (arg_jobs < 1)
+                die("invalid job count: %d", arg_jobs);
+        } else if (strcmp(opt, "worst") == 0) {
+            if (value == NULL)
+                die("-worst requires parameter -worst=<n>");
+            arg_worst = xatoi(value);
+            if (arg_worst < 0 || kMaxWorst < arg_worst)
+                die("worst frame count must be in the range 0-%d: %d",
+                    kMaxWorst, arg_worst);
+        } else {
+            if (eq != NULL) {
+                *eq = '=';
+            }
+            usage(stderr);
+            die("unknown flag: '%s'", arg);
+        }
+    }
+    if (path_count != 2) {
+        usage(stderr);
+        die("expected 2 arguments, got %d", path_count);
+    }
+    if (arg_jobs == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        arg_jobs = n > 0 ? n : 1;
+    }
+
+    struct job *jobs;
+    size_t job_count;
+    bool ref_is_dir = is_dir(paths[0]), enc_is_dir = is_dir(paths[1]);
+    if (ref_is_dir != enc_is_dir) {
+        die("arguments must both be files or both be directories");
+    }
+    if (ref_is_dir) {
+        jobs = list_jobs(paths[0], paths[1], &job_count);
+    } else {
+        jobs = calloc(1, sizeof(*jobs));
+        if (jobs == NULL) {
+            die("no memory");
+        }
+        jobs[0].reference = xstrdup(paths[0]);
+        jobs[0].encoded = xstrdup(paths[1]);
+        job_count = 1;
+    }
+
+    run_jobs(jobs, job_count, arg_jobs, arg_worst);
+
+    FILE *out = stdout;
+    if (arg_output != NULL) {
+        out = fopen(arg_output, "w");
+        if (out == NULL)
+            die_errno(errno, "could not open output '%s'", arg_output);
+    }
+    write_json(out, jobs, job_count);
+    if (fflush(out) != 0 || ferror(out)) {
+        die_errno(errno, "could not write output");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < job_count; i++) {
+        if (jobs[i].error[0] != '\0') {
+            fprintf(stderr, "Error: %s\n", jobs[i].error);
+            status = 1;
+        }
+        free(jobs[i].reference);
+        free(jobs[i].encoded);
+    }
+    free(jobs);
+    return status;
+}
+
+#else // TEST
+
+static int test_failure_count;
+
+// Check that the comparison statistics are correct for synthetic audio with
+// known error.
+static void test_compare(void) {
+    enum {
+        kFrameCount = 40,
+        kSampleCount = kFrameCount * kVADPCMFrameSampleCount,
+    };
+    static int16_t ref[kSampleCount], out[kSampleCount];
+    for (int i = 0; i < kSampleCount; i++) {
+        ref[i] = 1000;
+        out[i] = 1000;
+    }
+    // Error of 10 in every sample of frame 3, and 20 in one sample of frame 7.
+    // Frame 30 is clipped, with error 0x7fff - 1000.
+    for (int i = 0; i < kVADPCMFrameSampleCount; i++) {
+        out[3 * kVADPCMFrameSampleCount + i] += 10;
+    }
+    out[7 * kVADPCMFrameSampleCount + 5] -= 20;
+    out[30 * kVADPCMFrameSampleCount] = 0x7fff;
+
+    static char kRefName[] = "ref", kOutName[] = "out";
+    struct job job = {.reference = kRefName, .encoded = kOutName};
+    compare(&job, 2, kSampleCount, ref, out);
+    const double clip_error = (double)(0x7fff - 1000) * (0x7fff - 1000);
+    const double noise = kVADPCMFrameSampleCount * 10.0 * 10.0 + 20.0 * 20.0 +
+                         clip_error;
+    const double snr = 10.0 * log10(kSampleCount * 1000.0 * 1000.0 / noise);
+    if (fabs(job.snr - snr) > 1e-9) {
+        fprintf(stderr, "error: test_compare: snr = %f, expected %f\n",
+                job.snr, snr);
+        test_failure_count++;
+    }
+    if (job.peak_error != 0x7fff - 1000) {
+        fprintf(stderr, "error: test_compare: peak error = %d, expected %d\n",
+                job.peak_error, 0x7fff - 1000);
+        test_failure_count++;
+    }
+    if (job.clip_count != 1) {
+        fprintf(stderr, "error: test_compare: clip count = %zu, expected 1\n",
+                job.clip_count);
+        test_failure_count++;
+    }
+    static const size_t kWorstFrame[2] = {30, 3};
+    const double worst_error[2] = {clip_error,
+                                   kVADPCMFrameSampleCount * 10.0 * 10.0};
+    if (job.worst_count != 2) {
+        fprintf(stderr, "error: test_compare: worst count = %d, expected 2\n",
+                job.worst_count);
+        test_failure_count++;
+    } else {
+        for (int i = 0; i < 2; i++) {
+            if (job.worst_frame[i] != kWorstFrame[i] ||
+                job.worst_error[i] != worst_error[i]) {
+                fprintf(stderr,
+                        "error: test_compare: worst[%d] = frame %zu, "
+                        "error %f; expected frame %zu, error %f\n",
+                        i, job.worst_frame[i], job.worst_error[i],
+                        kWorstFrame[i], worst_error[i]);
+                test_failure_count++;
+            }
+        }
+    }
+
+    // Identical audio has no noise, and is written as null in JSON.
+    job = (struct job){.reference = kRefName, .encoded = kOutName};
+    compare(&job, 2, kSampleCount, ref, ref);
+    if (!isinf(job.snr) || job.peak_error != 0 || job.worst_count != 0) {
+        fprintf(stderr,
+                "error: test_compare: identical audio: snr = %f, "
+                "peak error = %d, worst count = %d\n",
+                job.snr, job.peak_error, job.worst_count);
+        test_failure_count++;
+    }
+}
+
+// Check that the JSON output is correct for a successful comparison and a
+// failed comparison.
+static void test_write_json(void) {
+    static char kNames[4][16] = {"a.aiff", "a.aifc", "b.aiff", "b\"c.aifc"};
+    struct job jobs[2] = {
+        {
+            .reference = kNames[0],
+            .encoded = kNames[1],
+            .sample_count = 32,
+            .snr = INFINITY,
+            .segmental_snr = 12.5,
+            .peak_error = 3,
+            .clip_count = 0,
+            .worst_count = 1,
+            .worst_frame = {1},
+            .worst_error = {9.0},
+        },
+        {
+            .reference = kNames[2],
+            .encoded = kNames[3],
+            .error = "b.aiff: bad chunk",
+        },
+    };
+    static const char kExpected[] =
+        "[\n"
+        "  {\n"
+        "    \"reference\": \"a.aiff\",\n"
+        "    \"encoded\": \"a.aifc\",\n"
+        "    \"sampleCount\": 32,\n"
+        "    \"snr\": null,\n"
+        "    \"segmentalSNR\": 12.500,\n"
+        "    \"peakError\": 3,\n"
+        "    \"clipCount\": 0,\n"
+        "    \"worstFrames\": [\n"
+        "      {\"frame\": 1, \"error\": 9}\n"
+        "    ]\n"
+        "  },\n"
+        "  {\n"
+        "    \"reference\": \"b.aiff\",\n"
+        "    \"encoded\": \"b\\\"c.aifc\",\n"
+        "    \"error\": \"b.aiff: bad chunk\"\n"
+        "  }\n"
+        "]\n";
+    char buf[1024];
+    FILE *fp = tmpfile();
+    if (fp == NULL) {
+        die_errno(errno, "tmpfile");
+    }
+    write_json(fp, jobs, 2);
+    rewind(fp);
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    if (strcmp(buf, kExpected) != 0) {
+        fprintf(stderr,
+                "error: test_write_json: output:\n%s\nexpected:\n%s\n", buf,
+                kExpected);
+        test_failure_count++;
+    }
+}
+
+// Check that the tool reads the test data. The PCM file is the decoded output
+// of the VADPCM file, so there is no error.
+static void test_file(const char *name) {
+    char reference[128], encoded[128];
+    snprintf(reference, sizeof(reference), "lib/vadpcm/data/%s.pcm.aiff",
+             name);
+    snprintf(encoded, sizeof(encoded), "lib/vadpcm/data/%s.adpcm.aifc", name);
+    struct job job = {.reference = reference, .encoded = encoded};
+    run_job(&job, 5);
+    if (job.error[0] != '\0') {
+        fprintf(stderr, "error: test_file %s: %s\n", name, job.error);
+        test_failure_count++;
+        return;
+    }
+    if (job.sample_count == 0 || !isinf(job.snr) || job.peak_error != 0 ||
+        job.worst_count != 0) {
+        fprintf(stderr,
+                "error: test_file %s: sample count = %zu, snr = %f, "
+                "peak error = %d, worst count = %d\n",
+                name, job.sample_count, job.snr, job.peak_error,
+                job.worst_count);
+        test_failure_count++;
+    }
+}
+
+// Create a symbolic link to a file in the test data directory.
+static void test_link(const char *cwd, const char *name, const char *dir,
+                      const char *link) {
+    char target[1024], path[1024];
+    snprintf(target, sizeof(target), "%s/lib/vadpcm/data/%s", cwd, name);
+    snprintf(path, sizeof(path), "%s/%s", dir, link);
+    if (symlink(target, path) != 0) {
+        die_errno(errno, "symlink %s", path);
+    }
+}
+
+// Check that directory mode pairs up files by name and reports missing
+// reference files as errors.
+static void test_dir(void) {
+    char cwd[512], root[512], ref[600], enc[600];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        die_errno(errno, "getcwd");
+    }
+    const char *tmpdir = getenv("TEST_TMPDIR");
+    snprintf(root, sizeof(root), "%s/compare_test.XXXXXX",
+             tmpdir != NULL ? tmpdir : "/tmp");
+    if (mkdtemp(root) == NULL) {
+        die_errno(errno, "mkdtemp");
+    }
+    snprintf(ref, sizeof(ref), "%s/ref", root);
+    snprintf(enc, sizeof(enc), "%s/enc", root);
+    if (mkdir(ref, 0777) != 0 || mkdir(enc, 0777) != 0) {
+        die_errno(errno, "mkdir");
+    }
+    test_link(cwd, "sfx1.pcm.aiff", ref, "sfx1.aiff");
+    test_link(cwd, "sfx1.adpcm.aifc", enc, "sfx1.aifc");
+    test_link(cwd, "sfx1.adpcm.aifc", enc, "missing.aifc");
+    test_link(cwd, "sfx1.pcm.aiff", enc, "sfx1.aiff");
+    if (!is_dir(ref) || !is_dir(enc)) {
+        fputs("error: test_dir: is_dir returned false\n", stderr);
+        test_failure_count++;
+    }
+
+    size_t job_count;
+    struct job *jobs = list_jobs(ref, enc, &job_count);
+    run_jobs(jobs, job_count, 2, 5);
+    if (job_count != 2) {
+        fprintf(stderr, "error: test_dir: job count = %zu, expected 2\n",
+                job_count);
+        test_failure_count++;
+    } else {
+        if (strcmp(jobs[0].encoded + strlen(enc), "/missing.aifc") != 0 ||
+            jobs[0].error[0] == '\0') {
+            fprintf(stderr, "error: test_dir: job 0: %s: error = \"%s\"\n",
+                    jobs[0].encoded, jobs[0].error);
+            test_failure_count++;
+        }
+        if (strcmp(jobs[1].encoded + strlen(enc), "/sfx1.aifc") != 0 ||
+            jobs[1].error[0] != '\0') {
+            fprintf(stderr, "error: test_dir: job 1: %s: error = \"%s\"\n",
+                    jobs[1].encoded, jobs[1].error);
+            test_failure_count++;
+        }
+    }
+    for (size_t i = 0; i < job_count; i++) {
+        free(jobs[i].reference);
+        free(jobs[i].encoded);
+    }
+    free(jobs);
+
+    static const char *const kPaths[] = {
+        "ref/sfx1.aiff", "enc/sfx1.aifc", "enc/missing.aifc",
+        "enc/sfx1.aiff", "ref",           "enc",
+    };
+    for (size_t i = 0; i < ARRAY_COUNT(kPaths); i++) {
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", root, kPaths[i]);
+        remove(path);
+    }
+    rmdir(root);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    test_compare();
+    test_write_json();
+    test_file("sfx1");
+    test_dir();
+
+    if (test_failure_count > 0) {
+        fprintf(stderr, "tests failed: %d\n", test_failure_count);
+        return 1;
+    }
+    fputs("all tests passed\n", stderr);
+    return 0;
+}
+
+#endif // TEST
@@ -200,13 +200,17 @@ func makeCodebookChunk(codebook *vadpcm.Codebook) *aiff.VADPCMCodes {
 	}
 }
 
-var flagPredictorCount int
+var (
+	flagPredictorCount int
+	flagClosedLoop     bool
+	flagTargetSNR      float64
+)
 
 var cmdEncode = cobra.Command{
 	Use:   "encode <input> <output.aifc>",
 	Short: "Encode an audio file using VADPCM.",
 	Args:  cobra.ExactArgs(2),
-	RunE: func(_ *cobra.Command, args []string) error {
+	RunE: func(cmd *cobra.Command, args []string) error {
 		filein := args[0]
 		fileout := args[1]
 		if ext := filepath.Ext(fileout); !strings.EqualFold(ext, ".aifc") {
@@ -226,11 +230,31 @@ var cmdEncode = cobra.Command{
 		if len(ad.samples) < nframes {
 			ad.samples = append(ad.samples, make([]int16, nframes-len(ad.samples))...)
 		}
-		codebook, vdata, err := vadpcm.Encode(&vadpcm.Parameters{
+		params := vadpcm.Parameters{
 			PredictorCount: flagPredictorCount,
-		}, ad.samples)
-		if err != nil {
-			return err
+			ClosedLoop:     flagClosedLoop,
+			TargetSNR:      flagTargetSNR,
+		}
+		var codebook *vadpcm.Codebook
+		var vdata []byte
+		if flagTargetSNR > 0 {
+			if !cmd.Flags().Changed("predictor-count") {
+				params.PredictorCount = vadpcm.MaxPredictorCount
+			}
+			var snr float64
+			codebook, vdata, snr, err = vadpcm.EncodeAuto(&params, ad.samples)
+			if err != nil {
+				return err
+			}
+			logrus.Infof("predictor count: %d, SNR: %.1f dB", codebook.PredictorCount, snr)
+			if snr < flagTargetSNR {
+				logrus.Warnf("target SNR not met: %.1f dB", flagTargetSNR)
+			}
+		} else {
+			codebook, vdata, err = vadpcm.Encode(&params, ad.samples)
+			if err != nil {
+				return err
+			}
 		}
 		o := aiff.AIFF{
 			Common: aiff.Common{
@@ -262,6 +286,10 @@ func main() {
 	f := cmdEncode.Flags()
 	f.IntVar(&flagPredictorCount, "predictor-count", 4,
 		"number of VADPCM predictors, 1-16")
+	f.BoolVar(&flagClosedLoop, "closed-loop", false,
+		"choose the predictor for each frame by trial encoding")
+	f.Float64Var(&flagTargetSNR, "target-snr", 0,
+		"use the smallest predictor count that meets this SNR, in dB")
 	if err := cmdRoot.Execute(); err != nil {
 		logrus.Error(err)
 		os.Exit(1)